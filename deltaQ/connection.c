@@ -234,95 +234,87 @@ int
 connection_init_indexes (struct connection_class *connection,
 			 struct scenario_class *scenario)
 {
-  int i, j;
-  int found_nodes = 0;
+  int j;
   struct node_class *node;
 
   // check if "from_node_index" or "to_node_index" are not initialized
   if (connection->from_node_index == INVALID_INDEX ||
       connection->to_node_index == INVALID_INDEX)
     {
-      // try to find the "from_node" and "to_node" in scenario
-      for (i = 0; i < scenario->node_number; i++)
+      // try to identify from_node
+      connection->from_node_index =
+	scenario_find_node (scenario, connection->from_node);
+      if (connection->from_node_index != INVALID_INDEX)
 	{
-	  node = &(scenario->nodes[i]);
+	  node = &(scenario->nodes[connection->from_node_index]);
 
-	  // try to identify from_node
-	  if (strcmp (node->name, connection->from_node) == 0)
+	  // check whether a from_interface was defined
+	  if (strcmp (connection->from_interface, DEFAULT_STRING) == 0)
 	    {
-	      connection->from_node_index = i;
-	      found_nodes++;
-
-	      // check whether a from_interface was defined
-	      if (strcmp (connection->from_interface, DEFAULT_STRING) == 0)
-		{
-		  // from_interface uses default value => assume interface 0
-		  connection->from_interface_index = 0;
-		  connection->from_id = node->interfaces[0].id;
-		}
-	      else		// try to find from_interface among those of the node
+	      // from_interface uses default value => assume interface 0
+	      connection->from_interface_index = 0;
+	      connection->from_id = node->interfaces[0].id;
+	    }
+	  else		// try to find from_interface among those of the node
+	    {
+	      for (j = 0; j < node->if_num; j++)
+		if (strcmp (node->interfaces[j].name,
+			    connection->from_interface) == 0)
+		  {
+		    connection->from_interface_index = j;
+		    connection->from_id = node->interfaces[j].id;
+		    break;
+		  }
+
+	      // if j equals node->if_num, then the from_interface 
+	      // could not be found => return ERROR
+	      if (j >= node->if_num)
 		{
-		  for (j = 0; j < node->if_num; j++)
-		    if (strcmp (node->interfaces[j].name,
-				connection->from_interface) == 0)
-		      {
-			connection->from_interface_index = j;
-			connection->from_id = node->interfaces[j].id;
-			break;
-		      }
-
-		  // if j equals node->if_num, then the from_interface 
-		  // could not be found => return ERROR
-		  if (j >= node->if_num)
-		    {
-		      WARNING
-			("Connection attribute '%s' with value '%s' does not exist for node '%s'.",
-			 CONNECTION_FROM_INTERFACE_STRING,
-			 connection->from_interface, connection->from_node);
-		      return ERROR;
-		    }
+		  WARNING
+		    ("Connection attribute '%s' with value '%s' does not exist for node '%s'.",
+		     CONNECTION_FROM_INTERFACE_STRING,
+		     connection->from_interface, connection->from_node);
+		  return ERROR;
 		}
 	    }
+	}
 
-	  // try to identify to_node
-	  if (strcmp (node->name, connection->to_node) == 0)
-	    {
-	      connection->to_node_index = i;
-	      found_nodes++;
+      // try to identify to_node
+      connection->to_node_index =
+	scenario_find_node (scenario, connection->to_node);
+      if (connection->to_node_index != INVALID_INDEX)
+	{
+	  node = &(scenario->nodes[connection->to_node_index]);
 
-	      // check whether a to_interface was defined
-	      if (strcmp (connection->to_interface, DEFAULT_STRING) == 0)
-		{
-		  // to_interface uses default value => assume interface 0
-		  connection->to_interface_index = 0;
-		  connection->to_id = node->interfaces[0].id;
-		}
-	      else		// try to find to_interface among those of the node
+	  // check whether a to_interface was defined
+	  if (strcmp (connection->to_interface, DEFAULT_STRING) == 0)
+	    {
+	      // to_interface uses default value => assume interface 0
+	      connection->to_interface_index = 0;
+	      connection->to_id = node->interfaces[0].id;
+	    }
+	  else		// try to find to_interface among those of the node
+	    {
+	      for (j = 0; j < node->if_num; j++)
+		if (strcmp (node->interfaces[j].name,
+			    connection->to_interface) == 0)
+		  {
+		    connection->to_interface_index = j;
+		    connection->to_id = node->interfaces[j].id;
+		    break;
+		  }
+
+	      // if j equals node->if_num, then the to_interface 
+	      // could not be found => return ERROR
+	      if (j >= node->if_num)
 		{
-		  for (j = 0; j < node->if_num; j++)
-		    if (strcmp (node->interfaces[j].name,
-				connection->to_interface) == 0)
-		      {
-			connection->to_interface_index = j;
-			connection->to_id = node->interfaces[j].id;
-			break;
-		      }
-
-		  // if j equals node->if_num, then the to_interface 
-		  // could not be found => return ERROR
-		  if (j >= node->if_num)
-		    {
-		      WARNING
-			("Connection attribute '%s' with value '%s' does not exist for node '%s'.",
-			 CONNECTION_TO_INTERFACE_STRING,
-			 connection->to_interface, connection->to_node);
-		      return ERROR;
-		    }
+		  WARNING
+		    ("Connection attribute '%s' with value '%s' does not exist for node '%s'.",
+		     CONNECTION_TO_INTERFACE_STRING,
+		     connection->to_interface, connection->to_node);
+		  return ERROR;
 		}
 	    }
-
-	  if (found_nodes == 2)
-	    break;
 	}
     }
 
@@ -344,28 +336,9 @@ in scenario", connection->to_node);
 
   // check if "through_environment_index" not initialized
   if (connection->through_environment_index == INVALID_INDEX)
-    {
-      uint32_t through_environment_hash =
-	string_hash (connection->through_environment,
-		     strlen (connection->through_environment));
-      // try to find the through_environment in scenario
-      for (i = 0; i < scenario->environment_number; i++)
-	{			/*
-				   INFO("crt_name=%s crt_hash=%d  through=%s through_hash=%d",
-				   scenario->environments[i].name, 
-				   scenario->environments[i].name_hash,
-				   connection->through_environment,
-				   through_environment_hash);
-				 */
-	  if (scenario->environments[i].name_hash == through_environment_hash)
-	    if (strcmp (scenario->environments[i].name,
-			connection->through_environment) == 0)
-	      {
-		connection->through_environment_index = i;
-		break;
-	      }
-	}
-    }
+    // try to find the through_environment in scenario
+    connection->through_environment_index =
+      scenario_find_environment (scenario, connection->through_environment);
 
   // check if "through_environment" could not be found
   if (connection->through_environment_index == INVALID_INDEX)
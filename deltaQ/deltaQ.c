@@ -101,14 +101,24 @@ static struct option long_options[] = {
     {"output", 1, 0, 'o'},
 
     {"disable-deltaQ", 0, 0, 'd'},
+    {"seed", 1, 0, 'r'},
+    {"duration", 1, 0, 'u'},
+
+    {"save-snapshot", 1, 0, 'S'},
+    {"load-snapshot", 1, 0, 'L'},
 
     {0, 0, 0, 0}
 };
 
 // structure holding name of short options; 
 // should match the 'long_options' structure above 
-static char *short_options = "hvltbnmsjo:d";
+static char *short_options = "hvltbnmsjo:dr:u:S:L:";
+
 
+// state of the random number generator; it is saved in scenario
+// snapshots so that runs from a snapshot are identical to the run
+// that saved it
+static char random_state[SNAPSHOT_RANDOM_STATE_SIZE];
 
 // print license info
 static void
@@ -149,6 +159,7 @@ usage(f)
 FILE *f;
 {
     fprintf(f, "\nUsage: deltaQ [options] <scenario_file.xml>\n");
+    fprintf(f, "       deltaQ [options] --load-snapshot <snapshot_file>\n");
     fprintf(f, "General options:\n");
     fprintf(f, " -h, --help             - print this help message and exit\n");
     fprintf(f, " -v, --version          - print version information and exit\n");
@@ -164,6 +175,12 @@ FILE *f;
     fprintf(f, "                          instead of the input file name\n");
     fprintf(f, "Computation control:\n");
     fprintf(f, " -d, --disable-deltaQ   - disable deltaQ computation (output still generated)\n");
+    fprintf(f, " -r, --seed <seed>      - seed of the random number generator (default 1)\n");
+    fprintf(f, " -u, --duration <time>  - scenario duration in s, instead of that of the scenario\n");
+    fprintf(f, "Scenario snapshots:\n");
+    fprintf(f, " -S, --save-snapshot <file> - save the initialized scenario to <file>\n");
+    fprintf(f, " -L, --load-snapshot <file> - start from a scenario saved with '-S' instead\n");
+    fprintf(f, "                          of parsing and initializing a scenario file\n");
     fprintf(f, "\n");
     fprintf(f, "See the documentation for more usage details.\n");
     fprintf(f, "Please send any comments or bug reports to 'info@starbed.org'.\n\n");
@@ -312,6 +329,16 @@ char *argv[];
 
     // computation control variables
     int deltaQ_disabled;
+    unsigned int random_seed;
+    int random_seed_provided;
+    double duration;
+    int duration_provided;
+
+    // scenario snapshot variables
+    char save_snapshot_filename[MAX_STRING];
+    int save_snapshot_enabled;
+    char load_snapshot_filename[MAX_STRING];
+    int load_snapshot_enabled;
 
     struct io_connection_state_class io_connection_state;
 
@@ -368,6 +395,12 @@ char *argv[];
     no_deltaQ_enabled = FALSE;
     deltaQ_disabled = FALSE;
     object_output_enabled = FALSE;
+    random_seed = 1;
+    random_seed_provided = FALSE;
+    duration = 0;
+    duration_provided = FALSE;
+    save_snapshot_enabled = FALSE;
+    load_snapshot_enabled = FALSE;
 
     // parse options
     while((c = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
@@ -433,6 +466,28 @@ char *argv[];
             case 'd':
                 deltaQ_disabled = TRUE;
                 break;
+            case 'r':
+                random_seed = strtoul(optarg, NULL, 10);
+                random_seed_provided = TRUE;
+                break;
+            case 'u':
+                duration = double_value(optarg);
+                if(duration == -HUGE_VAL || duration < 0) {
+                    WARNING("Invalid scenario duration '%s'.", optarg);
+                    exit(1);
+                }
+                duration_provided = TRUE;
+                break;
+
+                // scenario snapshots
+            case 'S':
+                save_snapshot_enabled = TRUE;
+                strncpy(save_snapshot_filename, optarg, MAX_STRING - 1);
+                break;
+            case 'L':
+                load_snapshot_enabled = TRUE;
+                strncpy(load_snapshot_filename, optarg, MAX_STRING - 1);
+                break;
 
                 // unknown options
             case '?':
@@ -470,10 +525,17 @@ char *argv[];
         binary_output_enabled = FALSE;
     }
 
+    if(save_snapshot_enabled == TRUE && load_snapshot_enabled == TRUE) {
+        WARNING("The options 'save-snapshot' and 'load-snapshot' cannot be used together!");
+        usage(stdout);
+        exit(1);
+    }
+
     // optind represents the index where option parsing stopped
     // and where non-option arguments parsing can start;
-    // check whether non-option arguments are present
-    if(argc == optind) {
+    // check whether non-option arguments are present, unless
+    // the scenario is loaded from a snapshot
+    if(argc == optind && load_snapshot_enabled == FALSE) {
         WARNING("No scenario configuration file was provided.");
         printf("\n%s: A versatile wireless network emulator.\n", qomet_name);
         usage(stdout);
@@ -512,43 +574,70 @@ char *argv[];
     // initialize the scenario object
     scenario_init(&(xml_scenario->scenario));
 
-    ////////////////////////////////////////////////////////////
-    // scenario parsing phase
-    INFO("\n-- QOMET Emulator: Scenario Parsing --\n");
+    if(load_snapshot_enabled == TRUE) {
+        ////////////////////////////////////////////////////////////
+        // snapshot loading phase
+        INFO("\n-- QOMET Emulator: Snapshot Loading --\n");
 
-    if(strlen(argv[optind]) > MAX_STRING) {
-        WARNING("Input file name '%s' longer than %d characters!", argv[optind], MAX_STRING);
-        goto ERROR_HANDLE;
+        strncpy(scenario_filename, load_snapshot_filename, MAX_STRING - 1);
+
+        // set the output filename base to the snapshot filename
+        // if no output filename base was provided
+        if(output_filename_provided == FALSE) {
+            strncpy(output_filename_base, scenario_filename, MAX_STRING - 1);
+        }
+
+        if(snapshot_load(xml_scenario, deltaQ_disabled, random_state, scenario_filename) == ERROR) {
+            WARNING("Cannot load snapshot file '%s'!", scenario_filename);
+            goto ERROR_HANDLE;
+        }
+
+        INFO("Snapshot file '%s' loaded.", scenario_filename);
     }
     else {
-        strncpy(scenario_filename, argv[optind], MAX_STRING - 1);
-    }
+        ////////////////////////////////////////////////////////////
+        // scenario parsing phase
+        INFO("\n-- QOMET Emulator: Scenario Parsing --\n");
 
-    // set the output filename base to the scenario filename
-    // if no output filename base was provided
-    if(output_filename_provided == FALSE) {
-        strncpy(output_filename_base, scenario_filename, MAX_STRING - 1);
-    }
+        if(strlen(argv[optind]) > MAX_STRING) {
+            WARNING("Input file name '%s' longer than %d characters!", argv[optind], MAX_STRING);
+            goto ERROR_HANDLE;
+        }
+        else {
+            strncpy(scenario_filename, argv[optind], MAX_STRING - 1);
+        }
 
-    // open scenario file
-    scenario_file = fopen(scenario_filename, "r");
-    if(scenario_file == NULL) {
-        WARNING("Cannot open scenario file '%s'!", scenario_filename);
-        goto ERROR_HANDLE;
-    }
+        // set the output filename base to the scenario filename
+        // if no output filename base was provided
+        if(output_filename_provided == FALSE) {
+            strncpy(output_filename_base, scenario_filename, MAX_STRING - 1);
+        }
 
-    // parse scenario file
-    if(xml_scenario_parse(scenario_file, xml_scenario) == ERROR) {
-        WARNING("Cannot parse scenario file '%s'!", scenario_filename);
-        goto ERROR_HANDLE;
-    }
+        // open scenario file
+        scenario_file = fopen(scenario_filename, "r");
+        if(scenario_file == NULL) {
+            WARNING("Cannot open scenario file '%s'!", scenario_filename);
+            goto ERROR_HANDLE;
+        }
+
+        // parse scenario file
+        if(xml_scenario_parse(scenario_file, xml_scenario) == ERROR) {
+            WARNING("Cannot parse scenario file '%s'!", scenario_filename);
+            goto ERROR_HANDLE;
+        }
 
-    // print parse summary
-    INFO("Scenario file '%s' parsed.", scenario_filename);
+        // print parse summary
+        INFO("Scenario file '%s' parsed.", scenario_filename);
 #ifdef MESSAGE_DEBUG
-    DEBUG("Loaded scenario file summary:");
-    xml_scenario_print (xml_scenario);
+        DEBUG("Loaded scenario file summary:");
+        xml_scenario_print (xml_scenario);
 #endif
+    }
+
+    // the duration given as option replaces that of the scenario
+    if(duration_provided == TRUE) {
+        xml_scenario->duration = duration;
+    }
 
     // even more initialization
     motion_step = xml_scenario->step / xml_scenario->motion_step_divider;
@@ -565,13 +654,22 @@ char *argv[];
     // number generator seed to values obtained from the clock. This causes
     // random values computed by us to change at each run. To fix this
     // we initialize the random number generator seed to its default
-    // value (1).
+    // value (1), or to the seed given as option.
     // References:
     // [1] http://cmeerw.org/blog/759.html
     // [2] https://bugzilla.redhat.com/show_bug.cgi?id=786617
     // [3] https://rhn.redhat.com/errata/RHSA-2012-0731.html
-    DEBUG("Initialize random seed because it was changed by expat during parsing.\n");
-    srand(1);
+    // The generator uses 'random_state', so that its state can be saved
+    // in snapshots; runs from a snapshot continue the sequence of the
+    // run that saved it, unless a seed is given.
+    if(load_snapshot_enabled == TRUE && random_seed_provided == FALSE) {
+        DEBUG("Restore random generator state saved in snapshot.\n");
+        setstate(random_state);
+    }
+    else {
+        DEBUG("Initialize random seed because it was changed by expat during parsing.\n");
+        initstate(random_seed, random_state, SNAPSHOT_RANDOM_STATE_SIZE);
+    }
 
     INFO("\n-- QOMET Emulator: Scenario Computation --");
 
@@ -702,13 +800,31 @@ char *argv[];
     INFO("\n-- Scenario initialization:");
     fprintf(stderr, "\n-- Scenario initialization:\n");
 
-    if(scenario_init_state(scenario, xml_scenario->jpgis_filename_provided, xml_scenario->jpgis_filename,
+    if(load_snapshot_enabled == TRUE) {
+        // the snapshot holds the initialized scenario
+        fprintf(stderr, "* Scenario loaded from snapshot (%d nodes, %d objects, %d connections)\n",
+                scenario->node_number, scenario->object_number, scenario->connection_number);
+    }
+    else if(scenario_init_state(scenario, xml_scenario->jpgis_filename_provided, xml_scenario->jpgis_filename,
                 xml_scenario->cartesian_coord_syst, deltaQ_disabled) == ERROR) {
         fflush(stdout);
         WARNING("Error during scenario initialization. Aborting...");
         goto ERROR_HANDLE;
     }
 
+    // save the initialized scenario if requested
+    if(save_snapshot_enabled == TRUE) {
+        // setstate() makes the generator record its position
+        // in 'random_state' before the state is saved
+        setstate(random_state);
+
+        if(snapshot_save(xml_scenario, deltaQ_disabled, random_state, save_snapshot_filename) == ERROR) {
+            WARNING("Cannot save snapshot file '%s'!", save_snapshot_filename);
+            goto ERROR_HANDLE;
+        }
+        fprintf(stderr, "* Scenario snapshot saved to '%s'\n", save_snapshot_filename);
+    }
+
     // it is now late enough to output objects if enabled
     if(object_output_enabled == TRUE) {
         // prepare object output filename
@@ -234,19 +234,15 @@ int
 motion_init_index (struct motion_class *motion,
 		   struct scenario_class *scenario, int cartesian_coord_syst)
 {
-  int i;
-
   if (motion->node_index == INVALID_INDEX)	// node_index not initialized
-    // try to find corresponding node in scenario
-    for (i = 0; i < scenario->node_number; i++)
-      if (strcmp (scenario->nodes[i].name, motion->node_name) == 0)
-	{
-	  motion->node_index = i;
-	  // copy also the motion index to the node 
-	  // for use in mobility calculations (e.g., behavioral model)
-	  (scenario->nodes[i]).motion_index = motion->id;
-	  break;
-	}
+    {
+      // try to find corresponding node in scenario
+      motion->node_index = scenario_find_node (scenario, motion->node_name);
+      if (motion->node_index != INVALID_INDEX)
+	// copy also the motion index to the node 
+	// for use in mobility calculations (e.g., behavioral model)
+	(scenario->nodes[motion->node_index]).motion_index = motion->id;
+    }
 
   if (motion->node_index == INVALID_INDEX)	// node could not be found
     {
@@ -145,17 +145,11 @@ int
 object_init_index (struct object_class *object,
 		   struct scenario_class *scenario)
 {
-  int i;
-
   // check if "environment_index" is not initialized
   if (object->environment_index == INVALID_INDEX)
     // try to find the named environment in scenario
-    for (i = 0; i < scenario->environment_number; i++)
-      if (strcmp (scenario->environments[i].name, object->environment) == 0)
-	{
-	  object->environment_index = i;
-	  break;
-	}
+    object->environment_index =
+      scenario_find_environment (scenario, object->environment);
 
   // check if "environment_index" could not be found
   if (object->environment_index == INVALID_INDEX)
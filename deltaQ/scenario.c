@@ -20,6 +20,7 @@
  ***********************************************************************/
 
 
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
@@ -32,6 +33,64 @@
 #include "xml_jpgis.h"
 
 
+/////////////////////////////////////////
+// Name index functions
+/////////////////////////////////////////
+
+// return the slot of the hash table 'name_index' that holds 'name',
+// or the empty slot where it would be inserted; the name of element
+// i is found at 'names' + i * 'stride', so that the same table code
+// serves nodes and environments
+static int
+name_index_slot (int *name_index, char *name, char *names, size_t stride)
+{
+  uint32_t slot = string_hash (name, strlen (name)) & (NAME_INDEX_SIZE - 1);
+
+  while (name_index[slot] != 0
+	 && strcmp (names + (name_index[slot] - 1) * stride, name) != 0)
+    slot = (slot + 1) & (NAME_INDEX_SIZE - 1);
+
+  return slot;
+}
+
+// add element 'index' named 'name' to the hash table 'name_index'; if
+// the name is already present, the first element keeps it, as it was
+// the one found by the former linear searches
+static void
+name_index_add (int *name_index, int index, char *name, char *names,
+		size_t stride)
+{
+  int slot = name_index_slot (name_index, name, names, stride);
+
+  if (name_index[slot] == 0)
+    name_index[slot] = index + 1;
+}
+
+// return the index of the node named 'name' in the scenario,
+// or INVALID_INDEX if there is no such node
+int
+scenario_find_node (struct scenario_class *scenario, char *name)
+{
+  return scenario->node_name_index[name_index_slot
+				   (scenario->node_name_index, name,
+				    scenario->nodes[0].name,
+				    sizeof (struct node_class))] - 1;
+}
+
+// return the index of the environment named 'name' in the scenario,
+// or INVALID_INDEX if there is no such environment
+int
+scenario_find_environment (struct scenario_class *scenario, char *name)
+{
+  return scenario->environment_name_index[name_index_slot
+					  (scenario->environment_name_index,
+					   name,
+					   scenario->environments[0].name,
+					   sizeof (struct environment_class))]
+    - 1;
+}
+
+
 /////////////////////////////////////////
 // Scenario structure functions
 /////////////////////////////////////////
@@ -48,6 +107,11 @@ scenario_init (struct scenario_class *scenario)
   scenario->connection_number = 0;
   scenario->if_num = 0;
 
+  // empty the name indexes
+  memset (scenario->node_name_index, 0, sizeof (scenario->node_name_index));
+  memset (scenario->environment_name_index, 0,
+	  sizeof (scenario->environment_name_index));
+
   scenario->current_time = 0.0;
 }
 
@@ -75,6 +139,9 @@ scenario_add_node (struct scenario_class *scenario, struct node_class *node)
       node->id = scenario->node_number;
 
       node_copy (&(scenario->nodes[scenario->node_number]), node);
+      name_index_add (scenario->node_name_index, scenario->node_number,
+		      node->name, scenario->nodes[0].name,
+		      sizeof (struct node_class));
       return_value = &(scenario->nodes[scenario->node_number]);
       scenario->node_number++;
     }
@@ -127,6 +194,10 @@ scenario_add_environment (struct scenario_class *scenario,
       environment_copy (&
 			(scenario->environments
 			 [scenario->environment_number]), environment);
+      name_index_add (scenario->environment_name_index,
+		      scenario->environment_number, environment->name,
+		      scenario->environments[0].name,
+		      sizeof (struct environment_class));
       return_value = &(scenario->environments[scenario->environment_number]);
       scenario->environment_number++;
     }
@@ -185,7 +256,6 @@ scenario_add_connection (struct scenario_class *scenario,
   char environment_base_name[MAX_STRING];
 
   int node_i, env_i;
-  uint32_t through_environment_hash;
 
   struct environment_class *add_env_result = NULL;
 
@@ -200,36 +270,10 @@ connections...", connection->from_node);
       // check first if the environment provided was defined;
       // if so, use it _directly_, otherwise create new environments
       // for each connection (a warning will be issued in this case)
-      through_environment_hash =
-	string_hash (connection->through_environment,
-		     strlen (connection->through_environment));
-
       // try to find the through_environment in scenario
-      for (env_i = 0; env_i < scenario->environment_number; env_i++)
-	{
-	  if (scenario->environments[env_i].name_hash ==
-	      through_environment_hash)
-	    if (strcmp (scenario->environments[env_i].name,
-			connection->through_environment) == 0)
-	      {
-		/*
-		   if (scenario->environments[env_i].is_dynamic == TRUE)
-		   {
-		   WARNING ("ERROR: Environment '%s' is dynamic, and cannot be used to \
-		   define multiple connections", connection->
-		   through_environment);
-		   return NULL;
-		   }
-		   else
-		   {
-		 */
-		connection->through_environment_index = env_i;
-		break;
-		/*
-		   }
-		 */
-	      }
-	}
+      connection->through_environment_index =
+	scenario_find_environment (scenario,
+				   connection->through_environment);
 
       // environment was not previously defined, a new one must be
       // created now for each connection (dynamic type)
@@ -336,30 +380,19 @@ connections...");
       // check first if the environment provided was defined;
       // if so, use it _directly_, otherwise create new environments
       // for each connection (a warning will be issued in this case)
-      through_environment_hash =
-	string_hash (connection->through_environment,
-		     strlen (connection->through_environment));
-
       // try to find the through_environment in scenario
-      for (env_i = 0; env_i < scenario->environment_number; env_i++)
+      env_i = scenario_find_environment (scenario,
+					 connection->through_environment);
+      if (env_i != INVALID_INDEX)
 	{
-	  if (scenario->environments[env_i].name_hash ==
-	      through_environment_hash)
-	    if (strcmp (scenario->environments[env_i].name,
-			connection->through_environment) == 0)
-	      {
-		if (scenario->environments[env_i].is_dynamic == TRUE)
-		  {
-		    WARNING ("ERROR: Environment '%s' is dynamic, and cannot \
+	  if (scenario->environments[env_i].is_dynamic == TRUE)
+	    {
+	      WARNING ("ERROR: Environment '%s' is dynamic, and cannot \
 be used to define multiple connections", connection->through_environment);
-		    return NULL;
-		  }
-		else
-		  {
-		    connection->through_environment_index = env_i;
-		    break;
-		  }
-	      }
+	      return NULL;
+	    }
+	  else
+	    connection->through_environment_index = env_i;
 	}
 
       // environment was not previously defined, a new one must be
@@ -631,63 +664,12 @@ scenario_init_state (struct scenario_class *scenario,
 
   // try to merge the objects to form polygons; this may be needed,
   // for example, for the objects that been loaded as polylines 
-  // from the JPGIS file; failure to merge a polyline to any of the 
-  // current objects will result in an error
-  while (1)
+  // from the JPGIS file; polylines that cannot be merged into
+  // a polygon are removed
+  if (scenario_merge_polylines (scenario) == ERROR)
     {
-      int merge_done = FALSE;
-      int tested_objects = 0;
-
-      // loop for each object
-      for (object_i = 0; object_i < scenario->object_number; object_i++)
-	{
-	  struct object_class *crt_object = &(scenario->objects[object_i]);
-
-	  // check that first coordinate and last coordinate 
-	  // are equal, which is the convention used in JPGIS
-	  // to represent polygons
-	  if ((fabs (crt_object->vertices[0].c[0] - crt_object->vertices
-		     [crt_object->vertex_number - 1].c[0]) > EPSILON) ||
-	      (fabs (crt_object->vertices[0].c[1] - crt_object->vertices
-		     [crt_object->vertex_number - 1].c[1]) > EPSILON))
-	    {
-	      if (crt_object->make_polygon == TRUE)
-		{
-		  INFO ("The polyline object '%s' is considered a polygon; \
-no merging necessary", crt_object->name);
-		  tested_objects++;
-		  continue;
-		}
-	      else
-		DEBUG
-		  ("The object '%s' is not a polygon. Trying to merge...",
-		   crt_object->name);
-
-	      // try to merge this object with another one
-	      merge_done = scenario_try_merge_object (scenario, object_i);
-
-	      if (merge_done == FALSE)
-		{
-		  DEBUG ("Unable to merge, removing object '%s'...",
-			 scenario->objects[object_i].name);
-		  scenario_remove_object (scenario, object_i);
-
-#ifdef MESSAGE_DEBUG
-		  scenario_print (scenario);
-
-		  // loop for each object
-		  for (object_i = 0; object_i < scenario->object_number;
-		       object_i++)
-		    object_print (&(scenario->objects[object_i]));
-#endif
-		  //              return ERROR;
-		}
-	    }
-	  else
-	    tested_objects++;
-	}
-      if (tested_objects == scenario->object_number)
-	break;
+      WARNING ("Error while merging polyline objects");
+      return ERROR;
     }
 
   fprintf (stderr,
@@ -892,194 +874,271 @@ scenario_reset_node_interference_flag (struct scenario_class *scenario)
     }
 }
 
-// try to merge an object specified by index 'merge_object_i' to other
-// objects in scenario; 
-// return TRUE if a merge operation was performed, FALSE otherwise
-int
-scenario_try_merge_object (struct scenario_class *scenario,
-			   int merge_object_i)
+// return the hash of the cell of the endpoint grid used by
+// scenario_merge_polylines; points that are closer than EPSILON
+// on both axes are in the same cell or in adjacent cells
+static uint32_t
+endpoint_cell_hash (long long cell_x, long long cell_y)
 {
-  int crt_object_j;
-  struct object_class *merge_object = &(scenario->objects[merge_object_i]);
-
-  // loop for each object
-  for (crt_object_j = 0; crt_object_j < scenario->object_number;
-       crt_object_j++)
-    {
-      struct object_class *crt_object = &(scenario->objects[crt_object_j]);
+  uint64_t hash = (uint64_t) cell_x * 0x9E3779B97F4A7C15ULL
+    ^ (uint64_t) cell_y * 0xC2B2AE3D27D4EB4FULL;
 
-      if (merge_object_i == crt_object_j)
-	continue;
-
-#ifdef MESSAGE_DEBUG
-      object_print (merge_object);
+  return (uint32_t) (hash >> 32);
+}
 
-      DEBUG ("Checking object '%s' (index=%d) for merge...",
-	     crt_object->name, crt_object_j);
-      object_print (crt_object);
-#endif
+// return the endpoint 'endpoint' of the polyline objects 'pieces' of
+// scenario_merge_polylines; endpoint 2 * i is the first vertex of
+// piece i, and endpoint 2 * i + 1 is its last vertex
+static struct coordinate_class *
+endpoint_vertex (struct scenario_class *scenario, int *pieces, int endpoint)
+{
+  struct object_class *object = &(scenario->objects[pieces[endpoint / 2]]);
 
-      // first vertex equals last vertex
-      if ((fabs (merge_object->vertices[0].c[0] -
-		 crt_object->vertices[crt_object->vertex_number - 1].c[0]) <
-	   EPSILON) &&
-	  (fabs (merge_object->vertices[0].c[1] -
-		 crt_object->vertices[crt_object->vertex_number - 1].c[1]) <
-	   EPSILON))
-	{
-	  INFO ("Merging object '%s' to object '%s' by direct appending...",
-		merge_object->name, crt_object->name);
+  if (endpoint % 2 == 0)
+    return &(object->vertices[0]);
+  else
+    return &(object->vertices[object->vertex_number - 1]);
+}
 
-	  if (scenario_merge_objects (scenario, crt_object_j,
-				      merge_object_i, TRUE) == SUCCESS)
-	    return TRUE;
-	  else
-	    return FALSE;
-	}
-      // first vertex equals first vertex!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-      else if ((fabs (merge_object->vertices[0].c[0] -
-		      crt_object->vertices[0].c[0]) < EPSILON) &&
-	       (fabs (merge_object->vertices[0].c[1] -
-		      crt_object->vertices[0].c[1]) < EPSILON))
-	{
-	  INFO
-	    ("Merging object '%s' to object '%s' by direct appending after reversing...",
-	     merge_object->name, crt_object->name);
+// add the endpoint 'endpoint' of the polyline objects 'pieces'
+// to the hash table 'endpoint_index'
+static void
+endpoint_index_add (struct scenario_class *scenario, int *pieces,
+		    int *endpoint_index, uint32_t mask, int endpoint)
+{
+  struct coordinate_class *vertex =
+    endpoint_vertex (scenario, pieces, endpoint);
+  uint32_t slot = endpoint_cell_hash (llround (vertex->c[0] / EPSILON),
+				      llround (vertex->c[1] / EPSILON)) & mask;
+
+  while (endpoint_index[slot] != 0)
+    slot = (slot + 1) & mask;
+  endpoint_index[slot] = endpoint + 1;
+}
 
-	  if (scenario_merge_objects (scenario, crt_object_j,
-				      merge_object_i, TRUE) == SUCCESS)
-	    return TRUE;
-	  else
-	    return FALSE;
-	}
-      // last vertex equals first vertex
-      else
-	if ((fabs
-	     (merge_object->vertices[merge_object->vertex_number - 1].c[0] -
-	      crt_object->vertices[0].c[0]) < EPSILON)
-	    &&
-	    (fabs
-	     (merge_object->vertices[merge_object->vertex_number - 1].c[1] -
-	      crt_object->vertices[0].c[1]) < EPSILON))
-	{
-	  INFO ("Merging object '%s' to object '%s' by direct appending...",
-		crt_object->name, merge_object->name);
-	  if (scenario_merge_objects (scenario, merge_object_i,
-				      crt_object_j, TRUE) == SUCCESS)
-	    return TRUE;
-	  else
-	    return FALSE;
-	}
-      // last vertex equals last vertex
-      else
-	if ((fabs
-	     (merge_object->vertices[merge_object->vertex_number - 1].c[0] -
-	      crt_object->vertices[crt_object->vertex_number - 1].c[0]) <
-	     EPSILON)
-	    &&
-	    (fabs
-	     (merge_object->vertices[merge_object->vertex_number - 1].c[1] -
-	      crt_object->vertices[crt_object->vertex_number - 1].c[1]) <
-	     EPSILON))
+// return an endpoint of a piece not yet used that is closer than
+// EPSILON on both axes to 'vertex', or -1 if there is none
+static int
+endpoint_index_find (struct scenario_class *scenario, int *pieces,
+		     char *piece_used, int *endpoint_index, uint32_t mask,
+		     struct coordinate_class *vertex)
+{
+  long long cell_x = llround (vertex->c[0] / EPSILON);
+  long long cell_y = llround (vertex->c[1] / EPSILON);
+  struct coordinate_class *candidate;
+  uint32_t slot;
+  int dx, dy, endpoint;
+
+  for (dx = -1; dx <= 1; dx++)
+    for (dy = -1; dy <= 1; dy++)
+      for (slot = endpoint_cell_hash (cell_x + dx, cell_y + dy) & mask;
+	   endpoint_index[slot] != 0; slot = (slot + 1) & mask)
 	{
-	  INFO ("Merging object '%s' to object '%s' by reverse appending...",
-		crt_object->name, merge_object->name);
-	  if (scenario_merge_objects (scenario, merge_object_i,
-				      crt_object_j, FALSE) == SUCCESS)
-	    return TRUE;
-	  else
-	    return FALSE;
+	  endpoint = endpoint_index[slot] - 1;
+	  if (piece_used[endpoint / 2] == TRUE)
+	    continue;
+
+	  candidate = endpoint_vertex (scenario, pieces, endpoint);
+	  if (fabs (candidate->c[0] - vertex->c[0]) < EPSILON
+	      && fabs (candidate->c[1] - vertex->c[1]) < EPSILON)
+	    return endpoint;
 	}
-    }
 
-  return FALSE;
+  return -1;
 }
 
-// merge the object specified by index 'object_i2' to the 
-// one specified by index 'object_i1'; if direct_merge is TRUE,
-// then direct vertex merging is done, by appending those of 
-// object 2 to those of object 1; if direct_merge is FALSE,
-// then the order of vertices of object 2 is reversed while merging;
+// merge the polyline objects that have the same first and last
+// vertex into polygons, which is the convention used in JPGIS
+// to represent polygons, and remove the polylines that cannot be
+// merged; objects with the 'make_polygon' flag set and objects that
+// are already polygons are kept unchanged; the endpoints of the
+// polylines are indexed in a hash table, so that each polygon is
+// built by following its pieces, and the object array is compacted
+// once at the end;
 // return SUCCESS on success, ERROR on error
 int
-scenario_merge_objects (struct scenario_class *scenario, int object_i1,
-			int object_i2, int direct_merge)
+scenario_merge_polylines (struct scenario_class *scenario)
 {
-  int i;
-  struct object_class *object1 = &(scenario->objects[object_i1]);
-  struct object_class *object2 = &(scenario->objects[object_i2]);
+  struct coordinate_class chain[MAX_VERTICES];
+  int chain_length, chain_reversed, chain_closed, chain_overflow;
+  int *pieces, *chain_pieces, *endpoint_index;
+  char *piece_used, *object_removed;
+  int piece_number = 0, chain_piece_number;
+  int polygon_number = 0, removed_number = 0;
+  uint32_t index_size = 16;
+  int object_i, piece_i, endpoint, i, j;
+  struct object_class *object;
+  struct coordinate_class *first, *last;
+
+  pieces = (int *) malloc (scenario->object_number * sizeof (int) + 1);
+  chain_pieces = (int *) malloc (scenario->object_number * sizeof (int) + 1);
+  piece_used = (char *) calloc (scenario->object_number + 1, sizeof (char));
+  object_removed =
+    (char *) calloc (scenario->object_number + 1, sizeof (char));
+  while (index_size < 4 * (uint32_t) scenario->object_number)
+    index_size *= 2;
+  endpoint_index = (int *) calloc (index_size, sizeof (int));
+
+  if (pieces == NULL || chain_pieces == NULL || piece_used == NULL
+      || object_removed == NULL || endpoint_index == NULL)
+    {
+      WARNING ("Cannot allocate memory for merging polyline objects");
+      free (pieces);
+      free (chain_pieces);
+      free (piece_used);
+      free (object_removed);
+      free (endpoint_index);
+      return ERROR;
+    }
+
+  // collect the polylines to be merged and index their endpoints
+  for (object_i = 0; object_i < scenario->object_number; object_i++)
+    {
+      object = &(scenario->objects[object_i]);
+      if (object->vertex_number < 2)
+	continue;
+
+      first = &(object->vertices[0]);
+      last = &(object->vertices[object->vertex_number - 1]);
+      if (fabs (first->c[0] - last->c[0]) <= EPSILON
+	  && fabs (first->c[1] - last->c[1]) <= EPSILON)
+	continue;
+
+      if (object->make_polygon == TRUE)
+	{
+	  INFO ("The polyline object '%s' is considered a polygon; \
+no merging necessary", object->name);
+	  continue;
+	}
 
-  // check if direct vertex merging was requested
-  if (direct_merge == TRUE)
+      DEBUG ("The object '%s' is not a polygon. Trying to merge...",
+	     object->name);
+      pieces[piece_number] = object_i;
+      endpoint_index_add (scenario, pieces, endpoint_index, index_size - 1,
+			  2 * piece_number);
+      endpoint_index_add (scenario, pieces, endpoint_index, index_size - 1,
+			  2 * piece_number + 1);
+      piece_number++;
+    }
+
+  // follow the pieces of each polygon, starting from the first
+  // piece not yet used; when the end of the chain cannot be extended,
+  // the chain is reversed to extend its other end
+  for (piece_i = 0; piece_i < piece_number; piece_i++)
     {
-      // if first vertex equals first vertex, then the object1
-      // vertex order must first be reversed
-      if ((fabs (object1->vertices[0].c[0] -
-		 object2->vertices[0].c[0]) < EPSILON) &&
-	  (fabs (object1->vertices[0].c[1] -
-		 object2->vertices[0].c[1]) < EPSILON))
+      if (piece_used[piece_i] == TRUE)
+	continue;
+
+      object = &(scenario->objects[pieces[piece_i]]);
+      piece_used[piece_i] = TRUE;
+      chain_pieces[0] = piece_i;
+      chain_piece_number = 1;
+      for (i = 0; i < object->vertex_number; i++)
+	coordinate_copy (&(chain[i]), &(object->vertices[i]));
+      chain_length = object->vertex_number;
+      chain_reversed = FALSE;
+      chain_closed = FALSE;
+      chain_overflow = FALSE;
+
+      while (chain_closed == FALSE && chain_overflow == FALSE)
 	{
-	  struct coordinate_class aux_coord;
-	  INFO ("@@@@@@@@@@@@@@@@@@@@ Reversing");
-	  //object_print(object1);
+	  endpoint = endpoint_index_find (scenario, pieces, piece_used,
+					  endpoint_index, index_size - 1,
+					  &(chain[chain_length - 1]));
+	  if (endpoint == -1)
+	    {
+	      if (chain_reversed == TRUE)
+		break;
+
+	      for (i = 0; i < chain_length / 2; i++)
+		{
+		  struct coordinate_class aux_coord;
 
-	  for (i = 0; i < object1->vertex_number / 2; i++)
+		  coordinate_copy (&aux_coord, &(chain[i]));
+		  coordinate_copy (&(chain[i]), &(chain[chain_length - 1 - i]));
+		  coordinate_copy (&(chain[chain_length - 1 - i]), &aux_coord);
+		}
+	      chain_reversed = TRUE;
+	      continue;
+	    }
+
+	  piece_used[endpoint / 2] = TRUE;
+	  chain_pieces[chain_piece_number++] = endpoint / 2;
+	  object = &(scenario->objects[pieces[endpoint / 2]]);
+
+	  if (chain_length + object->vertex_number - 1 > MAX_VERTICES)
 	    {
-	      coordinate_copy (&aux_coord, &(object1->vertices[i]));
-	      coordinate_copy
-		(&(object1->vertices[i]),
-		 &(object1->vertices[object1->vertex_number - 1 - i]));
-	      coordinate_copy (&
-			       (object1->vertices
-				[object1->vertex_number - 1 - i]),
-			       &aux_coord);
-	      //INFO("-- after step %d (exchanging %d and %d)", i,
-	      //   i, object1->vertex_number-1-i);
-	      //object_print(object1);
+	      WARNING ("Maximum number of vertices (%d) exceeded",
+		       MAX_VERTICES);
+	      chain_overflow = TRUE;
+	      break;
 	    }
-	  //INFO("-- final");
-	  //object_print(object1);
+
+	  // append the vertices of the piece after the common one, in
+	  // direct order if the common vertex is its first vertex, and
+	  // in reverse order otherwise
+	  for (i = 1; i < object->vertex_number; i++)
+	    coordinate_copy (&(chain[chain_length++]),
+			     &(object->vertices[(endpoint % 2 == 0) ? i :
+						object->vertex_number - 1 - i]));
+
+	  chain_closed =
+	    (fabs (chain[0].c[0] - chain[chain_length - 1].c[0]) < EPSILON
+	     && fabs (chain[0].c[1] - chain[chain_length - 1].c[1]) < EPSILON);
 	}
 
-      // append vertices of object2 in direct order
-      for (i = 1; i < object2->vertex_number; i++)
-	if (object1->vertex_number < MAX_VERTICES)
-	  {
-	    coordinate_copy (&(object1->vertices[object1->vertex_number]),
-			     &(object2->vertices[i]));
-	    object1->vertex_number++;
-	  }
-	else
-	  {
-	    WARNING ("Maximum number of vertices (%d) exceeded",
-		     MAX_VERTICES);
-	    return ERROR;
-	  }
-    }
-  else				// reverse vertex merging
-    {
-      for (i = object2->vertex_number - 2; i >= 0; i--)
-	if (object1->vertex_number < MAX_VERTICES)
-	  {
-	    coordinate_copy (&(object1->vertices[object1->vertex_number]),
-			     &(object2->vertices[i]));
-	    object1->vertex_number++;
-	  }
-	else
+      if (chain_closed == TRUE && chain_overflow == FALSE)
+	{
+	  // store the polygon in the object of the first piece
+	  object = &(scenario->objects[pieces[piece_i]]);
+	  for (i = 0; i < chain_length; i++)
+	    coordinate_copy (&(object->vertices[i]), &(chain[i]));
+	  object->vertex_number = chain_length;
+
+	  for (j = 1; j < chain_piece_number; j++)
+	    {
+	      struct object_class *merged_object =
+		&(scenario->objects[pieces[chain_pieces[j]]]);
+
+	      INFO ("Merging object '%s' to object '%s'...",
+		    merged_object->name, object->name);
+	      strncat (object->name, merged_object->name,
+		       MAX_STRING - strlen (object->name) - 1);
+	      object_removed[pieces[chain_pieces[j]]] = TRUE;
+	    }
+	  polygon_number++;
+	}
+      else
+	for (j = 0; j < chain_piece_number; j++)
 	  {
-	    WARNING ("Maximum number of vertices (%d) exceeded",
-		     MAX_VERTICES);
-	    return ERROR;
+	    DEBUG ("Unable to merge, removing object '%s'...",
+		   scenario->objects[pieces[chain_pieces[j]]].name);
+	    object_removed[pieces[chain_pieces[j]]] = TRUE;
+	    removed_number++;
 	  }
     }
-  strncat (object1->name, object2->name,
-	   MAX_STRING - strlen (object1->name) - 1);
-
-#ifdef MESSAGE_DEBUG
-  object_print (object1);
-#endif
 
-  scenario_remove_object (scenario, object_i2);
+  // compact the object array
+  for (object_i = 0, j = 0; object_i < scenario->object_number; object_i++)
+    if (object_removed[object_i] == FALSE)
+      {
+	if (j != object_i)
+	  object_copy (&(scenario->objects[j]),
+		       &(scenario->objects[object_i]));
+	j++;
+      }
+  scenario->object_number = j;
+
+  if (piece_number > 0)
+    INFO ("Merged %d polyline objects into %d polygons, and removed %d \
+polyline objects that could not be merged", piece_number - removed_number,
+	  polygon_number, removed_number);
+
+  free (pieces);
+  free (chain_pieces);
+  free (piece_used);
+  free (object_removed);
+  free (endpoint_index);
 
   return SUCCESS;
 }
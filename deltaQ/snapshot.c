@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2006-2013 The StarBED Project  All rights reserved.
+ *
+ * See the file 'LICENSE' for licensing information.
+ *
+ */
+
+/************************************************************************
+ *
+ * QOMET Emulator Implementation
+ *
+ * File name: snapshot.c
+ * Function: Save and load initialized scenarios as binary snapshots
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "message.h"
+
+
+////////////////////////////////////////////////
+// Trimmed structure layout
+////////////////////////////////////////////////
+
+// Objects and motions embed arrays sized for the largest possible
+// element (MAX_VERTICES vertices, MAX_MOBILITY_RECORDS trace records),
+// which would make snapshots of map-based scenarios mostly empty
+// space. Such a structure is stored as its part before the array, its
+// part after the array (which holds the number of used elements), and
+// then the used elements only.
+
+struct trimmed_layout
+{
+  size_t size;
+  size_t array_offset;
+  size_t array_end;
+  size_t element_size;
+};
+
+static const struct trimmed_layout object_layout = {
+  sizeof (struct object_class),
+  offsetof (struct object_class, vertices),
+  offsetof (struct object_class, vertices) +
+    sizeof (((struct object_class *) 0)->vertices),
+  sizeof (struct coordinate_class)
+};
+
+static const struct trimmed_layout motion_layout = {
+  sizeof (struct motion_class),
+  offsetof (struct motion_class, trace_records),
+  offsetof (struct motion_class, trace_records) +
+    sizeof (((struct motion_class *) 0)->trace_records),
+  sizeof (struct trace_record_class)
+};
+
+// write the structure 'element' with 'used' array elements;
+// return SUCCESS on success, ERROR on error
+static int
+snapshot_write_trimmed (FILE * snapshot_file, void *element,
+			const struct trimmed_layout *layout, int used)
+{
+  char *bytes = (char *) element;
+
+  if (fwrite (bytes, layout->array_offset, 1, snapshot_file) != 1 ||
+      fwrite (bytes + layout->array_end, layout->size - layout->array_end,
+	      1, snapshot_file) != 1)
+    return ERROR;
+
+  if (used > 0 &&
+      fwrite (bytes + layout->array_offset, layout->element_size, used,
+	      snapshot_file) != (size_t) used)
+    return ERROR;
+
+  return SUCCESS;
+}
+
+// copy 'size' bytes at '*cursor' to 'destination' and advance the
+// cursor, unless this would go past 'end';
+// return SUCCESS on success, ERROR on error
+static int
+snapshot_copy (void *destination, char **cursor, char *end, size_t size)
+{
+  if ((size_t) (end - *cursor) < size)
+    return ERROR;
+
+  memcpy (destination, *cursor, size);
+  *cursor += size;
+
+  return SUCCESS;
+}
+
+
+////////////////////////////////////////////////
+// Snapshot functions
+////////////////////////////////////////////////
+
+// save the state of 'xml_scenario', initialized by scenario_init_state
+// with the flag 'deltaQ_disabled', and the random number generator state
+// 'random_state' to the file 'snapshot_filename';
+// return SUCCESS on success, ERROR on error
+int
+snapshot_save (struct xml_scenario_class *xml_scenario,
+	       int deltaQ_disabled, char *random_state,
+	       char *snapshot_filename)
+{
+  struct scenario_class *scenario = &(xml_scenario->scenario);
+  struct snapshot_header header;
+  FILE *snapshot_file;
+  long file_size;
+  int i;
+
+  memset (&header, 0, sizeof (header));
+  strncpy (header.signature, SNAPSHOT_SIGNATURE, sizeof (header.signature));
+  header.version = SNAPSHOT_VERSION;
+
+  header.scenario_size = sizeof (struct scenario_class);
+  header.node_size = sizeof (struct node_class);
+  header.object_size = sizeof (struct object_class);
+  header.environment_size = sizeof (struct environment_class);
+  header.motion_size = sizeof (struct motion_class);
+  header.connection_size = sizeof (struct connection_class);
+
+  header.start_time = xml_scenario->start_time;
+  header.duration = xml_scenario->duration;
+  header.step = xml_scenario->step;
+  header.motion_step_divider = xml_scenario->motion_step_divider;
+  header.cartesian_coord_syst = xml_scenario->cartesian_coord_syst;
+  header.jpgis_filename_provided = xml_scenario->jpgis_filename_provided;
+  strncpy (header.jpgis_filename, xml_scenario->jpgis_filename,
+	   MAX_STRING - 1);
+
+  header.deltaQ_disabled = deltaQ_disabled;
+
+  header.node_number = scenario->node_number;
+  header.object_number = scenario->object_number;
+  header.environment_number = scenario->environment_number;
+  header.motion_number = scenario->motion_number;
+  header.connection_number = scenario->connection_number;
+  header.if_num = scenario->if_num;
+
+  memcpy (header.random_state, random_state, SNAPSHOT_RANDOM_STATE_SIZE);
+
+  snapshot_file = fopen (snapshot_filename, "w");
+  if (snapshot_file == NULL)
+    {
+      WARNING ("Cannot open snapshot file '%s' for writing!",
+	       snapshot_filename);
+      return ERROR;
+    }
+
+  // the header is written again at the end, with the file size
+  if (fwrite (&header, sizeof (header), 1, snapshot_file) != 1)
+    goto WRITE_ERROR;
+
+  if ((scenario->node_number > 0 &&
+       fwrite (scenario->nodes, sizeof (struct node_class),
+	       scenario->node_number, snapshot_file)
+       != (size_t) scenario->node_number) ||
+      (scenario->environment_number > 0 &&
+       fwrite (scenario->environments, sizeof (struct environment_class),
+	       scenario->environment_number, snapshot_file)
+       != (size_t) scenario->environment_number) ||
+      (scenario->connection_number > 0 &&
+       fwrite (scenario->connections, sizeof (struct connection_class),
+	       scenario->connection_number, snapshot_file)
+       != (size_t) scenario->connection_number))
+    goto WRITE_ERROR;
+
+  for (i = 0; i < scenario->object_number; i++)
+    if (snapshot_write_trimmed (snapshot_file, &(scenario->objects[i]),
+				&object_layout,
+				scenario->objects[i].vertex_number) == ERROR)
+      goto WRITE_ERROR;
+
+  for (i = 0; i < scenario->motion_number; i++)
+    if (snapshot_write_trimmed (snapshot_file, &(scenario->motions[i]),
+				&motion_layout,
+				scenario->motions[i].trace_record_number)
+	== ERROR)
+      goto WRITE_ERROR;
+
+  if (fwrite (scenario->node_name_index,
+	      sizeof (scenario->node_name_index), 1, snapshot_file) != 1 ||
+      fwrite (scenario->environment_name_index,
+	      sizeof (scenario->environment_name_index), 1,
+	      snapshot_file) != 1)
+    goto WRITE_ERROR;
+
+  file_size = ftell (snapshot_file);
+  if (file_size < 0)
+    goto WRITE_ERROR;
+  header.file_size = file_size;
+
+  if (fseek (snapshot_file, 0, SEEK_SET) != 0 ||
+      fwrite (&header, sizeof (header), 1, snapshot_file) != 1)
+    goto WRITE_ERROR;
+
+  if (fclose (snapshot_file) != 0)
+    {
+      WARNING ("Error closing snapshot file '%s'", snapshot_filename);
+      perror ("fclose");
+      return ERROR;
+    }
+
+  return SUCCESS;
+
+WRITE_ERROR:
+  WARNING ("Error writing snapshot file '%s'", snapshot_filename);
+  perror ("fwrite");
+  fclose (snapshot_file);
+  return ERROR;
+}
+
+// load the snapshot file 'snapshot_filename' into 'xml_scenario', which
+// must have been initialized by scenario_init, and the saved random
+// number generator state into 'random_state'; a snapshot saved with
+// deltaQ computation disabled cannot be loaded if 'deltaQ_disabled' is
+// FALSE; return SUCCESS on success, ERROR on error
+int
+snapshot_load (struct xml_scenario_class *xml_scenario,
+	       int deltaQ_disabled, char *random_state,
+	       char *snapshot_filename)
+{
+  struct scenario_class *scenario = &(xml_scenario->scenario);
+  struct snapshot_header header;
+  const struct trimmed_layout *layout;
+  struct stat snapshot_stat;
+  char *map, *cursor, *end, *element;
+  int snapshot_fd;
+  int i, used;
+  int result = ERROR;
+
+  snapshot_fd = open (snapshot_filename, O_RDONLY);
+  if (snapshot_fd < 0)
+    {
+      WARNING ("Cannot open snapshot file '%s'!", snapshot_filename);
+      return ERROR;
+    }
+
+  if (fstat (snapshot_fd, &snapshot_stat) != 0)
+    {
+      WARNING ("Cannot get the size of snapshot file '%s'",
+	       snapshot_filename);
+      close (snapshot_fd);
+      return ERROR;
+    }
+
+  if (snapshot_stat.st_size < (off_t) sizeof (header))
+    {
+      WARNING ("File '%s' is too short to be a snapshot", snapshot_filename);
+      close (snapshot_fd);
+      return ERROR;
+    }
+
+  map = mmap (NULL, snapshot_stat.st_size, PROT_READ, MAP_PRIVATE,
+	      snapshot_fd, 0);
+  close (snapshot_fd);
+  if (map == MAP_FAILED)
+    {
+      WARNING ("Cannot map snapshot file '%s'", snapshot_filename);
+      perror ("mmap");
+      return ERROR;
+    }
+  madvise (map, snapshot_stat.st_size, MADV_SEQUENTIAL);
+
+  cursor = map;
+  end = map + snapshot_stat.st_size;
+  snapshot_copy (&header, &cursor, end, sizeof (header));
+
+  // check that the snapshot was written completely by a build
+  // with the same structures
+  if (memcmp (header.signature, SNAPSHOT_SIGNATURE,
+	      sizeof (SNAPSHOT_SIGNATURE)) != 0)
+    {
+      WARNING ("File '%s' is not a snapshot", snapshot_filename);
+      goto LOAD_END;
+    }
+  if (header.version != SNAPSHOT_VERSION)
+    {
+      WARNING ("Snapshot '%s' has version %d, but version %d is required",
+	       snapshot_filename, header.version, SNAPSHOT_VERSION);
+      goto LOAD_END;
+    }
+  if (header.scenario_size != sizeof (struct scenario_class) ||
+      header.node_size != sizeof (struct node_class) ||
+      header.object_size != sizeof (struct object_class) ||
+      header.environment_size != sizeof (struct environment_class) ||
+      header.motion_size != sizeof (struct motion_class) ||
+      header.connection_size != sizeof (struct connection_class))
+    {
+      WARNING ("Snapshot '%s' was written by a build with different \
+scenario structures", snapshot_filename);
+      goto LOAD_END;
+    }
+  if (header.file_size != (uint64_t) snapshot_stat.st_size)
+    {
+      WARNING ("Snapshot '%s' is incomplete", snapshot_filename);
+      goto LOAD_END;
+    }
+  if (header.node_number < 0 || header.node_number > MAX_NODES ||
+      header.object_number < 0 || header.object_number > MAX_OBJECTS ||
+      header.environment_number < 0 ||
+      header.environment_number > MAX_ENVIRONMENTS ||
+      header.motion_number < 0 || header.motion_number > MAX_MOTIONS ||
+      header.connection_number < 0 ||
+      header.connection_number > MAX_CONNECTIONS)
+    {
+      WARNING ("Snapshot '%s' has invalid element numbers",
+	       snapshot_filename);
+      goto LOAD_END;
+    }
+  if (header.deltaQ_disabled == TRUE && deltaQ_disabled == FALSE)
+    {
+      WARNING ("Snapshot '%s' was saved with deltaQ computation disabled, \
+so it can only be used with deltaQ computation disabled", snapshot_filename);
+      goto LOAD_END;
+    }
+
+  xml_scenario->start_time = header.start_time;
+  xml_scenario->duration = header.duration;
+  xml_scenario->step = header.step;
+  xml_scenario->motion_step_divider = header.motion_step_divider;
+  xml_scenario->cartesian_coord_syst = header.cartesian_coord_syst;
+  xml_scenario->jpgis_filename_provided = header.jpgis_filename_provided;
+  strncpy (xml_scenario->jpgis_filename, header.jpgis_filename,
+	   MAX_STRING - 1);
+
+  scenario->node_number = header.node_number;
+  scenario->object_number = header.object_number;
+  scenario->environment_number = header.environment_number;
+  scenario->motion_number = header.motion_number;
+  scenario->connection_number = header.connection_number;
+  scenario->if_num = header.if_num;
+
+  memcpy (random_state, header.random_state, SNAPSHOT_RANDOM_STATE_SIZE);
+
+  if (snapshot_copy (scenario->nodes, &cursor, end,
+		     header.node_number * sizeof (struct node_class))
+      == ERROR ||
+      snapshot_copy (scenario->environments, &cursor, end,
+		     header.environment_number *
+		     sizeof (struct environment_class)) == ERROR ||
+      snapshot_copy (scenario->connections, &cursor, end,
+		     header.connection_number *
+		     sizeof (struct connection_class)) == ERROR)
+    goto CORRUPT;
+
+  // objects and motions are stored in trimmed form
+  for (i = 0; i < header.object_number + header.motion_number; i++)
+    {
+      if (i < header.object_number)
+	{
+	  layout = &object_layout;
+	  element = (char *) &(scenario->objects[i]);
+	}
+      else
+	{
+	  layout = &motion_layout;
+	  element = (char *) &(scenario->motions[i - header.object_number]);
+	}
+
+      if (snapshot_copy (element, &cursor, end, layout->array_offset)
+	  == ERROR ||
+	  snapshot_copy (element + layout->array_end, &cursor, end,
+			 layout->size - layout->array_end) == ERROR)
+	goto CORRUPT;
+
+      if (i < header.object_number)
+	used = scenario->objects[i].vertex_number;
+      else
+	used = scenario->motions[i - header.object_number].
+	  trace_record_number;
+      if (used < 0 ||
+	  (size_t) used > (layout->array_end - layout->array_offset) /
+	  layout->element_size)
+	goto CORRUPT;
+
+      if (snapshot_copy (element + layout->array_offset, &cursor, end,
+			 used * layout->element_size) == ERROR)
+	goto CORRUPT;
+    }
+
+  if (snapshot_copy (scenario->node_name_index, &cursor, end,
+		     sizeof (scenario->node_name_index)) == ERROR ||
+      snapshot_copy (scenario->environment_name_index, &cursor, end,
+		     sizeof (scenario->environment_name_index)) == ERROR ||
+      cursor != end)
+    goto CORRUPT;
+
+  result = SUCCESS;
+  goto LOAD_END;
+
+CORRUPT:
+  WARNING ("Snapshot '%s' is corrupted", snapshot_filename);
+
+LOAD_END:
+  munmap (map, snapshot_stat.st_size);
+  return result;
+}
@@ -22,7 +22,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "xml_jpgis.h"
 #include "message.h"
@@ -34,18 +40,37 @@
 // xml_jpgis functions
 /////////////////////////////////////////////////
 
-// init the xml_jpgis structure
-void
+// return the slot of the object index of 'xml_jpgis' that holds
+// the object named 'name', or the empty slot where it would be added
+static int *
+xml_jpgis_object_slot (struct xml_jpgis_class *xml_jpgis, const char *name)
+{
+  uint32_t slot = string_hash ((char *) name, strlen (name))
+    & xml_jpgis->object_index_mask;
+
+  while (xml_jpgis->object_index[slot] != 0
+	 && strcmp (xml_jpgis->objects[xml_jpgis->object_index[slot] - 1].name,
+		    name) != 0)
+    slot = (slot + 1) & xml_jpgis->object_index_mask;
+
+  return &(xml_jpgis->object_index[slot]);
+}
+
+// init the xml_jpgis structure;
+// return SUCCESS on success, ERROR on error
+int
 xml_jpgis_init (struct xml_jpgis_class *xml_jpgis,
 		struct scenario_class *scenario,
 		struct object_class *objects, int object_number)
 {
   int i;
+  unsigned int index_size = 16;
 
   xml_jpgis->object_found = FALSE;
   xml_jpgis->coordinate_found = FALSE;
 
   strcpy (xml_jpgis->coordinate_text, "");
+  xml_jpgis->coordinate_length = 0;
 
   xml_jpgis->scenario = scenario;
   xml_jpgis->objects = objects;
@@ -65,6 +90,106 @@ xml_jpgis_init (struct xml_jpgis_class *xml_jpgis,
       }
     else
       xml_jpgis->load_all_from_region = FALSE;
+
+  // index the objects to be loaded by name, keeping the table at most
+  // half full; as for the former linear search, the last object with
+  // a given name is the one that is loaded
+  while (index_size < 2 * (unsigned int) object_number)
+    index_size *= 2;
+  xml_jpgis->object_index = (int *) calloc (index_size, sizeof (int));
+  if (xml_jpgis->object_index == NULL)
+    {
+      WARNING ("Cannot allocate memory for the JPGIS object index");
+      return ERROR;
+    }
+  xml_jpgis->object_index_mask = index_size - 1;
+
+  for (i = 0; i < object_number; i++)
+    if (objects[i].load_from_jpgis_file == TRUE)
+      *xml_jpgis_object_slot (xml_jpgis, objects[i].name) = i + 1;
+
+  return SUCCESS;
+}
+
+// free the memory allocated by xml_jpgis_init
+void
+xml_jpgis_finalize (struct xml_jpgis_class *xml_jpgis)
+{
+  free (xml_jpgis->object_index);
+  xml_jpgis->object_index = NULL;
+}
+
+// convert the decimal number at the beginning of '*text', after any
+// white space, and advance '*text' past it; numbers with at most 15
+// significant digits, at most 22 decimals and no exponent, which is
+// the case of JPGIS coordinates, are converted as an integer divided
+// by an exact power of ten, which gives the same correctly rounded
+// result as strtod; other numbers are converted by strtod;
+// return SUCCESS on success, ERROR on error
+static int
+jpgis_scan_double (char **text, double *value)
+{
+  static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  char *start, *crt, *end_pointer;
+  uint64_t mantissa = 0;
+  int digits = 0, significant_digits = 0, decimals = 0;
+  int negative = FALSE;
+
+  start = *text;
+  while (isspace ((unsigned char) *start))
+    start++;
+
+  crt = start;
+  if (*crt == '-' || *crt == '+')
+    {
+      negative = (*crt == '-');
+      crt++;
+    }
+
+  // integer part, then decimal part
+  for (; isdigit ((unsigned char) *crt); crt++, digits++)
+    if (mantissa != 0 || *crt != '0')
+      {
+	mantissa = mantissa * 10 + (*crt - '0');
+	significant_digits++;
+	if (significant_digits > 15)
+	  break;
+      }
+  if (*crt == '.' && significant_digits <= 15)
+    for (crt++; isdigit ((unsigned char) *crt); crt++, digits++)
+      {
+	decimals++;
+	if (mantissa != 0 || *crt != '0')
+	  {
+	    mantissa = mantissa * 10 + (*crt - '0');
+	    significant_digits++;
+	    if (significant_digits > 15)
+	      break;
+	  }
+      }
+
+  if (digits > 0 && significant_digits <= 15 && decimals <= 22
+      && *crt != 'e' && *crt != 'E')
+    {
+      *value = (double) mantissa / powers_of_ten[decimals];
+      if (negative == TRUE)
+	*value = -*value;
+      *text = crt;
+      return SUCCESS;
+    }
+
+  // use 'errno' to catch "out of range" errors
+  errno = 0;
+  *value = strtod (start, &end_pointer);
+  if (end_pointer == start || errno != 0)
+    return ERROR;
+
+  *text = end_pointer;
+  return SUCCESS;
 }
 
 
@@ -79,7 +204,7 @@ xml_jpgis_start_element (void *user_data, const char *el, const char **attr)
   // get a pointer to the user data in our XML object
   struct xml_jpgis_class *xml_jpgis = (struct xml_jpgis_class *) user_data;
 
-  int i, j;
+  int i, j, *object_slot;
 
   // search for all recognized elements (objects)
   if ((strcmp (el, BUILDING_EDGE_LABEL) == 0) ||
@@ -94,29 +219,28 @@ xml_jpgis_start_element (void *user_data, const char *el, const char **attr)
 	    {
 	      DEBUG ("  Found %s with %s='%s'\n", el, attr[i], attr[i + 1]);
 
-	      for (j = 0; j < xml_jpgis->object_number; j++)
-		// check whether object needs to be loaded from JPGIS file
-		if (xml_jpgis->objects[j].load_from_jpgis_file == TRUE)
-		  // check object name
-		  if (strcmp (xml_jpgis->objects[j].name, attr[i + 1]) == 0)
+	      // check whether object needs to be loaded from JPGIS file
+	      object_slot = xml_jpgis_object_slot (xml_jpgis, attr[i + 1]);
+	      j = *object_slot - 1;
+	      if (j >= 0 && xml_jpgis->objects[j].load_from_jpgis_file == TRUE)
+		{
+		  // check whether the object has the appropriate type
+		  if (((strcmp (el, BUILDING_EDGE_LABEL) == 0) &&
+		       xml_jpgis->objects[j].type == BUILDING_OBJECT) ||
+		      ((strcmp (el, ROAD_EDGE_LABEL) == 0) &&
+		       xml_jpgis->objects[j].type == ROAD_OBJECT))
 		    {
-		      // check whether the object has the appropriate type
-		      if (((strcmp (el, BUILDING_EDGE_LABEL) == 0) &&
-			   xml_jpgis->objects[j].type == BUILDING_OBJECT) ||
-			  ((strcmp (el, ROAD_EDGE_LABEL) == 0) &&
-			   xml_jpgis->objects[j].type == ROAD_OBJECT))
-			{
-			  INFO ("\tObject to be loaded='%s'",
-				xml_jpgis->objects[j].name);
-			  xml_jpgis->object_found = TRUE;
-			  xml_jpgis->object_j = j;
-			  xml_jpgis->coordinate_i = 0;
-			  xml_jpgis->objects[j].vertex_number = 0;
-			}
-		      else
-			WARNING ("Found object '%s' has is not of expected \
-type", xml_jpgis->objects[j].name);
+		      INFO ("\tObject to be loaded='%s'",
+			    xml_jpgis->objects[j].name);
+		      xml_jpgis->object_found = TRUE;
+		      xml_jpgis->object_j = j;
+		      xml_jpgis->coordinate_i = 0;
+		      xml_jpgis->objects[j].vertex_number = 0;
 		    }
+		  else
+		    WARNING ("Found object '%s' has is not of expected type",
+			     xml_jpgis->objects[j].name);
+		}
 
 	      // check whether we are in region adding mode, and the current
 	      // object has not been added in the loop above
@@ -163,6 +287,7 @@ type", xml_jpgis->objects[j].name);
 	  xml_jpgis->longitude = -HUGE_VAL;
 	  xml_jpgis->coordinate_found = TRUE;
 	  strcpy (xml_jpgis->coordinate_text, "");
+	  xml_jpgis->coordinate_length = 0;
 	}
       else			// discard the coordinate
 	xml_jpgis->coordinate_found = FALSE;
@@ -318,34 +443,26 @@ xml_jpgis_end_element (void *user_data, const char *el)
   else if ((strcmp (el, "jps:coordinate") == 0) &&
 	   xml_jpgis->object_found == TRUE)
     {
-      char *space_ptr;
+      char *text_ptr = xml_jpgis->coordinate_text;
 
       struct object_class *target_object;
 
-      // identify space position
-      space_ptr = strstr (xml_jpgis->coordinate_text, " ");
-      //DEBUG("space_ptr='%s'", space_ptr);
-
-      // convert second part of the string
-      if (space_ptr != NULL)
-	{
-	  xml_jpgis->longitude = double_value (space_ptr);
-	  space_ptr[0] = '\0';
-
-	  // convert first part of the string
-	  //DEBUG("coordinate_text='%s'", xml_jpgis->coordinate_text);
-	  xml_jpgis->latitude = double_value (xml_jpgis->coordinate_text);
-	}
+      // convert the latitude and the longitude, which must be followed
+      // only by white space
+      if (jpgis_scan_double (&text_ptr, &(xml_jpgis->latitude)) == ERROR
+	  || jpgis_scan_double (&text_ptr, &(xml_jpgis->longitude)) == ERROR)
+	text_ptr = NULL;
+      else
+	while (isspace ((unsigned char) *text_ptr))
+	  text_ptr++;
 
       // check whether both coordinates were correctly imported
-      if (xml_jpgis->longitude == -HUGE_VAL
-	  || xml_jpgis->latitude == -HUGE_VAL)
+      if (text_ptr == NULL || *text_ptr != '\0')
 	{
-	  // restore space character for printing
-	  space_ptr[0] = ' ';
 	  WARNING ("Error converting the string '%s' to object coordinates",
 		   xml_jpgis->coordinate_text);
 	  xml_jpgis->error = TRUE;
+	  return;
 	}
 
       if (xml_jpgis->object_j == -1)
@@ -405,14 +522,20 @@ xml_jpgis_element_text (void *user_data, const char *xmlData, int length)
   // get a pointer to the user data in our XML object
   struct xml_jpgis_class *xml_jpgis = (struct xml_jpgis_class *) user_data;
 
-  // check whether the text is inside a coordinate we want to import,
-  // and the text has a length larger than 1 (equivalent to non-empty string)
-  if (xml_jpgis->coordinate_found == TRUE && length > 1)
+  // check whether the text is inside a coordinate we want to import;
+  // the text may be given in several parts, e.g. when it crosses the
+  // boundary of two blocks given to the parser
+  if (xml_jpgis->coordinate_found == TRUE && length > 0)
     {
       // if there is still enough space, add the text to our
       // parsing buffer
-      if (strlen (xml_jpgis->coordinate_text) + length + 1 < MAX_STRING)
-	strncat (xml_jpgis->coordinate_text, xmlData, length);
+      if (xml_jpgis->coordinate_length + length + 1 < MAX_STRING)
+	{
+	  memcpy (xml_jpgis->coordinate_text + xml_jpgis->coordinate_length,
+		  xmlData, length);
+	  xml_jpgis->coordinate_length += length;
+	  xml_jpgis->coordinate_text[xml_jpgis->coordinate_length] = '\0';
+	}
       else
 	{
 	  WARNING ("Coordinate text exceeded maximum size (%d)", MAX_STRING);
@@ -529,32 +652,62 @@ xml_jpgis_load_objects (struct scenario_class *scenario,
 			struct object_class *objects, int object_number,
 			char *jpgis_filename)
 {
-  FILE *jpgis_file;
+  int jpgis_fd = -1;
+  struct stat jpgis_stat;
+  char *jpgis_map = MAP_FAILED;
+  size_t offset, length;
+  int done;
   int error_status = SUCCESS;
 
 
   // object used to store state while parsing
   struct xml_jpgis_class xml_jpgis;
 
-  XML_Parser xml_parser = XML_ParserCreate (NULL);
+  XML_Parser xml_parser;
 
-  xml_jpgis_init (&xml_jpgis, scenario, objects, object_number);
+  if (xml_jpgis_init (&xml_jpgis, scenario, objects, object_number) == ERROR)
+    return ERROR;
 
   INFO ("Loading objects from file '%s'...", jpgis_filename);
 
+  xml_parser = XML_ParserCreate (NULL);
   if (xml_parser == NULL)
     {
       fprintf (stderr, "Couldn't allocate memory for parser\n");
+      xml_jpgis_finalize (&xml_jpgis);
       return ERROR;
     }
 
-  jpgis_file = fopen (jpgis_filename, "r");
-  if (jpgis_file == NULL)
+  // national-scale JPGIS files have several GB, hence they are mapped
+  // in memory and given to the parser directly, instead of being
+  // copied through a read buffer
+  jpgis_fd = open (jpgis_filename, O_RDONLY);
+  if (jpgis_fd == -1)
     {
       fprintf (stderr, "ERROR: Could not open file '%s'.\n", jpgis_filename);
       goto ERROR_HANDLE;
     }
 
+  if (fstat (jpgis_fd, &jpgis_stat) == -1)
+    {
+      fprintf (stderr, "ERROR: Could not get the size of file '%s'.\n",
+	       jpgis_filename);
+      goto ERROR_HANDLE;
+    }
+
+  if (jpgis_stat.st_size > 0)
+    {
+      jpgis_map = (char *) mmap (NULL, jpgis_stat.st_size, PROT_READ,
+				 MAP_PRIVATE, jpgis_fd, 0);
+      if (jpgis_map == MAP_FAILED)
+	{
+	  fprintf (stderr, "ERROR: Could not map file '%s' in memory.\n",
+		   jpgis_filename);
+	  goto ERROR_HANDLE;
+	}
+      madvise (jpgis_map, jpgis_stat.st_size, MADV_SEQUENTIAL);
+    }
+
   XML_SetElementHandler (xml_parser, xml_jpgis_start_element,
 			 xml_jpgis_end_element);
   XML_SetCharacterDataHandler (xml_parser, xml_jpgis_element_text);
@@ -562,20 +715,18 @@ xml_jpgis_load_objects (struct scenario_class *scenario,
   // set the user data pointer to the scenario object
   XML_SetUserData (xml_parser, &xml_jpgis);
 
-  for (;;)
+  // the parser takes the length of its input as an int, hence the
+  // file is given to it in slices
+  for (offset = 0;; offset += length)
     {
-      int done;
-      int len;
-
-      len = (int) fread (xml_buffer, 1, BUFFER_SIZE, jpgis_file);
-      if (ferror (jpgis_file))
-	{
-	  fprintf (stderr, "Read error\n");
-	  exit (-1);
-	}
-      done = feof (jpgis_file);
-
-      if (XML_Parse (xml_parser, xml_buffer, len, done) == XML_STATUS_ERROR)
+      length = jpgis_stat.st_size - offset;
+      if (length > JPGIS_PARSE_CHUNK)
+	length = JPGIS_PARSE_CHUNK;
+      done = (offset + length == (size_t) jpgis_stat.st_size);
+
+      if (XML_Parse (xml_parser, (jpgis_map != MAP_FAILED) ?
+		     jpgis_map + offset : NULL, (int) length,
+		     done) == XML_STATUS_ERROR)
 	{
 	  fprintf (stderr, "Parse error at line %" XML_FMT_INT_MOD "u:\n%s\n",
 		   (long unsigned int) XML_GetCurrentLineNumber (xml_parser),
@@ -599,10 +750,13 @@ ERROR_HANDLE:
 
 FINAL_HANDLE:
 
-  if (jpgis_file != NULL)
-    fclose (jpgis_file);
+  if (jpgis_map != MAP_FAILED)
+    munmap (jpgis_map, jpgis_stat.st_size);
+  if (jpgis_fd != -1)
+    close (jpgis_fd);
 
   XML_ParserFree (xml_parser);
+  xml_jpgis_finalize (&xml_jpgis);
 
   if (error_status == ERROR || xml_jpgis.error == TRUE)
     {
@@ -1,3 +1,5 @@
+#include <net/if.h>
+
 struct link_params {
     struct in_addr addr;
     uint16_t id;
@@ -17,6 +19,18 @@ struct meteor_params {
     struct link_params *add_params;
     struct link_params *update_params;
     struct node_array *delete_params;
+    // "opts": {"commit": "batch"}: apply all changes as one tc batch
+    int batch;
+    // "opts": {"at": ..., "clock": ...}: METEORD_CLOCK_* or 0, and s
+    int at_clock;
+    double at;
+    // "opts": {"epoch": ...}: set the scenario epoch to epoch_at
+    // monotonic s, or to now if negative
+    int epoch;
+    double epoch_at;
+    // "opts": {"interface": ...}: physical interface, or empty for the
+    // first one of the config
+    char ifname[IFNAMSIZ];
 };
 
 struct meteor_params * parse_json(char *req);
@@ -19,17 +19,46 @@
 // Filter module
 #define NL_U32 "u32"
 
+// priority of the catch-all redirect filter on the physical interface
+#define MIRRED_PRIO 0xffff
+
+// bytes and number of requests written at once by a batch; the acks
+// of one write must fit in the default socket receive buffer
+#define TC_BATCH_CHUNK 8192
+#define TC_BATCH_MSGS  64
+
+// requests of the wrappers below, queued between tc_batch_begin() and
+// tc_batch_commit() on the batch's socket and written together
+struct tc_batch {
+    struct nl_sock *sock;
+    char *buf;
+    size_t len;
+    size_t size;
+    uint32_t queued;
+    uint32_t pending;
+    uint32_t ops;
+    int errors;
+    int first_error;
+};
+
 int get_ifindex(struct nl_cache *cache, char *ifname);
 int add_ingress_qdisc(struct nl_sock *sock, int if_index);
 int add_mirred_filter(struct nl_sock *sock, int src_if, int dst_if);
 int add_class_ipv4filter(struct nl_sock *sock, int if_index, uint32_t parent, uint32_t handle, uint32_t src_addr, int src_prefix, uint32_t dst_addr, int dst_prefix);
 int add_class_macfilter(struct nl_sock *sock, int if_index, uint32_t parent, uint32_t handle, uint8_t src_addr[6], uint8_t dst_addr[6]);
+int add_mq_qdisc(struct nl_sock *sock, int if_index, uint32_t handle);
 int add_htb_qdisc(struct nl_sock *sock, int if_index, uint32_t parent, uint32_t handle, uint32_t defcls);
 int add_htb_class(struct nl_sock *sock, int if_index, uint32_t parent, uint32_t handle, uint32_t clsid, uint32_t rate);
 int change_htb_class(struct nl_sock *sock, int if_index, uint32_t parent, uint32_t handle, uint32_t clsid, uint32_t rate);
 int add_netem_qdisc(struct nl_sock *sock, int if_index, uint32_t parent, uint32_t handle, int delay, int jitter, int loss, int limit);
 int change_netem_qdisc(struct nl_sock *sock, int if_index, uint32_t parent, uint32_t handle, int delay, int jitter, int loss, int limit);
+int add_netem_rate_qdisc(struct nl_sock *sock, int if_index, uint32_t parent, uint32_t handle, int delay, int jitter, int loss, int limit, uint64_t rate);
+int change_netem_rate_qdisc(struct nl_sock *sock, int if_index, uint32_t parent, uint32_t handle, int delay, int jitter, int loss, int limit, uint64_t rate);
 int delete_qdisc(struct nl_sock *sock, int if_index, uint32_t parent, uint32_t handle);
 int delete_class(struct nl_sock *sock, int if_index, uint32_t parent, uint32_t handle);
+struct tc_batch *tc_batch_alloc(struct nl_sock *sock);
+void tc_batch_free(struct tc_batch *batch);
+void tc_batch_begin(struct tc_batch *batch);
+int tc_batch_commit(struct tc_batch *batch);
 int delete_ipv4filter(struct nl_sock *sock, int if_index, uint32_t parent, uint32_t handle);
 #endif
@@ -21,7 +21,9 @@
 #define UNDEFINED_SIGNED        -1
 #define UNDEFINED_UNSIGNED      65535
 #define UNDEFINED_BANDWIDTH     -1.0
-#define SCALING_FACTOR          1.0
+#define DEF_TIME_SCALE          1.0
+#define MIN_TIME_SCALE          0.1
+#define MAX_TIME_SCALE          100.0
 
 #define DEF_DELAY               0
 #define DEF_BW                  1000000000
@@ -33,6 +35,21 @@
 
 #define QLEN                    100000
 
+#define LINK_MODEL_HTB          0
+#define LINK_MODEL_NETEM        1
+// minor of the empty class that marks a tree of the netem-rate model
+#define NETEM_MODEL_MINOR       2
+
+#define RT_DEF_PRIORITY         80
+// stack pre-faulted by the real-time profile, in bytes
+#define RT_STACK_PREFAULT       (512 * 1024)
+#define MAX_SHARDS              256
+#define SHARD_HTB_MAJOR         0xf000
+#define SHARD_DEF_MAJOR         0xf800
+// netem majors of one shard; the majors below SHARD_HTB_MAJOR are split
+// evenly between the shards
+#define SHARD_NETEM_STRIDE(shards) ((SHARD_HTB_MAJOR - 10) / (shards))
+
 #ifdef TCDEBUG
 #define debug(...) { \
     printf("%s in %s:%d. ", __func__, __FILE__, __LINE__); \
@@ -57,6 +74,12 @@ struct connection_list {
     uint16_t rec_i;
 };
 
+struct local_node {
+    int32_t id;
+    int32_t pif_index;
+    int32_t ifb_index;
+};
+
 struct meteor_config {
     struct nl_sock *nlsock;
     struct nl_cache *cache;
@@ -66,12 +89,38 @@ struct meteor_config {
 
     int32_t  node_cnt;
     uint32_t id;
+    int32_t  local_cnt;
+    struct local_node *local;
+    uint8_t *local_map;
     uint32_t loop;
     uint32_t direction;
     uint32_t filter_mode;
+    uint32_t shards;
+    uint32_t link_model;
+    int32_t  reconcile;
+
+    // scenario seconds per real second, and the last point at which
+    // it changed, as real and scenario time since the timer zero
+    double time_scale;
+    double time_scale_def;
+    double real_anchor;
+    double scenario_anchor;
+
+    // link records currently applied, one row of cur_recs_stride
+    // entries per local node; read by the statistics, which run on
+    // their own thread with the real-time profile and may then see
+    // the records of two consecutive time records in one sample
+    struct bin_rec_cls *cur_recs;
+    uint32_t cur_recs_stride;
+    uint32_t stats_interval;
     int32_t  daemonize;
     int32_t  verbose;
 
+    // real-time profile: CPU of the replay loop, or -1 if disabled,
+    // and its SCHED_FIFO priority
+    int32_t  rt_cpu;
+    int32_t  rt_priority;
+
     FILE *deltaq_fd;
     FILE *settings_fd;
     FILE *connection_fd;
@@ -82,4 +131,8 @@ struct meteor_config {
     struct connection_list *conn_list_head;
 };
 
+uint16_t shard_major(struct meteor_config *meteor_conf, uint32_t shard_i);
+uint16_t netem_major(struct meteor_config *meteor_conf, uint16_t parent, uint32_t shard_i);
+int is_tree_major(struct meteor_config *meteor_conf, uint16_t major);
+
 #endif
@@ -0,0 +1,132 @@
+#ifndef __METEORD_PROTO_H_
+#define __METEORD_PROTO_H_
+#include <stdint.h>
+
+// Binary control protocol of meteord.
+//
+// A connection speaks JSON lines unless its first bytes are a
+// struct meteord_hello; meteord then echoes the hello back and every
+// following message is a frame: a 32-bit length in network byte order
+// followed by that many bytes of struct meteord_rec. All fields are in
+// network byte order.
+//
+// With METEORD_HELLO_BATCH, all records of a frame are applied as one
+// tc batch and meteord answers every frame with a struct meteord_commit.
+// A JSON command asks for the same with "opts": {"commit": "batch"} and
+// is answered with a {"commit": {...}} line.
+//
+// A METEORD_OP_AT record, laid out as struct meteord_at_rec, schedules
+// the records that follow it in the same frame for a point in time,
+// either on the CLOCK_MONOTONIC of the meteord host or relative to the
+// scenario epoch set with METEORD_OP_EPOCH. JSON commands do the same
+// with "opts": {"at": "<s>", "clock": "monotonic"|"scenario"} and
+// "opts": {"epoch": "now"|"<monotonic s>"}.
+//
+// Records go to the first interface of the meteord config file until a
+// METEORD_OP_IFACE record selects the interface whose config id is in
+// its id field for the records after it in the same frame. A JSON
+// command names its interface with "opts": {"interface": "<name>"}.
+//
+// Both protocols are also spoken on the optional Unix domain socket.
+// Controllers on the meteord host may instead write records into a
+// struct meteord_ring in POSIX shared memory created by meteord; see
+// below.
+
+#define METEORD_MAGIC           "MTRB"
+#define METEORD_PROTO_VERSION   1
+
+// largest frame payload accepted, in bytes
+#define METEORD_FRAME_MAX       (1024 * 1024)
+
+// link id N is tc class 1:N+10, and 1:65535 is the default class that
+// drops traffic of no link, so ids above this one cannot be used
+#define METEORD_MAX_LINK_ID     65524
+
+#define METEORD_OP_ADD          1
+#define METEORD_OP_UPDATE       2
+#define METEORD_OP_DELETE       3
+#define METEORD_OP_AT           4
+#define METEORD_OP_EPOCH        5
+#define METEORD_OP_IFACE        6
+
+#define METEORD_CLOCK_MONOTONIC 1
+#define METEORD_CLOCK_SCENARIO  2
+
+#define METEORD_HELLO_BATCH     0x0001
+
+#define METEORD_RING_MAGIC      "MTRR"
+// records in a ring, a power of 2
+#define METEORD_RING_RECS       (64 * 1024)
+
+struct meteord_hello {
+    char     magic[4];
+    uint16_t version;
+    uint16_t flags;
+} __attribute__ ((packed));
+
+struct meteord_rec {
+    uint8_t  op;
+    uint8_t  reserved;
+    uint16_t id;
+    // IPv4 address of the peer, only used by METEORD_OP_ADD
+    uint32_t addr;
+    // bit/s
+    uint32_t rate;
+    // us
+    uint32_t delay;
+    // parts per million
+    uint32_t loss;
+} __attribute__ ((packed));
+
+// same size as struct meteord_rec
+struct meteord_at_rec {
+    uint8_t  op;
+    // METEORD_CLOCK_*, only used by METEORD_OP_AT
+    uint8_t  clock;
+    uint16_t reserved;
+    // ns; for METEORD_OP_EPOCH the monotonic time of the scenario
+    // start, or 0 for the time the record is received
+    uint64_t at_ns;
+    uint64_t reserved2;
+} __attribute__ ((packed));
+
+struct meteord_commit {
+    // tc requests written and how many of them the kernel rejected
+    uint32_t ops;
+    uint32_t errors;
+    // from the first request queued to the last ack, in us
+    uint32_t latency_us;
+    // from the receipt of the command until meteord started to apply
+    // it, in us
+    uint32_t queue_us;
+} __attribute__ ((packed));
+
+// Single-producer single-consumer ring of struct meteord_rec in shared
+// memory. meteord creates and initializes it and writes the magic
+// last. The controller writes records at recs[head % size] and then
+// publishes them by storing the new head with release semantics;
+// meteord drains [tail, head) on its own schedule and releases the
+// slots by storing tail. head and tail count records and never wrap;
+// the ring is full when head - tail == size. They and the header are
+// in host byte order; records are laid out as on the socket.
+//
+// There are no frames: METEORD_OP_AT and METEORD_OP_IFACE records
+// apply to every record after them until the next one. An AT record for
+// METEORD_CLOCK_MONOTONIC time 0 returns to applying records as they
+// are drained. With METEORD_HELLO_BATCH set in flags, the records
+// drained together are applied as one tc batch. No commit is reported
+// back.
+struct meteord_ring {
+    char     magic[4];
+    uint16_t version;
+    uint16_t flags;
+    uint32_t size;
+    uint32_t reserved;
+    // written by the controller only
+    uint64_t head __attribute__ ((aligned(64)));
+    // written by meteord only
+    uint64_t tail __attribute__ ((aligned(64)));
+    struct meteord_rec recs[] __attribute__ ((aligned(64)));
+};
+
+#endif
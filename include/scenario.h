@@ -42,6 +42,10 @@
 // value of non-intialized index data
 #define INVALID_INDEX                   -1
 
+// number of slots of the name-to-index hash tables; must be a power
+// of two, and at least twice MAX_NODES and MAX_ENVIRONMENTS
+#define NAME_INDEX_SIZE                 65536
+
 // node types
 #define REGULAR_NODE                    0
 #define ACCESS_POINT_NODE               1
@@ -93,6 +97,13 @@ struct scenario_class
   // global number of interfaces for all nodes
   int if_num;
 
+  // open-addressing hash tables from the names of nodes and
+  // environments to their index + 1 (0 marks an empty slot); they
+  // are kept up to date by scenario_add_node and
+  // scenario_add_environment
+  int node_name_index[NAME_INDEX_SIZE];
+  int environment_name_index[NAME_INDEX_SIZE];
+
   // current execution time of the scenario
   double current_time;
 };
@@ -134,6 +145,14 @@ void *scenario_add_motion (struct scenario_class *scenario,
 void *scenario_add_connection (struct scenario_class *scenario,
 			       struct connection_class *connection);
 
+// return the index of the node named 'name' in the scenario,
+// or INVALID_INDEX if there is no such node
+int scenario_find_node (struct scenario_class *scenario, char *name);
+
+// return the index of the environment named 'name' in the scenario,
+// or INVALID_INDEX if there is no such environment
+int scenario_find_environment (struct scenario_class *scenario, char *name);
+
 /////////////////////////////////////////////////////
 // deltaQ computation top-level functions
 
@@ -166,20 +185,12 @@ int scenario_deltaQ (struct scenario_class *scenario, double current_time);
 void scenario_reset_node_interference_flag (struct scenario_class *scenario);
 
 
-// try to merge an object specified by index 'object_i' to other
-// objects in scenario; 
-// return TRUE if a merge operation was performed, FALSE otherwise
-int scenario_try_merge_object (struct scenario_class *scenario, int object_i);
-
-
-// merge the object specified by index 'object_i2' to the 
-// one specified by index 'object_i1'; if direct_merge is TRUE,
-// then direct vertex merging is done, by appending those of 
-// object 2 to those of object 1; if direct_merge is FALSE,
-// then the order of vertices of object 2 is reversed while merging;
+// merge the polyline objects that have the same first and last
+// vertex into polygons, and remove the polylines that cannot be
+// merged; objects with the 'make_polygon' flag set and objects that
+// are already polygons are kept unchanged;
 // return SUCCESS on success, ERROR on error
-int scenario_merge_objects (struct scenario_class *scenario, int object_i1,
-			    int object_i2, int direct_merge);
+int scenario_merge_polylines (struct scenario_class *scenario);
 
 // remove the object specified by index 'object_i' from the scenario; 
 // return SUCCESS on success, ERROR on error
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2006-2013 The StarBED Project  All rights reserved.
+ *
+ * See the file 'LICENSE' for licensing information.
+ *
+ */
+
+/************************************************************************
+ *
+ * QOMET Emulator Implementation
+ *
+ * File name: snapshot.h
+ * Function: Header file of snapshot.c
+ *
+ ***********************************************************************/
+
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "deltaQ.h"
+
+
+//////////////////////////////////
+// Constants
+//////////////////////////////////
+
+// signature and format version of snapshot files; increase the
+// version when changing the file layout below
+#define SNAPSHOT_SIGNATURE              "QMTSNAP"
+#define SNAPSHOT_VERSION                1
+
+// size of the random number generator state saved in a snapshot, to
+// be used with initstate and setstate; this is the size of the default
+// state of rand, so that initstate gives the same sequence as srand
+#define SNAPSHOT_RANDOM_STATE_SIZE      128
+
+
+//////////////////////////////////
+// Snapshot file structures
+//////////////////////////////////
+
+// A snapshot holds the scenario state reached after scenario_init_state,
+// so that later runs skip XML parsing, JPGIS loading, object merging
+// and index initialization. The header is followed by the nodes,
+// environments and connections as stored in memory, then by the objects
+// and motions without the unused part of their vertex and trace record
+// arrays, and finally by the name indexes of the scenario. Snapshots are
+// only loaded by a build whose structures have the sizes recorded in
+// the header.
+
+// snapshot file header
+struct snapshot_header
+{
+  char signature[8];
+  int32_t version;
+
+  // structure sizes of the build that wrote the snapshot
+  uint64_t scenario_size;
+  uint64_t node_size;
+  uint64_t object_size;
+  uint64_t environment_size;
+  uint64_t motion_size;
+  uint64_t connection_size;
+
+  // settings of the xml_scenario
+  double start_time;
+  double duration;
+  double step;
+  double motion_step_divider;
+  int32_t cartesian_coord_syst;
+  int32_t jpgis_filename_provided;
+  char jpgis_filename[MAX_STRING];
+
+  // flag given to scenario_init_state
+  int32_t deltaQ_disabled;
+
+  // number of scenario elements
+  int32_t node_number;
+  int32_t object_number;
+  int32_t environment_number;
+  int32_t motion_number;
+  int32_t connection_number;
+  int32_t if_num;
+
+  // random number generator state after scenario_init_state
+  char random_state[SNAPSHOT_RANDOM_STATE_SIZE];
+
+  // size of the whole file, used to detect truncated snapshots
+  uint64_t file_size;
+};
+
+
+//////////////////////////////////
+// Snapshot functions
+//////////////////////////////////
+
+// save the state of 'xml_scenario', initialized by scenario_init_state
+// with the flag 'deltaQ_disabled', and the random number generator state
+// 'random_state' to the file 'snapshot_filename';
+// return SUCCESS on success, ERROR on error
+int snapshot_save (struct xml_scenario_class *xml_scenario,
+		   int deltaQ_disabled, char *random_state,
+		   char *snapshot_filename);
+
+// load the snapshot file 'snapshot_filename' into 'xml_scenario', which
+// must have been initialized by scenario_init, and the saved random
+// number generator state into 'random_state'; a snapshot saved with
+// deltaQ computation disabled cannot be loaded if 'deltaQ_disabled' is
+// FALSE; return SUCCESS on success, ERROR on error
+int snapshot_load (struct xml_scenario_class *xml_scenario,
+		   int deltaQ_disabled, char *random_state,
+		   char *snapshot_filename);
+
+#endif
@@ -42,8 +42,15 @@
 #define __STATISTICS_H
 
 
+#include <stdint.h>
+#include <netinet/in.h>
+
 #include "deltaQ.h"
 
+struct meteor_config;
+struct nl_sock;
+struct nl_cache;
+
 
 /////////////////////////////////////////////
 // Basic constants
@@ -54,6 +61,13 @@
 #define STATISTICS_END_EXEC       -1
 #define STATISTICS_ADDRESS        "225.1.1.1"
 
+// snapshot wire format
+#define STATISTICS_MAGIC          0x4d545354  // "MTST"
+#define STATISTICS_VERSION        1
+#define STATISTICS_DGRAM_SIZE     1472
+// maximum number of nodes, as the peer count is sent in 16 bits
+#define STATISTICS_MAX_PEERS      65536
+
 //#define STATISTICS_CONNECTION_STANDARD  WLAN_802_11A
 //#define STATISTICS_CONNECTION_STANDARD  WLAN_802_11B
 //#define STATISTICS_CONNECTION_STANDARD  WLAN_802_11G
@@ -77,18 +91,111 @@ struct stats_class
 };
 
 
+// snapshot header; one snapshot of a node is split over as many
+// datagrams as needed, all integers are in network byte order
+struct stats_snapshot_hdr
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t node_id;
+  uint32_t seq;
+  uint64_t timestamp_ns;
+  // total number of peers in the snapshot, and index of the first
+  // peer record carried by this datagram
+  uint16_t peer_cnt;
+  uint16_t peer_offset;
+  uint16_t rec_cnt;
+  uint16_t reserved;
+  // total channel utilization of the node, in parts per million
+  uint32_t channel_utilization;
+} __attribute__ ((packed));
+
+// per-peer record following the header
+struct stats_peer_rec
+{
+  uint16_t peer_id;
+  uint16_t reserved;
+  uint32_t drops;
+  uint64_t bytes;
+  uint64_t packets;
+  uint32_t backlog;
+  // channel utilization caused by this peer, in parts per million
+  uint32_t channel_utilization;
+} __attribute__ ((packed));
+
+#define STATISTICS_RECS_PER_DGRAM                                       \
+  ((STATISTICS_DGRAM_SIZE - sizeof (struct stats_snapshot_hdr)) /       \
+   sizeof (struct stats_peer_rec))
+
+// counters of one peer at the last sample
+struct stats_peer_state
+{
+  uint64_t bytes;
+  uint64_t packets;
+  uint64_t drops;
+  uint64_t backlog;
+  float channel_utilization;
+};
+
+// statistics state of one meteor instance
+struct stats_context
+{
+  struct meteor_config *meteor_conf;
+
+  // sampling period in ms
+  uint32_t interval_ms;
+
+  // counters per local node, indexed by local_i * node_cnt + peer id
+  struct stats_peer_state *peers;
+
+  // utilization reported by other instances, indexed by node id
+  struct stats_class *remote;
+  int remote_cnt;
+
+  // multicast sockets; listen_sock is non-blocking and should be
+  // polled for reading
+  int send_sock;
+  int listen_sock;
+  struct sockaddr_in group;
+  uint32_t seq;
+
+  // tc dumps refreshed at every sample, and the sample itself
+  struct nl_sock *nlsock;
+  struct nl_cache *qdisc_cache;
+  struct nl_cache **class_caches;
+  struct stats_peer_state *cur;
+
+  // open-addressing index from the ifindex of the ifb of each local
+  // node to the index of the node + 1 (0 marks an empty slot)
+  int32_t *ifb_local;
+  uint32_t ifb_local_mask;
+};
+
+
 /////////////////////////////////////////////
 // Statistics functions
 /////////////////////////////////////////////
 
-// statistics communication thread that sends traffic statistics
-// to other wireconf instances
-void *stats_send_thread (void *arg);
+// allocate the statistics context of a meteor instance;
+// return NULL on error
+struct stats_context *stats_init (struct meteor_config *meteor_conf,
+				  uint32_t interval_ms);
+
+// open the sockets and tc caches of the context and take the first
+// sample; return SUCCESS or ERROR
+int stats_open (struct stats_context *ctx);
+
+// sample the tc counters of all peers and send them to other meteor
+// instances; to be called every interval_ms
+void stats_send (struct stats_context *ctx);
 
-// statistics communication thread that listens for 
-// traffic statistics sent by other wireconf instances
-void *stats_listen_thread (void *arg);
+// take in the traffic statistics sent by other meteor instances;
+// to be called whenever listen_sock is readable
+void stats_receive (struct stats_context *ctx);
 
+// fraction of time the channel described by 'binary_record' was busy
+// carrying 'delta_pkt_counter' frames of 'delta_byte_counter' bytes
+// during 'time_interval' seconds
 float compute_channel_utilization (struct bin_rec_cls *binary_record,
                    long long unsigned int delta_pkt_counter,
                    long long unsigned int delta_byte_counter,
@@ -59,6 +59,11 @@ struct timer_handle
 
     uint64_t zero;
     uint64_t next_event;
+
+    // timerfd of the pollable interface; timer_reset does not touch
+    // it, so a handle that may be closed without having been opened
+    // must have it set to -1 by its user; -1 after timer_close_fd
+    int fd;
 };
 
 
@@ -86,4 +91,30 @@ int timer_wait(struct timer_handle *handle, float time_in_s);
 // should not be called too often so as not to interfere with timing
 double timer_elapsed_time (struct timer_handle *handle);
 
+#ifdef __linux
+// Pollable interface: instead of blocking in timer_wait, arm the
+// timer for a logical time and wait for its file descriptor to
+// become readable, e.g. from an event loop
+
+// open the timerfd of the timer; return its file descriptor, 
+// or -1 on error
+int timer_open_fd (struct timer_handle *handle);
+
+// arm the timerfd to expire once at logical time 'time_in_s', an
+// absolute deadline relative to the timer "zero"; a deadline in the
+// past expires immediately; return 0 on success, -1 on error
+int timer_arm_fd (struct timer_handle *handle, double time_in_s);
+
+// disarm the timerfd; return 0 on success, -1 on error
+int timer_disarm_fd (struct timer_handle *handle);
+
+// acknowledge the expiration of the timerfd; return the number of
+// expirations since the last call, 0 if it has not expired yet,
+// or -1 on error
+int timer_read_fd (struct timer_handle *handle);
+
+// close the timerfd, unless 'fd' of the handle is -1
+void timer_close_fd (struct timer_handle *handle);
+#endif
+
 #endif
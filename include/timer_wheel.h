@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2006-2013 The StarBED Project  All rights reserved.
+ *
+ * See the file 'LICENSE' for licensing information.
+ *
+ */
+
+/************************************************************************
+ *
+ * QOMET Emulator Implementation
+ *
+ * File name: timer_wheel.h
+ * Function: Header file of the timing wheel of the timer library
+ *
+ ***********************************************************************/
+
+
+#include <stdint.h>
+#include <pthread.h>
+
+#ifndef __TIMER_WHEEL_H
+#define __TIMER_WHEEL_H
+
+// The timing wheel keeps any number of pending events in
+// TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS slots each; level L
+// holds the events that expire within 64^(L+1) ticks, and its slots
+// are moved down one level as the time reaches them. Adding and
+// cancelling an event are O(1); events are user-allocated, so the
+// wheel itself never allocates after creation. With the default tick
+// of 100 us the wheel spans 2^36 ticks (about 79 days); events beyond
+// that are parked in the last level until they come into range.
+
+// number of bits of the slot index, and number of levels
+#define TIMER_WHEEL_BITS        6
+#define TIMER_WHEEL_SLOTS       (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS      6
+
+// default tick length in ns
+#define TIMER_WHEEL_DEF_TICK_NS 100000
+
+
+///////////////////////////////////
+// Structures of the timing wheel
+///////////////////////////////////
+
+struct timer_wheel_event;
+
+// function called when an event expires; the event is no longer
+// pending and may be added again from the callback
+typedef void (*timer_wheel_callback) (struct timer_wheel_event *event,
+				      void *arg);
+
+// structure for an event; usually embedded in a user structure
+struct timer_wheel_event
+{
+    // links of the slot list, NULL if the event is not pending
+    struct timer_wheel_event *next;
+    struct timer_wheel_event *prev;
+
+    // tick at which the event expires
+    uint64_t expires;
+
+    timer_wheel_callback callback;
+    void *arg;
+};
+
+// structure for the timing wheel
+struct timer_wheel
+{
+    // tick length, and TIMER_TYPE time of tick 0, in ns
+    uint64_t tick_ns;
+    uint64_t zero_ns;
+
+    // all ticks before this one have been processed
+    uint64_t now;
+
+    // number of pending events
+    uint64_t pending;
+
+    // circular slot lists, with the heads as sentinels
+    struct timer_wheel_event slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+    // protects all of the above and the events linked to them
+    pthread_mutex_t lock;
+
+    // clock thread; it sleeps on 'wakeup' until tick 'wake_tick'
+    pthread_cond_t wakeup;
+    pthread_t thread;
+    uint64_t wake_tick;
+    int running;
+};
+
+
+/////////////////////////////////////////////
+// Functions implemented by the timing wheel
+/////////////////////////////////////////////
+
+// create a timing wheel with ticks of 'tick_ns' ns, or of
+// TIMER_WHEEL_DEF_TICK_NS if 0, starting at the current time;
+// return NULL on error
+struct timer_wheel *timer_wheel_create (uint64_t tick_ns);
+
+// stop the clock thread if running, and free the wheel; pending
+// events are dropped without calling their callbacks
+void timer_wheel_destroy (struct timer_wheel *wheel);
+
+// return the current TIMER_TYPE time in ns, the clock of all
+// expiration times given to the wheel
+uint64_t timer_wheel_time_ns (void);
+
+// initialize an event before its first use
+void timer_wheel_event_init (struct timer_wheel_event *event,
+			     timer_wheel_callback callback, void *arg);
+
+// return TRUE if the event is pending, FALSE otherwise
+int timer_wheel_pending (struct timer_wheel_event *event);
+
+// add an event expiring at TIMER_TYPE time 'expires_ns', rounded up
+// to the next tick; an event already pending is moved; a time in the
+// past expires at the next tick; return SUCCESS or ERROR
+int timer_wheel_add (struct timer_wheel *wheel,
+		     struct timer_wheel_event *event, uint64_t expires_ns);
+
+// cancel an event if it is pending; once this returns, its callback
+// will not be called unless it was already running
+void timer_wheel_cancel (struct timer_wheel *wheel,
+			 struct timer_wheel_event *event);
+
+// return the TIMER_TYPE time in ns at which the next tick with work
+// is due, for callers that drive the wheel from their own poll loop,
+// or UINT64_MAX if no event is pending
+uint64_t timer_wheel_next_ns (struct timer_wheel *wheel);
+
+// process all ticks up to TIMER_TYPE time 'now_ns' and call the
+// callbacks of the expired events in the calling thread; return the
+// number of callbacks called
+int timer_wheel_advance (struct timer_wheel *wheel, uint64_t now_ns);
+
+// start the clock thread, which calls timer_wheel_advance as the ticks
+// with events become due; return SUCCESS or ERROR
+int timer_wheel_start (struct timer_wheel *wheel);
+
+// stop the clock thread and wait for it to exit
+void timer_wheel_stop (struct timer_wheel *wheel);
+
+#endif
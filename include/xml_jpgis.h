@@ -50,6 +50,9 @@
 // read buffer size
 #define BUFFER_SIZE        8192
 
+// size of the slices of the mapped JPGIS file given to the parser
+#define JPGIS_PARSE_CHUNK  (1 << 20)
+
 // read buffer
 char xml_buffer[BUFFER_SIZE];
 
@@ -75,6 +78,7 @@ struct xml_jpgis_class
   int coordinate_found;
 
   char coordinate_text[MAX_STRING];
+  int coordinate_length;
 
   struct scenario_class *scenario;
   struct object_class *objects;
@@ -88,6 +92,11 @@ struct xml_jpgis_class
 
   int load_all_from_region;
 
+  // open-addressing index from the name of the objects to be loaded
+  // from the JPGIS file to their index + 1 (0 marks an empty slot)
+  int *object_index;
+  unsigned int object_index_mask;
+
   struct object_class temp_object;
 };
 
@@ -95,10 +104,14 @@ struct xml_jpgis_class
 // xml_jpgis functions
 /////////////////////////////////////////////////
 
-// init the xml_jpgis structure
-void xml_jpgis_init (struct xml_jpgis_class *xml_jpgis,
-		     struct scenario_class *scenario,
-		     struct object_class *objects, int object_number);
+// init the xml_jpgis structure;
+// return SUCCESS on success, ERROR on error
+int xml_jpgis_init (struct xml_jpgis_class *xml_jpgis,
+		    struct scenario_class *scenario,
+		    struct object_class *objects, int object_number);
+
+// free the memory allocated by xml_jpgis_init
+void xml_jpgis_finalize (struct xml_jpgis_class *xml_jpgis);
 
 /////////////////////////////////////////////////
 // Main XML parsing function 
@@ -0,0 +1,385 @@
+/************************************************************************
+ *
+ * Meteor Emulator Implementation
+ *
+ * File name: bench_rules.c
+ * Function: Measures the cost of installing, updating and removing
+ *           the per-peer tc rules of meteor as the peer count grows
+ *
+ * Authors : Kunio AKASHI
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netlink/route/link/veth.h>
+
+#include "global.h"
+#include "meteor.h"
+#include "libnlwrap.h"
+
+#define BENCH_DEV       "mbench0"
+#define BENCH_PEER_DEV  "mbench1"
+#define BENCH_TICKS     10
+#define BENCH_MAX_PEERS 5000
+
+static const int default_peer_cnts[] = {10, 100, 500, 1000, 2000, 5000};
+
+struct bench_result {
+    int32_t peer_cnt;
+    double install_ms;
+    double update_p50_us;
+    double update_p90_us;
+    double update_p99_us;
+    double update_max_us;
+    double tick_avg_ms;
+    double teardown_ms;
+};
+
+static double
+elapsed_us(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double
+percentile(double *sorted, size_t cnt, double p)
+{
+    size_t i = (size_t)(p * (cnt - 1) + 0.5);
+
+    return sorted[i];
+}
+
+void
+usage()
+{
+    fprintf(stderr, "Usage: bench_rules [-n peers] [-t ticks] [-b] [-R] [-j]\n");
+    fprintf(stderr, "\t-n, --peers: Number of peers (1-%d), may be repeated.\n"
+            "\t\tDefault sweeps 10 to %d.\n", BENCH_MAX_PEERS, BENCH_MAX_PEERS);
+    fprintf(stderr, "\t-t, --ticks: Update every peer <ticks> times (default %d).\n", BENCH_TICKS);
+    fprintf(stderr, "\t-b, --batch: Write each phase and tick as one tc batch;\n"
+            "\t\tupdate percentiles are then per tick.\n");
+    fprintf(stderr, "\t-R, --netem_rate: Use the netem-rate link model.\n");
+    fprintf(stderr, "\t-j, --json: Print JSON lines instead of CSV.\n");
+    fprintf(stderr, "\tMust be run as root; all links live in a private network namespace.\n");
+}
+
+// move into a private network namespace and create a veth pair there;
+// everything disappears with the process
+static int
+setup_netns(struct nl_sock *sock)
+{
+    int err, if_index;
+    struct nl_cache *cache;
+    struct rtnl_link *link, *change;
+
+    if (unshare(CLONE_NEWNET) != 0) {
+        perror("unshare");
+        return -1;
+    }
+    if (nl_connect(sock, NETLINK_ROUTE) != 0) {
+        perror("nl_connect");
+        return -1;
+    }
+    if ((err = rtnl_link_veth_add(sock, BENCH_DEV, BENCH_PEER_DEV, getpid())) < 0) {
+        nl_perror(err, "Unable to add veth pair");
+        return -1;
+    }
+
+    rtnl_link_alloc_cache(sock, AF_UNSPEC, &cache);
+    if_index = get_ifindex(cache, BENCH_DEV);
+    link = rtnl_link_get(cache, if_index);
+    change = rtnl_link_alloc();
+    rtnl_link_set_flags(change, IFF_UP);
+    rtnl_link_change(sock, link, change, 0);
+    rtnl_link_put(change);
+    rtnl_link_put(link);
+    nl_cache_put(cache);
+
+    return if_index;
+}
+
+// same sequence as init_rule() of meteor with a single shard
+static void
+bench_init(struct nl_sock *sock, int if_index)
+{
+    add_htb_qdisc(sock, if_index, TC_H_ROOT, TC_HANDLE(1, 0), 65535);
+    add_htb_class(sock, if_index, TC_HANDLE(1, 0), TC_HANDLE(1, 1), 1, DEF_BW);
+    add_htb_class(sock, if_index, TC_HANDLE(1, 0), TC_HANDLE(1, 65535), 1, DEF_BW);
+    add_netem_qdisc(sock, if_index, TC_HANDLE(1, 65535), TC_HANDLE(65535, 0),
+            DEF_DELAY, DEF_DELAY, DEF_LOSS, 1000);
+}
+
+// same sequence as add_rule() of meteor
+static void
+bench_add(struct nl_sock *sock, int if_index, int32_t id, int link_model)
+{
+    uint16_t parent = id + 10;
+    uint32_t addr = htonl(0x0a000000 + id + 1);
+
+    add_htb_class(sock, if_index, TC_HANDLE(1, 0), TC_HANDLE(1, parent), 1, DEF_BW);
+    add_class_ipv4filter(sock, if_index, TC_HANDLE(1, 0), TC_HANDLE(1, parent),
+            addr, 32, 0, 0);
+    if (link_model == LINK_MODEL_NETEM) {
+        add_netem_rate_qdisc(sock, if_index, TC_HANDLE(1, parent), TC_HANDLE(parent, 0),
+                0, 0, 100, QLEN, DEF_BW);
+    }
+    else {
+        add_netem_qdisc(sock, if_index, TC_HANDLE(1, parent), TC_HANDLE(parent, 0),
+                0, 0, 100, 1000);
+    }
+}
+
+// same sequence as configure_rule() of meteor
+static void
+bench_configure(struct nl_sock *sock, int if_index, int32_t id, int link_model,
+        int32_t bandwidth, double delay, double loss)
+{
+    uint16_t parent = id + 10;
+
+    if (link_model == LINK_MODEL_NETEM) {
+        change_netem_rate_qdisc(sock, if_index, TC_HANDLE(1, parent), TC_HANDLE(parent, 0),
+                delay, 0, loss, QLEN, bandwidth);
+        return;
+    }
+
+    change_htb_class(sock, if_index, TC_HANDLE(1, 0), TC_HANDLE(1, parent), 1, bandwidth);
+    change_netem_qdisc(sock, if_index, TC_HANDLE(1, parent), TC_HANDLE(parent, 0),
+            delay, 0, loss, 1000);
+}
+
+// same sequence as delete_rule() of meteor
+static void
+bench_delete(struct nl_sock *sock, int if_index, int32_t id)
+{
+    uint16_t parent = id + 10;
+
+    delete_qdisc(sock, if_index, TC_HANDLE(1, parent), TC_HANDLE(parent, 0));
+    delete_ipv4filter(sock, if_index, TC_HANDLE(1, 0), TC_HANDLE(1, parent));
+    delete_class(sock, if_index, TC_HANDLE(1, 0), TC_HANDLE(1, parent));
+}
+
+// with a batch, installation, every tick and teardown are each written
+// as one batch and the update percentiles are those of whole ticks
+static void
+bench_run(struct nl_sock *sock, int if_index, int32_t peer_cnt, int ticks,
+        int link_model, struct tc_batch *batch, struct bench_result *res)
+{
+    int32_t id;
+    int tick_i;
+    size_t sample_i = 0;
+    double *samples;
+    double tick_total = 0.0;
+    struct timespec start, end, op_start, op_end;
+
+    if (!(samples = calloc((size_t)peer_cnt * (ticks ? ticks : 1), sizeof (double)))) {
+        fprintf(stderr, "Cannot allocate memory for samples\n");
+        exit(1);
+    }
+
+    memset(res, 0, sizeof (struct bench_result));
+    res->peer_cnt = peer_cnt;
+
+    delete_qdisc(sock, if_index, TC_H_ROOT, 0);
+    bench_init(sock, if_index);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (batch) {
+        tc_batch_begin(batch);
+    }
+    for (id = 0; id < peer_cnt; id++) {
+        bench_add(sock, if_index, id, link_model);
+    }
+    if (batch && tc_batch_commit(batch)) {
+        fprintf(stderr, "%d of %u requests failed: %s\n", batch->errors, batch->ops,
+                nl_geterror(batch->first_error));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    res->install_ms = elapsed_us(&start, &end) / 1e3;
+
+    // every tick changes all links, as meteor does on a new time record
+    for (tick_i = 0; tick_i < ticks; tick_i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (batch) {
+            tc_batch_begin(batch);
+        }
+        for (id = 0; id < peer_cnt; id++) {
+            clock_gettime(CLOCK_MONOTONIC, &op_start);
+            bench_configure(sock, if_index, id, link_model,
+                    1000000 * (1 + (id + tick_i) % 100), (id + tick_i) % 50, (tick_i % 10) / 10.0);
+            clock_gettime(CLOCK_MONOTONIC, &op_end);
+            if (!batch) {
+                samples[sample_i++] = elapsed_us(&op_start, &op_end);
+            }
+        }
+        if (batch) {
+            tc_batch_commit(batch);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (batch) {
+            samples[sample_i++] = elapsed_us(&start, &end);
+        }
+        tick_total += elapsed_us(&start, &end) / 1e3;
+    }
+    if (ticks > 0) {
+        qsort(samples, sample_i, sizeof (double), cmp_double);
+        res->update_p50_us = percentile(samples, sample_i, 0.50);
+        res->update_p90_us = percentile(samples, sample_i, 0.90);
+        res->update_p99_us = percentile(samples, sample_i, 0.99);
+        res->update_max_us = samples[sample_i - 1];
+        res->tick_avg_ms = tick_total / ticks;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (batch) {
+        tc_batch_begin(batch);
+    }
+    for (id = 0; id < peer_cnt; id++) {
+        bench_delete(sock, if_index, id);
+    }
+    if (batch) {
+        tc_batch_commit(batch);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    res->teardown_ms = elapsed_us(&start, &end) / 1e3;
+
+    delete_qdisc(sock, if_index, TC_H_ROOT, 0);
+    free(samples);
+}
+
+static void
+print_result(struct bench_result *res, int link_model, int json, int ticks, int batched)
+{
+    const char *model = link_model == LINK_MODEL_NETEM ? "netem_rate" : "htb";
+
+    if (json) {
+        printf("{\"peers\": %d, \"model\": \"%s\", \"batch\": %d, \"ticks\": %d, \"install_ms\": %.3f, "
+                "\"update_p50_us\": %.3f, \"update_p90_us\": %.3f, \"update_p99_us\": %.3f, "
+                "\"update_max_us\": %.3f, \"tick_avg_ms\": %.3f, \"teardown_ms\": %.3f}\n",
+                res->peer_cnt, model, batched, ticks, res->install_ms,
+                res->update_p50_us, res->update_p90_us, res->update_p99_us,
+                res->update_max_us, res->tick_avg_ms, res->teardown_ms);
+    }
+    else {
+        printf("%d,%s,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                res->peer_cnt, model, batched, ticks, res->install_ms,
+                res->update_p50_us, res->update_p90_us, res->update_p99_us,
+                res->update_max_us, res->tick_avg_ms, res->teardown_ms);
+    }
+    fflush(stdout);
+}
+
+struct option options[] =
+{
+    {"batch", no_argument, NULL, 'b'},
+    {"help", no_argument, NULL, 'h'},
+    {"json", no_argument, NULL, 'j'},
+    {"peers", required_argument, NULL, 'n'},
+    {"netem_rate", no_argument, NULL, 'R'},
+    {"ticks", required_argument, NULL, 't'},
+    {0, 0, 0, 0}
+};
+
+int
+main(int argc, char **argv)
+{
+    int ch, index, i;
+    int if_index;
+    int json = FALSE;
+    int batched = FALSE;
+    int ticks = BENCH_TICKS;
+    int link_model = LINK_MODEL_HTB;
+    int peer_cnts[sizeof (default_peer_cnts) / sizeof (int)];
+    int peer_cnt_num = 0;
+    struct nl_sock *sock;
+    struct bench_result res;
+    struct tc_batch *batch = NULL;
+
+    while ((ch = getopt_long(argc, argv, "bhjn:Rt:", options, &index)) != -1) {
+        switch (ch) {
+            case 'b':
+                batched = TRUE;
+                break;
+            case 'h':
+                usage();
+                exit(0);
+            case 'j':
+                json = TRUE;
+                break;
+            case 'n':
+                if (peer_cnt_num == sizeof (peer_cnts) / sizeof (int)) {
+                    fprintf(stderr, "Too many peer counts\n");
+                    exit(1);
+                }
+                peer_cnts[peer_cnt_num] = strtol(optarg, NULL, 10);
+                if (peer_cnts[peer_cnt_num] < 1 || peer_cnts[peer_cnt_num] > BENCH_MAX_PEERS) {
+                    fprintf(stderr, "Number of peers must be in [1, %d]\n", BENCH_MAX_PEERS);
+                    exit(1);
+                }
+                peer_cnt_num++;
+                break;
+            case 'R':
+                link_model = LINK_MODEL_NETEM;
+                break;
+            case 't':
+                ticks = strtol(optarg, NULL, 10);
+                if (ticks < 0) {
+                    fprintf(stderr, "Number of ticks must not be negative\n");
+                    exit(1);
+                }
+                break;
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if (peer_cnt_num == 0) {
+        memcpy(peer_cnts, default_peer_cnts, sizeof (default_peer_cnts));
+        peer_cnt_num = sizeof (default_peer_cnts) / sizeof (int);
+    }
+
+    if (!(sock = nl_socket_alloc())) {
+        perror("nl_socket_alloc");
+        exit(1);
+    }
+    if ((if_index = setup_netns(sock)) <= 0) {
+        exit(1);
+    }
+
+    if (batched && !(batch = tc_batch_alloc(sock))) {
+        fprintf(stderr, "Cannot allocate batch\n");
+        exit(1);
+    }
+
+    if (!json) {
+        printf("peers,model,batch,ticks,install_ms,update_p50_us,update_p90_us,"
+                "update_p99_us,update_max_us,tick_avg_ms,teardown_ms\n");
+    }
+    for (i = 0; i < peer_cnt_num; i++) {
+        bench_run(sock, if_index, peer_cnts[i], ticks, link_model, batch, &res);
+        print_result(&res, link_model, json, ticks, batched);
+    }
+
+    if (batch) {
+        tc_batch_free(batch);
+    }
+    nl_socket_free(sock);
+
+    return 0;
+}
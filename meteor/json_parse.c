@@ -9,13 +9,22 @@
 #include <stdio.h>
 
 #include "json_parse.h"
+#include "meteord_proto.h"
 
 #define HEREDOC(...) #__VA_ARGS__ "\n";
 
+// TRUE if 'id' is a link id meteord can map to a tc class
+static int
+valid_link_id(long long id)
+{
+    return id >= 0 && id <= METEORD_MAX_LINK_ID;
+}
+
 struct link_params *
-parse_params(json_t *json_data)
+parse_params(json_t *json_data, int *invalid)
 {
     char *ptr;
+    long id;
     const char *node, *key;
     struct json_t *nodeval, *value;
     struct link_params *link_ptr;
@@ -64,16 +73,20 @@ parse_params(json_t *json_data)
             }
         }
 
-        if (link_ptr->delay != 0.0 || link_ptr->rate != 0.0) {
-            link_ptr->id = (uint16_t)strtol(node, &ptr, 10);
+        id = strtol(node, &ptr, 10);
+        if (ptr == node || *ptr != '\0' || !valid_link_id(id)) {
+            fprintf(stderr, "Invalid link id %s\n", node);
+            *invalid = 1;
+            continue;
         }
+        link_ptr->id = id;
     }
 
     return link_head;
 }
 
 struct node_array *
-parse_array(json_t *json_data)
+parse_array(json_t *json_data, int *invalid)
 {
     size_t index, size;
     json_t *value;
@@ -90,6 +103,11 @@ parse_array(json_t *json_data)
         return node_ary;
     }
     json_array_foreach(json_data, index, value) {
+        if (!json_is_integer(value) || !valid_link_id(json_integer_value(value))) {
+            fprintf(stderr, "Invalid link id in delete\n");
+            *invalid = 1;
+            continue;
+        }
         node_ary->id[index] = (uint16_t)json_integer_value(value);
     }
 
@@ -100,7 +118,8 @@ struct meteor_params *
 parse_json(char *req)
 {
     void *nodes;
-    const char *opcode, *node, *key;
+    const char *opcode, *node;
+    int invalid = 0;
 
     struct meteor_params *mp = NULL;
     json_t *opval, *nodeval;
@@ -117,6 +136,12 @@ parse_json(char *req)
     mp->update_params = NULL;
     mp->add_params = NULL;
     mp->delete_params = NULL;
+    mp->batch = 0;
+    mp->at_clock = 0;
+    mp->at = 0.0;
+    mp->epoch = 0;
+    mp->epoch_at = -1.0;
+    mp->ifname[0] = '\0';
     json_object_foreach(retjson, opcode, opval) {
         if (strncmp(opcode, "opts", sizeof ("opts")) == 0) {
             if (json_is_object(opval) != 1) {
@@ -127,24 +152,60 @@ parse_json(char *req)
                 node    = (char *)json_object_iter_key(nodes);
                 nodeval = json_object_iter_value(nodes);
                 printf("--> key: %s, value: %s\n", node, json_string_value(nodeval));
+                if (strncmp(node, "commit", sizeof ("commit")) == 0 &&
+                        json_string_value(nodeval) &&
+                        strcmp(json_string_value(nodeval), "batch") == 0) {
+                    mp->batch = 1;
+                }
+                else if (strncmp(node, "at", sizeof ("at")) == 0 && json_string_value(nodeval)) {
+                    mp->at = strtod(json_string_value(nodeval), NULL);
+                    if (!mp->at_clock) {
+                        mp->at_clock = METEORD_CLOCK_MONOTONIC;
+                    }
+                }
+                else if (strncmp(node, "clock", sizeof ("clock")) == 0 && json_string_value(nodeval)) {
+                    if (strcmp(json_string_value(nodeval), "scenario") == 0) {
+                        mp->at_clock = METEORD_CLOCK_SCENARIO;
+                    }
+                    else {
+                        mp->at_clock = METEORD_CLOCK_MONOTONIC;
+                    }
+                }
+                else if (strncmp(node, "epoch", sizeof ("epoch")) == 0 && json_string_value(nodeval)) {
+                    mp->epoch = 1;
+                    if (strcmp(json_string_value(nodeval), "now") != 0) {
+                        mp->epoch_at = strtod(json_string_value(nodeval), NULL);
+                    }
+                }
+                else if (strncmp(node, "interface", sizeof ("interface")) == 0 &&
+                        json_string_value(nodeval)) {
+                    strncpy(mp->ifname, json_string_value(nodeval), IFNAMSIZ - 1);
+                    mp->ifname[IFNAMSIZ - 1] = '\0';
+                }
 
                 nodes = json_object_iter_next(opval, nodes);
             }
         }
         else if (strncmp(opcode, "add", sizeof ("add")) == 0) {
-            mp->add_params = parse_params(opval);
+            mp->add_params = parse_params(opval, &invalid);
         }
         else if (strncmp(opcode, "update", sizeof ("update")) == 0) {
-            mp->update_params = parse_params(opval);
+            mp->update_params = parse_params(opval, &invalid);
         }
-        else if (strncmp(key, "delete", sizeof ("delete")) == 0) {
-            mp->delete_params = parse_array(opval);
+        else if (strncmp(opcode, "delete", sizeof ("delete")) == 0) {
+            mp->delete_params = parse_array(opval, &invalid);
         }
     }
     //printf("%s\n", json_dumps(retjson, 0));
 
     json_decref(retjson);
 
+    // a command with any link id out of range is rejected as a whole
+    if (invalid) {
+        clear_meteor_params(mp);
+        return NULL;
+    }
+
     return mp;
 }
 
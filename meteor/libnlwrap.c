@@ -1,5 +1,157 @@
 #include "libnlwrap.h"
 
+// batch the wrappers below queue their requests into instead of
+// sending them, while it is open on their socket
+static struct tc_batch *open_batch = NULL;
+
+static int
+batch_ack(struct nl_msg *msg, void *arg)
+{
+    struct tc_batch *batch = arg;
+
+    batch->pending--;
+
+    return NL_OK;
+}
+
+static int
+batch_err(struct sockaddr_nl *nla, struct nlmsgerr *e, void *arg)
+{
+    struct tc_batch *batch = arg;
+
+    batch->pending--;
+    if (!batch->errors++) {
+        batch->first_error = -nl_syserr2nlerr(e->error);
+    }
+
+    return NL_SKIP;
+}
+
+// write the queued requests in one message and collect their acks
+static int
+tc_batch_flush(struct tc_batch *batch)
+{
+    int err = 0;
+    struct nl_cb *cb;
+
+    if (!batch->len) {
+        return 0;
+    }
+    if ((err = nl_sendto(batch->sock, batch->buf, batch->len)) < 0) {
+        batch->errors += batch->queued;
+        batch->first_error = err;
+        batch->len = batch->queued = 0;
+        return err;
+    }
+    batch->pending = batch->queued;
+    batch->len = batch->queued = 0;
+
+    cb = nl_cb_clone(nl_socket_get_cb(batch->sock));
+    nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, batch_ack, batch);
+    nl_cb_err(cb, NL_CB_CUSTOM, batch_err, batch);
+    while (batch->pending > 0) {
+        if ((err = nl_recvmsgs(batch->sock, cb)) < 0) {
+            batch->errors += batch->pending;
+            batch->first_error = err;
+            batch->pending = 0;
+            break;
+        }
+    }
+    nl_cb_put(cb);
+
+    return err < 0 ? err : 0;
+}
+
+static int
+tc_batch_queue(struct tc_batch *batch, struct nl_msg *msg)
+{
+    char *buf;
+    size_t len, size;
+    struct nlmsghdr *hdr;
+
+    nl_complete_msg(batch->sock, msg);
+    hdr = nlmsg_hdr(msg);
+    len = NLMSG_ALIGN(hdr->nlmsg_len);
+
+    if (batch->len + len > TC_BATCH_CHUNK || batch->queued == TC_BATCH_MSGS) {
+        tc_batch_flush(batch);
+    }
+    if (batch->len + len > batch->size) {
+        size = batch->len + len > TC_BATCH_CHUNK ? batch->len + len : TC_BATCH_CHUNK;
+        if (!(buf = realloc(batch->buf, size))) {
+            nlmsg_free(msg);
+            batch->errors++;
+            return -NLE_NOMEM;
+        }
+        batch->buf = buf;
+        batch->size = size;
+    }
+
+    memcpy(batch->buf + batch->len, hdr, hdr->nlmsg_len);
+    memset(batch->buf + batch->len + hdr->nlmsg_len, 0, len - hdr->nlmsg_len);
+    batch->len += len;
+    batch->queued++;
+    batch->ops++;
+    nlmsg_free(msg);
+
+    return 0;
+}
+
+// send 'msg' and wait for its ack, or queue it into the open batch
+static int
+submit_request(struct nl_sock *sock, struct nl_msg *msg)
+{
+    if (open_batch && open_batch->sock == sock) {
+        return tc_batch_queue(open_batch, msg);
+    }
+
+    return nl_send_sync(sock, msg);
+}
+
+struct tc_batch *
+tc_batch_alloc(struct nl_sock *sock)
+{
+    struct tc_batch *batch;
+
+    if (!(batch = calloc(1, sizeof (struct tc_batch)))) {
+        return NULL;
+    }
+    batch->sock = sock;
+
+    return batch;
+}
+
+void
+tc_batch_free(struct tc_batch *batch)
+{
+    if (open_batch == batch) {
+        open_batch = NULL;
+    }
+    free(batch->buf);
+    free(batch);
+}
+
+void
+tc_batch_begin(struct tc_batch *batch)
+{
+    batch->len = batch->queued = batch->pending = 0;
+    batch->ops = 0;
+    batch->errors = 0;
+    batch->first_error = 0;
+    open_batch = batch;
+}
+
+int
+tc_batch_commit(struct tc_batch *batch)
+{
+    if (open_batch == batch) {
+        open_batch = NULL;
+    }
+    tc_batch_flush(batch);
+
+    return batch->errors;
+}
+
 int
 get_ifindex(struct nl_cache *cache, char *ifname)
 {
@@ -19,13 +171,15 @@ add_ingress_qdisc(struct nl_sock *sock, int if_index)
 {
     int err;
     struct rtnl_qdisc *qdisc;
+    struct nl_msg *msg;
     qdisc = rtnl_qdisc_alloc();
 
     rtnl_tc_set_ifindex(TC_CAST(qdisc), if_index);
     rtnl_tc_set_parent(TC_CAST(qdisc), TC_H_INGRESS);
     rtnl_tc_set_kind(TC_CAST(qdisc), "ingress");
 
-    if ((err = rtnl_qdisc_add(sock, qdisc, NLM_F_CREATE)) < 0) {
+    if ((err = rtnl_qdisc_build_add_request(qdisc, NLM_F_CREATE, &msg)) < 0 ||
+            (err = submit_request(sock, msg)) < 0) {
         printf("Can not add ingress qdisc: %s\n", nl_geterror(err));
         return -1;
     }
@@ -37,10 +191,12 @@ int
 add_mirred_filter(struct nl_sock *sock, int src_if, int dst_if)
 {
     struct rtnl_cls *cls;
+    struct nl_msg *msg;
 
     cls = rtnl_cls_alloc();
     rtnl_tc_set_ifindex(TC_CAST(cls), src_if);
     rtnl_tc_set_parent(TC_CAST(cls), TC_HANDLE(0xffff, 0));
+    rtnl_cls_set_prio(cls, MIRRED_PRIO);
     rtnl_cls_set_protocol(cls, ETH_P_ALL);
     rtnl_tc_set_kind(TC_CAST(cls), "u32");
 
@@ -61,7 +217,8 @@ add_mirred_filter(struct nl_sock *sock, int src_if, int dst_if)
     rtnl_u32_set_cls_terminal(cls);
 
     int err;
-    if ((err = rtnl_cls_add(sock, cls, NLM_F_CREATE)) < 0) {
+    if ((err = rtnl_cls_build_add_request(cls, NLM_F_CREATE, &msg)) < 0 ||
+            (err = submit_request(sock, msg)) < 0) {
         printf("Can not add classifier: %s\n", nl_geterror(err));
 
         return -1;
@@ -82,6 +239,7 @@ add_class_ipv4filter(struct nl_sock *sock, int if_index,
     int offset;
     uint32_t src_mask, dst_mask;
     struct rtnl_cls *cls;
+    struct nl_msg *msg;
 
     if (src_addr == 0 && dst_addr == 0) {
         return -1;
@@ -111,7 +269,8 @@ add_class_ipv4filter(struct nl_sock *sock, int if_index,
     rtnl_u32_set_cls_terminal(cls);
 
     int err;
-    if ((err = rtnl_cls_add(sock, cls, NLM_F_CREATE)) < 0) {
+    if ((err = rtnl_cls_build_add_request(cls, NLM_F_CREATE, &msg)) < 0 ||
+            (err = submit_request(sock, msg)) < 0) {
         printf("Can not add IPv4 address filter: %s\n", nl_geterror(err));
         return -1;
     }
@@ -128,6 +287,7 @@ add_class_macfilter(struct nl_sock *sock, int if_index,
 {
     int err;
     struct rtnl_cls *cls;
+    struct nl_msg *msg;
 
     cls = rtnl_cls_alloc();
 
@@ -152,7 +312,8 @@ add_class_macfilter(struct nl_sock *sock, int if_index,
     rtnl_u32_set_classid(cls, handle);
     rtnl_u32_set_cls_terminal(cls);
 
-    if ((err = rtnl_cls_add(sock, cls, NLM_F_CREATE)) < 0) {
+    if ((err = rtnl_cls_build_add_request(cls, NLM_F_CREATE, &msg)) < 0 ||
+            (err = submit_request(sock, msg)) < 0) {
         printf("Can not add mac address filter: %s\n", nl_geterror(err));
         return -1;
     }
@@ -162,12 +323,36 @@ add_class_macfilter(struct nl_sock *sock, int if_index,
     return 0;
 }
 
+int
+add_mq_qdisc(struct nl_sock *sock, int if_index, uint32_t handle)
+{
+    int err;
+    struct rtnl_qdisc *qdisc;
+    struct nl_msg *msg;
+    qdisc = rtnl_qdisc_alloc();
+
+    rtnl_tc_set_ifindex(TC_CAST(qdisc), if_index);
+    rtnl_tc_set_parent(TC_CAST(qdisc), TC_H_ROOT);
+    rtnl_tc_set_handle(TC_CAST(qdisc), handle);
+    rtnl_tc_set_kind(TC_CAST(qdisc), "mq");
+
+    if ((err = rtnl_qdisc_build_add_request(qdisc, NLM_F_CREATE, &msg)) < 0 ||
+            (err = submit_request(sock, msg)) < 0) {
+        printf("Can not add mq Qdisc: %s\n", nl_geterror(err));
+        return -1;
+    }
+
+    rtnl_qdisc_put(qdisc);
+    return 0;
+}
+
 int
 add_htb_qdisc(struct nl_sock *sock, int if_index, 
         uint32_t parent, uint32_t handle, uint32_t defcls)
 {
     int err;
     struct rtnl_qdisc *qdisc;
+    struct nl_msg *msg;
     qdisc = rtnl_qdisc_alloc();
 
     rtnl_tc_set_ifindex(TC_CAST(qdisc), if_index);
@@ -176,7 +361,8 @@ add_htb_qdisc(struct nl_sock *sock, int if_index,
     rtnl_tc_set_kind(TC_CAST(qdisc), "htb");
     rtnl_htb_set_defcls(qdisc, defcls);
 
-    if ((err = rtnl_qdisc_add(sock, qdisc, NLM_F_CREATE)) < 0) {
+    if ((err = rtnl_qdisc_build_add_request(qdisc, NLM_F_CREATE, &msg)) < 0 ||
+            (err = submit_request(sock, msg)) < 0) {
         printf("Can not add HTB Qdisc: %s\n", nl_geterror(err));
         return -1;
     }
@@ -191,6 +377,7 @@ add_htb_class(struct nl_sock *sock, int if_index,
 {
     int err;
     struct rtnl_class *class;
+    struct nl_msg *msg;
 
     class = rtnl_class_alloc();
     rtnl_tc_set_ifindex(TC_CAST(class), if_index);
@@ -205,7 +392,8 @@ add_htb_class(struct nl_sock *sock, int if_index,
     rtnl_htb_set_rate(class, rate / 8);
     rtnl_htb_set_ceil(class, rate / 8);
 
-    if ((err = rtnl_class_add(sock, class, NLM_F_CREATE)) < 0) {
+    if ((err = rtnl_class_build_add_request(class, NLM_F_CREATE, &msg)) < 0 ||
+            (err = submit_request(sock, msg)) < 0) {
         printf("Can not add HTB class: %s\n", nl_geterror(err));
         return -1;
     }
@@ -221,6 +409,7 @@ change_htb_class(struct nl_sock *sock, int if_index,
 {
     int err;
     struct rtnl_class *class;
+    struct nl_msg *msg;
 
     class = rtnl_class_alloc();
     rtnl_tc_set_ifindex(TC_CAST(class), if_index);
@@ -235,7 +424,8 @@ change_htb_class(struct nl_sock *sock, int if_index,
     rtnl_htb_set_rate(class, rate / 8);
     rtnl_htb_set_ceil(class, rate / 8);
 
-    if ((err = rtnl_class_add(sock, class, NLM_F_REPLACE)) < 0) {
+    if ((err = rtnl_class_build_add_request(class, NLM_F_REPLACE, &msg)) < 0 ||
+            (err = submit_request(sock, msg)) < 0) {
         printf("Can not change HTB class: %s\n", nl_geterror(err));
         return -1;
     }
@@ -252,6 +442,7 @@ add_netem_qdisc(struct nl_sock *sock, int if_index,
 {
     int err;
     struct rtnl_qdisc *qdisc;
+    struct nl_msg *msg;
     qdisc = rtnl_qdisc_alloc();
 
     rtnl_tc_set_ifindex(TC_CAST(qdisc), if_index);
@@ -262,7 +453,8 @@ add_netem_qdisc(struct nl_sock *sock, int if_index,
     rtnl_netem_set_jitter(qdisc, jitter);
     rtnl_netem_set_loss(qdisc, 0xffffffff / 100 * loss);
 
-    if ((err = rtnl_qdisc_add(sock, qdisc, NLM_F_CREATE)) < 0) {
+    if ((err = rtnl_qdisc_build_add_request(qdisc, NLM_F_CREATE, &msg)) < 0 ||
+            (err = submit_request(sock, msg)) < 0) {
         printf("Can not add Netem. parent: %u. handle: %u. error: %s\n",
                 parent, handle, nl_geterror(err));
         return -1;
@@ -279,6 +471,7 @@ change_netem_qdisc(struct nl_sock *sock, int if_index,
 {
     int err;
     struct rtnl_qdisc *qdisc;
+    struct nl_msg *msg;
     qdisc = rtnl_qdisc_alloc();
 
     rtnl_tc_set_ifindex(TC_CAST(qdisc), if_index);
@@ -289,7 +482,8 @@ change_netem_qdisc(struct nl_sock *sock, int if_index,
     rtnl_netem_set_jitter(qdisc, jitter);
     rtnl_netem_set_loss(qdisc, 0xffffffff / 100 * loss);
 
-    if ((err = rtnl_qdisc_add(sock, qdisc, NLM_F_REPLACE)) < 0) {
+    if ((err = rtnl_qdisc_build_add_request(qdisc, NLM_F_REPLACE, &msg)) < 0 ||
+            (err = submit_request(sock, msg)) < 0) {
         printf("Can not add netem: %s\n", nl_geterror(err));
         return -1;
     }
@@ -298,12 +492,94 @@ change_netem_qdisc(struct nl_sock *sock, int if_index,
     return 0;
 }
 
+// libnl has no setter for the netem rate, so the request is built by
+// libnl and TCA_NETEM_RATE is appended to its TCA_OPTIONS, which
+// rtnl_tc_msg_build() always puts last
+static int
+netem_rate_qdisc(struct nl_sock *sock, int if_index,
+        uint32_t parent, uint32_t handle,
+        int delay, int jitter, int loss, int limit, uint64_t rate, int flags)
+{
+    int err;
+    struct nl_msg *msg;
+    struct nlmsghdr *hdr;
+    struct nlattr *opts;
+    struct rtnl_qdisc *qdisc;
+    struct tc_netem_rate netem_rate;
+    qdisc = rtnl_qdisc_alloc();
+
+    rtnl_tc_set_ifindex(TC_CAST(qdisc), if_index);
+    rtnl_tc_set_parent(TC_CAST(qdisc), parent);
+    rtnl_tc_set_handle(TC_CAST(qdisc), handle);
+    rtnl_tc_set_kind(TC_CAST(qdisc), "netem");
+    rtnl_netem_set_delay(qdisc, delay);
+    rtnl_netem_set_jitter(qdisc, jitter);
+    rtnl_netem_set_loss(qdisc, 0xffffffff / 100 * loss);
+    rtnl_netem_set_limit(qdisc, limit);
+
+    if ((err = rtnl_qdisc_build_add_request(qdisc, flags, &msg)) < 0) {
+        printf("Can not build netem request: %s\n", nl_geterror(err));
+        rtnl_qdisc_put(qdisc);
+        return -1;
+    }
+    rtnl_qdisc_put(qdisc);
+
+    // bytes/s; 0 disables rate limitation
+    memset(&netem_rate, 0, sizeof (netem_rate));
+    netem_rate.rate = rate / 8 > UINT32_MAX ? UINT32_MAX : rate / 8;
+
+    hdr = nlmsg_hdr(msg);
+    opts = nlmsg_find_attr(hdr, sizeof (struct tcmsg), TCA_OPTIONS);
+    if (!opts || nla_put(msg, TCA_NETEM_RATE, sizeof (netem_rate), &netem_rate) < 0) {
+        printf("Can not set netem rate\n");
+        nlmsg_free(msg);
+        return -1;
+    }
+    // the 32-bit rate above saturates; the kernel takes the full one
+    // from TCA_NETEM_RATE64
+    if (rate / 8 > UINT32_MAX && nla_put_u64(msg, TCA_NETEM_RATE64, rate / 8) < 0) {
+        printf("Can not set netem rate\n");
+        nlmsg_free(msg);
+        return -1;
+    }
+    // TCA_OPTIONS is the last attribute libnl wrote, so it is grown up
+    // to the message tail to take in the rate attributes appended above
+    opts->nla_len = (char *)nlmsg_tail(hdr) - (char *)opts;
+
+    if ((err = submit_request(sock, msg)) < 0) {
+        printf("Can not set netem. parent: %u. handle: %u. error: %s\n",
+                parent, handle, nl_geterror(err));
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+add_netem_rate_qdisc(struct nl_sock *sock, int if_index, 
+        uint32_t parent, uint32_t handle,
+        int delay, int jitter, int loss, int limit, uint64_t rate)
+{
+    return netem_rate_qdisc(sock, if_index, parent, handle,
+            delay, jitter, loss, limit, rate, NLM_F_CREATE);
+}
+
+int
+change_netem_rate_qdisc(struct nl_sock *sock, int if_index, 
+        uint32_t parent, uint32_t handle,
+        int delay, int jitter, int loss, int limit, uint64_t rate)
+{
+    return netem_rate_qdisc(sock, if_index, parent, handle,
+            delay, jitter, loss, limit, rate, NLM_F_REPLACE);
+}
+
 int
 delete_qdisc(struct nl_sock *sock, int if_index,
         uint32_t parent, uint32_t handle)
 {
     int ret;
     struct rtnl_qdisc *qdisc;
+    struct nl_msg *msg;
 
     qdisc = rtnl_qdisc_alloc();
     rtnl_tc_set_ifindex(TC_CAST(qdisc), if_index);
@@ -312,7 +588,9 @@ delete_qdisc(struct nl_sock *sock, int if_index,
         rtnl_tc_set_handle(TC_CAST(qdisc), handle);
     }
 
-    ret = rtnl_qdisc_delete(sock, qdisc);
+    if ((ret = rtnl_qdisc_build_delete_request(qdisc, &msg)) == 0) {
+        ret = submit_request(sock, msg);
+    }
 
     rtnl_qdisc_put(qdisc);
 
@@ -325,6 +603,7 @@ delete_class(struct nl_sock *sock, int if_index,
 {
     int ret;
     struct rtnl_class *class;
+    struct nl_msg *msg;
 
     class = rtnl_class_alloc();
     rtnl_tc_set_ifindex(TC_CAST(class), if_index);
@@ -333,7 +612,9 @@ delete_class(struct nl_sock *sock, int if_index,
         rtnl_tc_set_handle(TC_CAST(class), handle);
     }
 
-    ret = rtnl_class_delete(sock, class);
+    if ((ret = rtnl_class_build_delete_request(class, &msg)) == 0) {
+        ret = submit_request(sock, msg);
+    }
     rtnl_class_put(class);
 
     return ret;
@@ -345,6 +626,7 @@ delete_ipv4filter(struct nl_sock *sock, int if_index,
 {
     int ret;
     struct rtnl_cls *cls;
+    struct nl_msg *msg;
 
     cls = rtnl_cls_alloc();
 
@@ -355,7 +637,9 @@ delete_ipv4filter(struct nl_sock *sock, int if_index,
     rtnl_tc_set_kind(TC_CAST(cls), "u32");
 
 
-    ret = rtnl_cls_delete(sock, cls, 0);
+    if ((ret = rtnl_cls_build_delete_request(cls, 0, &msg)) == 0) {
+        ret = submit_request(sock, msg);
+    }
     rtnl_cls_put(cls);
 
     return ret;
@@ -17,10 +17,15 @@
 #include <signal.h>
 #include <getopt.h>
 #include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include <sys/queue.h>
 #include <sys/socket.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <ev.h>
 
 #include "global.h"
 //#include "wireconf.h"
@@ -33,30 +38,39 @@
 #include "libnlwrap.h"
 
 int32_t re_flag = FALSE;
-
-#ifdef __amd64__
-#define rdtsc(t)                                                              \
-    __asm__ __volatile__ ("rdtsc; movq %%rdx, %0; salq $32, %0;orq %%rax, %0" \
-    : "=r"(t) : : "%rax", "%rdx"); 
-#else
-#define rdtsc(t) asm volatile("rdtsc" : "=A" (t))
-#endif
+int32_t rescale_flag = FALSE;
+int32_t time_scale_req = 0;
+// wakes the event loop after a signal handler set one of the flags
+ev_async signal_watch;
 
 void
 usage()
 {
     fprintf(stderr, "Meteor. Wireless network emulator.\n\n");
     fprintf(stderr, "\tUsage: meteor -q <deltaQ_binary_file>"
-            " -i <node_id> -s <settings_file>\n"
+            " -i <node_id>[,<node_id>...] -s <settings_file>\n"
             "\t\t[-m <in|br>] [-M] [-I <Interface Name>] "
-            "[-a <assign_id>] [-l] [-d] [-v]\n");
+            "[-a <assign_id>] [-S <shards>] [-R] [-r] [-T <scale>]\n"
+            "\t\t[-P <cpu>[:<priority>]] [-l] [-d] [-v]\n");
 
     fprintf(stderr, "\t-q, --qomet_scenario: Scenario file.\n");
-    fprintf(stderr, "\t-i, --id: Own ID in QOMET scenario\n");
+    fprintf(stderr, "\t-i, --id: Own ID(s) in QOMET scenario, e.g. 3,4,5-20\n");
     fprintf(stderr, "\t-s, --settings: Setting file.\n");
     fprintf(stderr, "\t-m, --mode: ingress|hypervisor|bridge\n");
     fprintf(stderr, "\t-M, --use_mac_address: Use MAC Address filtering.\n");
     fprintf(stderr, "\t-I, --interface: Select physical interface.\n");
+    fprintf(stderr, "\t-S, --shards: Replicate the peer rules over <shards> ifb queues. The ifb\n"
+            "\t\tpicks the queue of a flow by hash, so a peer whose flows reach\n"
+            "\t\tseveral queues gets its bandwidth in each of them.\n");
+    fprintf(stderr, "\t-R, --netem_rate: Shape bandwidth with netem rate instead of HTB.\n");
+    fprintf(stderr, "\t-r, --reconcile: Reuse and fix up existing tc rules, keep them at exit.\n");
+    fprintf(stderr, "\t-T, --time-scale: Run the scenario <scale> times faster (%.1f-%.1f).\n"
+            "\t\tSend SIGRTMIN with value <scale * 1000> to change it at run time,\n"
+            "\t\tor with no value to restore it.\n", MIN_TIME_SCALE, MAX_TIME_SCALE);
+    fprintf(stderr, "\t-t, --stats: Publish per-peer tc counters every <interval> ms.\n");
+    fprintf(stderr, "\t-P, --rt: Real-time profile: run the replay loop on <cpu> with\n"
+            "\t\tSCHED_FIFO <priority> (default %d) and locked memory; statistics\n"
+            "\t\tare then sampled on a separate, normal thread.\n", RT_DEF_PRIORITY);
     fprintf(stderr, "\t-l, --loop: Scenario loop mode.\n");
     fprintf(stderr, "\t-d, --daemon: Daemon mode.\n");
     fprintf(stderr, "\t-v, --verbose: Verbose mode.\n");
@@ -66,6 +80,19 @@ void
 restart_scenario()
 {
     re_flag = TRUE;
+    if (ev_is_active(&signal_watch)) {
+        ev_async_send(EV_DEFAULT, &signal_watch);
+    }
+}
+
+void
+change_time_scale(int sig, siginfo_t *info, void *ctx)
+{
+    time_scale_req = info->si_value.sival_int;
+    rescale_flag = TRUE;
+    if (ev_is_active(&signal_watch)) {
+        ev_async_send(EV_DEFAULT, &signal_watch);
+    }
 }
 
 struct meteor_config *
@@ -74,18 +101,33 @@ init_meteor_conf()
     struct meteor_config *meteor_conf;
 
     meteor_conf = malloc(sizeof (struct meteor_config));
-    memset(meteor_conf, '0', sizeof (struct meteor_config));
     if (!meteor_conf) {
         fprintf(stderr, "[%s] Cannot allocate memory\n", __func__);
         exit(1);
     }
+    memset(meteor_conf, 0, sizeof (struct meteor_config));
     meteor_conf->id          = -1;
+    meteor_conf->local_cnt   = 0;
+    meteor_conf->local       = NULL;
+    meteor_conf->local_map   = NULL;
     meteor_conf->loop        = FALSE;
     meteor_conf->direction   = INGRESS;
     meteor_conf->node_cnt    = -1;
     meteor_conf->verbose     = 0;
     meteor_conf->filter_mode = ETH_P_IP;
+    meteor_conf->shards      = 1;
+    meteor_conf->link_model  = LINK_MODEL_HTB;
+    meteor_conf->reconcile   = FALSE;
+    meteor_conf->time_scale  = DEF_TIME_SCALE;
+    meteor_conf->time_scale_def  = DEF_TIME_SCALE;
+    meteor_conf->real_anchor     = 0.0;
+    meteor_conf->scenario_anchor = 0.0;
+    meteor_conf->cur_recs        = NULL;
+    meteor_conf->cur_recs_stride = 0;
+    meteor_conf->stats_interval  = 0;
     meteor_conf->daemonize   = FALSE;
+    meteor_conf->rt_cpu      = -1;
+    meteor_conf->rt_priority = RT_DEF_PRIORITY;
     meteor_conf->deltaq_fd   = NULL;
     meteor_conf->settings_fd = NULL;
     meteor_conf->logfd       = NULL;
@@ -95,87 +137,51 @@ init_meteor_conf()
     return meteor_conf;
 }
 
-int
-timer_wait_rdtsc(struct timer_handle *handle, uint64_t time_in_us)
-{
-    uint64_t crt_time;
-
-    handle->next_event = handle->zero + (handle->cpu_frequency * time_in_us) / 1000000;
-    rdtsc(crt_time);
-
-    if (handle->next_event < crt_time) {
-        return ERROR;
-    }
-
-    do {
-        if (re_flag == TRUE) {
-            return 2;
-        }
-
-        usleep(100);
-        rdtsc(crt_time);
-    } while (handle->next_event >= crt_time);
-
-    return SUCCESS;
-}
-
-uint32_t
-get_cpu_frequency(void)
+// real time in seconds since the timer zero at which scenario time
+// 'scenario_time' is reached with the current time scale
+double
+scenario_to_real_time(struct meteor_config *meteor_conf, double scenario_time)
 {
-    char str[256];
-    char buff[256];
-    uint32_t hz = 0;
-    double tmp_hz;
-    FILE *cpuinfo;
-
-    if ((cpuinfo = fopen("/proc/cpuinfo", "r")) == NULL) {
-        fprintf(stderr, "[%s] /proc/cpuinfo file cannot open\n", __func__);
-        exit(EXIT_FAILURE);
-    }
-
-    while (fgets(str, sizeof (str), cpuinfo) != NULL) {
-        if (strstr(str, "cpu MHz") != NULL) {
-            memset(buff, 0, sizeof (buff));
-            strncpy(buff, str + 11, strlen(str + 11));
-            tmp_hz = atof(buff);
-            hz = tmp_hz * 1000 * 1000;
-            break;
-        }
-    }
-    fclose(cpuinfo);
-
-    return hz;
+    return meteor_conf->real_anchor +
+        (scenario_time - meteor_conf->scenario_anchor) / meteor_conf->time_scale;
 }
 
+// restart the scenario/real time mapping at the timer zero
 void
-timer_free(struct timer_handle *handle)
+reset_time_scale(struct meteor_config *meteor_conf)
 {
-    free(handle);
+    meteor_conf->real_anchor = 0.0;
+    meteor_conf->scenario_anchor = 0.0;
 }
 
+// apply a time scale requested through SIGRTMIN; the mapping is
+// re-anchored at the current instant so that scenario time is continuous
 void
-timer_reset_rdtsc(struct timer_handle *handle)
+apply_time_scale(struct meteor_config *meteor_conf, struct timer_handle *handle)
 {
-    rdtsc(handle->next_event);
-    rdtsc(handle->zero);
-    //dprintf(("[timer_reset] next_event : %lu\n", handle->next_event));
-    //dprintf(("[timer_reset] zero : %lu\n", handle->zero));
-}
+    double real_now, scale;
 
-struct timer_handle *
-timer_init_rdtsc(void)
-{
-    struct timer_handle *handle;
-    
-    handle = (struct timer_handle *)malloc(sizeof (struct timer_handle));
-    if (!handle) {
-        WARNING("[%s] Could not allocate memory for the timer", __func__);
-        return NULL;
+    rescale_flag = FALSE;
+    if (time_scale_req == 0) {
+        scale = meteor_conf->time_scale_def;
+    }
+    else {
+        scale = time_scale_req / 1000.0;
+    }
+    if (scale < MIN_TIME_SCALE || scale > MAX_TIME_SCALE) {
+        fprintf(meteor_conf->logfd, "Ignoring invalid time scale %.3f\n", scale);
+        return;
+    }
+
+    real_now = timer_elapsed_time(handle);
+    meteor_conf->scenario_anchor += (real_now - meteor_conf->real_anchor) * meteor_conf->time_scale;
+    meteor_conf->real_anchor = real_now;
+    meteor_conf->time_scale = scale;
+
+    if (meteor_conf->verbose >= 1) {
+        fprintf(meteor_conf->logfd, "Time scale set to %.3f at scenario time %.6f s\n",
+                scale, meteor_conf->scenario_anchor);
     }
-    handle->cpu_frequency = get_cpu_frequency();
-    timer_reset_rdtsc(handle);
-    
-    return handle;
 }
 
 struct connection_list *
@@ -243,11 +249,12 @@ create_conn_list(struct meteor_config *meteor_conf)
 }
 
 int32_t
-create_ifb(struct nl_sock *sock, int32_t id)
+create_ifb(struct nl_sock *sock, int32_t id, uint32_t queues)
 {
     char *ifbdevname;
     int err;
     int if_index;
+    uint32_t tx_queues;
     struct nl_cache *cache;
     struct rtnl_link *link;
 
@@ -255,7 +262,6 @@ create_ifb(struct nl_sock *sock, int32_t id)
     sprintf(ifbdevname, "ifb%d", id);
     rtnl_link_alloc_cache(sock, AF_UNSPEC, &cache);
     if_index = rtnl_link_name2i(cache, ifbdevname);
-    nl_cache_put(cache);
 
     if (!if_index) {
         if (!(link = rtnl_link_alloc())) {
@@ -263,18 +269,37 @@ create_ifb(struct nl_sock *sock, int32_t id)
         }
         rtnl_link_set_name(link, ifbdevname);
         rtnl_link_set_type(link, "ifb");
-        rtnl_link_set_num_tx_queues(link, 8);
-        rtnl_link_set_num_rx_queues(link, 8);
+        rtnl_link_set_num_tx_queues(link, queues);
+        rtnl_link_set_num_rx_queues(link, queues);
         if ((err = rtnl_link_add(sock, link, NLM_F_CREATE)) < 0) {
             nl_perror(err, "Unable to add link");
+            nl_cache_put(cache);
             return err;
         }
-        rtnl_link_alloc_cache(sock, AF_UNSPEC, &cache);
+        nl_cache_refill(sock, cache);
         if_index = rtnl_link_name2i(cache, ifbdevname);
         rtnl_link_put(link);
-        nl_cache_put(cache);
     }
 
+    // a sharded tree needs exactly one ifb queue per shard: a queue
+    // without its own HTB tree would get the default pfifo of mq and
+    // pass traffic unshaped, so an existing ifb of another size is
+    // not reused
+    if (queues > 1) {
+        tx_queues = 0;
+        if ((link = rtnl_link_get(cache, if_index))) {
+            tx_queues = rtnl_link_get_num_tx_queues(link);
+            rtnl_link_put(link);
+        }
+        if (tx_queues != queues) {
+            fprintf(stderr, "%s has %u tx queues instead of %u; delete it or change the number of shards\n",
+                    ifbdevname, tx_queues, queues);
+            nl_cache_put(cache);
+            return -1;
+        }
+    }
+    nl_cache_put(cache);
+
     uint32_t flags;
     if (!(link = rtnl_link_alloc())) {
         perror("Unable to alloc link");
@@ -312,12 +337,51 @@ delete_ifb(struct nl_sock *sock, int32_t if_index)
     return 0;
 }
 
+// HTB major number of shard 'shard_i'; without sharding every peer
+// lives under the single root 1:
+uint16_t
+shard_major(struct meteor_config *meteor_conf, uint32_t shard_i)
+{
+    if (meteor_conf->shards <= 1) {
+        return 1;
+    }
+
+    return SHARD_HTB_MAJOR + shard_i;
+}
+
+// major number of the netem qdisc under class 'parent' of shard
+// 'shard_i'; it is 'parent' itself without sharding
+uint16_t
+netem_major(struct meteor_config *meteor_conf, uint16_t parent, uint32_t shard_i)
+{
+    return parent + shard_i * SHARD_NETEM_STRIDE(meteor_conf->shards);
+}
+
+void
+init_shard(struct nl_sock *sock, int ifb_index, uint32_t parent,
+        uint16_t major, uint16_t def_major)
+{
+    add_htb_qdisc(sock, ifb_index, parent, TC_HANDLE(major, 0), 65535);
+    add_htb_class(sock, ifb_index, TC_HANDLE(major, 0),
+            TC_HANDLE(major, 1), 1, DEF_BW);
+    add_htb_class(sock, ifb_index, TC_HANDLE(major, 0), 
+            TC_HANDLE(major, 65535), 1, DEF_BW);
+
+    int delay     = DEF_DELAY; // us
+    int jitter    = DEF_DELAY; // us
+    uint32_t loss = DEF_LOSS;  // %
+    add_netem_qdisc(sock, ifb_index,
+            TC_HANDLE(major, 65535), TC_HANDLE(def_major, 0),
+            delay, jitter, loss, 1000);
+}
+
 int
-init_rule(struct meteor_config *meteor_conf)
+init_rule(struct meteor_config *meteor_conf, struct local_node *ln)
 {
+    uint32_t shard_i;
     struct nl_sock *sock = meteor_conf->nlsock;
-    int pif_index = meteor_conf->pif_index;
-    int ifb_index = meteor_conf->ifb_index;
+    int pif_index = ln->pif_index;
+    int ifb_index = ln->ifb_index;
 
     delete_qdisc(sock, pif_index, TC_H_INGRESS, 0);
     add_ingress_qdisc(sock, pif_index);
@@ -325,371 +389,1135 @@ init_rule(struct meteor_config *meteor_conf)
 
     delete_qdisc(sock, ifb_index, TC_H_ROOT, 0);
 
-    add_htb_qdisc(sock, ifb_index, TC_H_ROOT, TC_HANDLE(1, 0), 65535);
-    add_htb_class(sock, ifb_index, TC_HANDLE(1, 0), TC_HANDLE(1, 1), 1, DEF_BW);
-
-    add_htb_class(sock, ifb_index, TC_HANDLE(1, 0), 
-            TC_HANDLE(1, 1), 1, DEF_BW);
-    add_htb_class(sock, ifb_index, TC_HANDLE(1, 0), 
-            TC_HANDLE(1, 65535), 1, DEF_BW);
+    if (meteor_conf->shards <= 1) {
+        init_shard(sock, ifb_index, TC_H_ROOT, 1, 65535);
+    }
+    else {
+        // one HTB tree per ifb tx queue, so that each queue has its own
+        // qdisc lock; the default class of every shard drops like 1:65535,
+        // so traffic of no peer, redirected by the catch-all filter above,
+        // is dropped whichever queue it reaches
+        add_mq_qdisc(sock, ifb_index, TC_HANDLE(1, 0));
+        for (shard_i = 0; shard_i < meteor_conf->shards; shard_i++) {
+            init_shard(sock, ifb_index, TC_HANDLE(1, shard_i + 1),
+                    SHARD_HTB_MAJOR + shard_i, SHARD_DEF_MAJOR + shard_i);
+        }
+    }
 
-    int delay     = DEF_DELAY; // us
-    int jitter    = DEF_DELAY; // us
-    uint32_t loss = DEF_LOSS;  // %
-    add_netem_qdisc(sock, meteor_conf->ifb_index, 
-            TC_HANDLE(1, 65535), TC_HANDLE(65535, 0),
-            delay, jitter, loss, 1000);
+    // an empty class records that the tree uses the netem-rate link
+    // model, whose peer classes and netems are set up differently
+    if (meteor_conf->link_model == LINK_MODEL_NETEM) {
+        add_htb_class(sock, ifb_index, TC_HANDLE(shard_major(meteor_conf, 0), 0),
+                TC_HANDLE(shard_major(meteor_conf, 0), NETEM_MODEL_MINOR), 1, DEF_BW);
+    }
 
     return 0;
 }
 
+// install the class, filter and netem of a peer in every shard: the
+// ifb spreads flows over its queues by hash, so any shard may carry
+// the traffic of any peer
 int
-add_rule(struct meteor_config *meteor_conf, uint16_t parent, uint16_t handle, 
+add_rule(struct meteor_config *meteor_conf, struct local_node *ln,
+        uint16_t parent, uint16_t handle, 
         struct node_data *src, struct node_data *dst)
 {
+    uint32_t shard_i;
+    uint16_t major;
     struct nl_sock *sock = meteor_conf->nlsock;
-    int idx = meteor_conf->ifb_index;
+    int idx = ln->ifb_index;
 
-    add_htb_class(sock, idx, TC_HANDLE(1, 0), TC_HANDLE(1, parent), 1, DEF_BW);
+    for (shard_i = 0; shard_i < meteor_conf->shards; shard_i++) {
+        major = shard_major(meteor_conf, shard_i);
+        add_htb_class(sock, idx, TC_HANDLE(major, 0), TC_HANDLE(major, parent), 1, DEF_BW);
 
-    if (meteor_conf->filter_mode == ETH_P_ALL) {
-        if (!dst) {
-            add_class_macfilter(sock, idx,
-                    TC_HANDLE(1, 0), TC_HANDLE(1, parent), 
-                    src->mac, NULL);
+        if (meteor_conf->filter_mode == ETH_P_ALL) {
+            if (!dst) {
+                add_class_macfilter(sock, idx,
+                        TC_HANDLE(major, 0), TC_HANDLE(major, parent), 
+                        src->mac, NULL);
+            }
+            else {
+                add_class_macfilter(sock, idx, TC_HANDLE(major, 0), TC_HANDLE(major, parent), 
+                        src->mac, dst->mac);
+            }
         }
-        else {
-            add_class_macfilter(sock, idx, TC_HANDLE(1, 0), TC_HANDLE(1, parent), 
-                    src->mac, dst->mac);
+        else if (meteor_conf->filter_mode == ETH_P_IP) {
+            if (!dst) {
+                add_class_ipv4filter(sock, idx,
+                        TC_HANDLE(major, 0), TC_HANDLE(major, parent), 
+                        src->ipv4addr.s_addr, src->ipv4prefix, 0, 0);
+            }
+            else {
+                add_class_ipv4filter(sock, idx,
+                        TC_HANDLE(major, 0), TC_HANDLE(major, parent), 
+                        src->ipv4addr.s_addr, src->ipv4prefix,
+                        dst->ipv4addr.s_addr, dst->ipv4prefix);
+            }
         }
-    }
-    else if (meteor_conf->filter_mode == ETH_P_IP) {
-        if (!dst) {
-            add_class_ipv4filter(sock, idx,
-                    TC_HANDLE(1, 0), TC_HANDLE(1, parent), 
-                    src->ipv4addr.s_addr, src->ipv4prefix, 0, 0);
+
+        int delay = 0 ;
+        int jitter = 0;
+        uint32_t loss = 100; // %
+        if (meteor_conf->link_model == LINK_MODEL_NETEM) {
+            add_netem_rate_qdisc(sock, idx, TC_HANDLE(major, parent),
+                    TC_HANDLE(netem_major(meteor_conf, parent, shard_i), 0),
+                    delay, jitter, loss, QLEN, DEF_BW);
         }
         else {
-            add_class_ipv4filter(sock, idx,
-                    TC_HANDLE(1, 0), TC_HANDLE(1, parent), 
-                    src->ipv4addr.s_addr, src->ipv4prefix,
-                    dst->ipv4addr.s_addr, dst->ipv4prefix);
+            add_netem_qdisc(sock, idx, TC_HANDLE(major, parent),
+                    TC_HANDLE(netem_major(meteor_conf, parent, shard_i), 0),
+                    delay, jitter, loss, 1000);
         }
     }
 
-    int delay = 0 ;
-    int jitter = 0;
-    uint32_t loss = 100; // %
-    add_netem_qdisc(sock, idx, TC_HANDLE(1, parent), TC_HANDLE(parent, 0),
-            delay, jitter, loss, 1000);
-
     return 0;
 }
 
 int32_t
-configure_rule(struct nl_sock *sock, int ifb_index,
-        uint16_t parent, uint16_t handle, 
+configure_rule(struct meteor_config *meteor_conf, struct local_node *ln,
+        int32_t id, uint16_t parent, uint16_t handle, 
         int32_t bandwidth, double delay, double loss)
 {
-    change_htb_class(sock, ifb_index,
-            TC_HANDLE(1, 0), TC_HANDLE(1, parent), 1, bandwidth);
-    change_netem_qdisc(sock, ifb_index,
-            TC_HANDLE(1, parent), TC_HANDLE(parent, 0), delay, 0, loss, 1000);
+    uint32_t shard_i;
+    uint16_t major;
+    struct nl_sock *sock = meteor_conf->nlsock;
+    int ifb_index = ln->ifb_index;
+
+    for (shard_i = 0; shard_i < meteor_conf->shards; shard_i++) {
+        major = shard_major(meteor_conf, shard_i);
+
+        // the HTB class stays at DEF_BW and only dispatches to the netem
+        // leaf, so a single message updates all parameters of the link
+        if (meteor_conf->link_model == LINK_MODEL_NETEM) {
+            change_netem_rate_qdisc(sock, ifb_index, TC_HANDLE(major, parent),
+                    TC_HANDLE(netem_major(meteor_conf, parent, shard_i), 0), delay, 0, loss,
+                    QLEN, bandwidth > 0 ? bandwidth : 0);
+            continue;
+        }
+
+        change_htb_class(sock, ifb_index,
+                TC_HANDLE(major, 0), TC_HANDLE(major, parent), 1, bandwidth);
+        change_netem_qdisc(sock, ifb_index, TC_HANDLE(major, parent),
+                TC_HANDLE(netem_major(meteor_conf, parent, shard_i), 0), delay, 0, loss, 1000);
+    }
  
     return 0;
 }
 
-void
-finalize_rule(struct meteor_config *meteor_conf)
+// TRUE if 'major' is the major number of a peer HTB tree
+int
+is_tree_major(struct meteor_config *meteor_conf, uint16_t major)
 {
-    delete_qdisc(meteor_conf->nlsock, meteor_conf->ifb_index, TC_H_ROOT, 0);
-    delete_qdisc(meteor_conf->nlsock, meteor_conf->pif_index, TC_H_INGRESS, 0);
-    delete_ifb(meteor_conf->nlsock, meteor_conf->ifb_index);
+    if (meteor_conf->shards <= 1) {
+        return major == 1;
+    }
 
-    nl_close(meteor_conf->nlsock);
+    return major >= SHARD_HTB_MAJOR && major < SHARD_HTB_MAJOR + meteor_conf->shards;
 }
 
-int
-meteor_loop(struct meteor_config *meteor_conf)
+// find the u32 filter that classifies into 'classid'
+struct rtnl_cls *
+find_class_filter(struct nl_cache *cls_cache, uint32_t classid)
 {
-    int node_i, ret;
-    int32_t bin_recs_max_cnt;
-    uint32_t bin_hdr_if_num;
-    float crt_record_time = 0.0;
-    double bandwidth, delay, lossrate;
-    struct bin_time_rec_cls bin_time_rec;
-    struct bin_rec_cls *bin_recs_all = NULL;
-    struct bin_rec_cls **recs_ucast = NULL;
-    struct bin_rec_cls *adjusted_recs_ucast = NULL;
-    struct timer_handle *timer;
-    int *recs_ucast_changed = NULL;
-    struct connection_list *conn_list = NULL;
- 
-    struct node_data *node;
-    struct node_data *my_node;
-    struct bin_hdr_cls *bin_hdr = meteor_conf->bin_hdr;
+    uint32_t id;
+    struct nl_object *obj;
 
-    for (node = meteor_conf->node_list_head; node->id < meteor_conf->node_cnt; node++) {
-        if (node->id == meteor_conf->id) {
-            my_node = node;
+    for (obj = nl_cache_get_first(cls_cache); obj; obj = nl_cache_get_next(obj)) {
+        if (rtnl_u32_get_classid((struct rtnl_cls *)obj, &id) == 0 && id == classid) {
+            return (struct rtnl_cls *)obj;
         }
     }
 
-    if (!(timer = timer_init_rdtsc())) {
-        fprintf(meteor_conf->logfd, "[%s] Could not initialize timer", __func__);
-        exit(1);
+    return NULL;
+}
+
+// TRUE if the u32 filter matches the IPv4 source address of 'node'
+int
+filter_matches_src(struct rtnl_cls *cls, struct node_data *node)
+{
+    int key_i, off, offmask;
+    int shift = 32 - node->ipv4prefix;
+    uint32_t val, mask;
+    uint32_t prefix_mask = htonl(0xffffffff >> shift << shift);
+
+    for (key_i = 0; rtnl_u32_get_key(cls, key_i, &val, &mask, &off, &offmask) == 0; key_i++) {
+        if (off == 12) {
+            return mask == prefix_mask &&
+                (val & mask) == (node->ipv4addr.s_addr & prefix_mask);
+        }
     }
 
-    bin_recs_max_cnt = bin_hdr->if_num * (bin_hdr->if_num - 1);
-    bin_recs_all = (struct bin_rec_cls *)calloc(bin_recs_max_cnt, sizeof (struct bin_rec_cls));
-    if (!bin_recs_all) {
-        WARNING("[%s] Cannot allocate memory for binary records", __func__);
-        exit(1);
+    return FALSE;
+}
+
+int
+delete_rule(struct meteor_config *meteor_conf, struct local_node *ln,
+        struct nl_cache *cls_cache, uint16_t major, uint16_t parent)
+{
+    struct rtnl_cls *cls;
+    struct nl_sock *sock = meteor_conf->nlsock;
+
+    // the netem is found by its parent, whatever its handle
+    delete_qdisc(sock, ln->ifb_index, TC_HANDLE(major, parent), 0);
+    if ((cls = find_class_filter(cls_cache, TC_HANDLE(major, parent)))) {
+        rtnl_cls_delete(sock, cls, 0);
     }
+    delete_class(sock, ln->ifb_index, TC_HANDLE(major, 0), TC_HANDLE(major, parent));
 
-    recs_ucast = (struct bin_rec_cls**)calloc(bin_hdr->if_num, sizeof (struct bin_rec_cls*));
-    if (!recs_ucast) {
-        fprintf(meteor_conf->logfd, "[%s] Cannot allocate memory for recs_ucast\n", __func__);
-        exit(1);
+    return 0;
+}
+
+// TRUE if the ingress redirect and the HTB tree(s) of a local node
+// are all in place
+int
+check_base_rule(struct meteor_config *meteor_conf, struct local_node *ln,
+        struct nl_cache *qdisc_cache)
+{
+    int ok;
+    uint32_t shard_i;
+    uint16_t major, def_major;
+    struct rtnl_qdisc *qdisc;
+    struct rtnl_class *class;
+    struct rtnl_cls *cls;
+    struct nl_cache *class_cache, *cls_cache;
+
+    if (!(qdisc = rtnl_qdisc_get(qdisc_cache, ln->pif_index, TC_HANDLE(0xffff, 0)))) {
+        return FALSE;
     }
+    rtnl_qdisc_put(qdisc);
 
-    for (node_i = 0; node_i < bin_hdr->if_num; node_i++) {
-        if (!recs_ucast[node_i]) {
-            recs_ucast[node_i] = (struct bin_rec_cls *)calloc(bin_hdr->if_num, sizeof (struct bin_rec_cls));
+    if (rtnl_cls_alloc_cache(meteor_conf->nlsock, ln->pif_index,
+                TC_HANDLE(0xffff, 0), &cls_cache) < 0) {
+        return FALSE;
+    }
+    cls = rtnl_cls_find_by_prio(cls_cache, ln->pif_index, TC_HANDLE(0xffff, 0), MIRRED_PRIO);
+    nl_cache_put(cls_cache);
+    if (!cls) {
+        return FALSE;
+    }
+    rtnl_cls_put(cls);
+
+    if (!(qdisc = rtnl_qdisc_get_by_parent(qdisc_cache, ln->ifb_index, TC_H_ROOT))) {
+        return FALSE;
+    }
+    ok = strcmp(rtnl_tc_get_kind(TC_CAST(qdisc)), meteor_conf->shards > 1 ? "mq" : "htb") == 0 &&
+        rtnl_tc_get_handle(TC_CAST(qdisc)) == TC_HANDLE(1, 0);
+    rtnl_qdisc_put(qdisc);
+    if (!ok) {
+        return FALSE;
+    }
+
+    if (rtnl_class_alloc_cache(meteor_conf->nlsock, ln->ifb_index, &class_cache) < 0) {
+        return FALSE;
+    }
+    for (shard_i = 0; ok && shard_i < meteor_conf->shards; shard_i++) {
+        major = shard_major(meteor_conf, shard_i);
+        def_major = meteor_conf->shards > 1 ? SHARD_DEF_MAJOR + shard_i : 65535;
+
+        if ((qdisc = rtnl_qdisc_get(qdisc_cache, ln->ifb_index, TC_HANDLE(major, 0)))) {
+            rtnl_qdisc_put(qdisc);
         }
-        if (!recs_ucast[node_i]) {
-            fprintf(meteor_conf->logfd, "[%s] Cannot allocate memory for recs_ucast[%d]\n",
-                            __func__, node_i);
-            exit(1);
+        else {
+            ok = FALSE;
         }
-
-        int node_j;
-        for (node_j = 0; node_j < bin_hdr->if_num; node_j++) {
-            recs_ucast[node_i][node_j].bandwidth = UNDEFINED_BANDWIDTH;
+        if ((class = rtnl_class_get(class_cache, ln->ifb_index, TC_HANDLE(major, 65535)))) {
+            rtnl_class_put(class);
+        }
+        else {
+            ok = FALSE;
+        }
+        if ((qdisc = rtnl_qdisc_get(qdisc_cache, ln->ifb_index, TC_HANDLE(def_major, 0)))) {
+            rtnl_qdisc_put(qdisc);
+        }
+        else {
+            ok = FALSE;
         }
     }
 
-    if (meteor_conf->direction == BRIDGE) {
-        bin_hdr_if_num = bin_hdr->if_num * bin_hdr->if_num;
+    // a tree of the other link model is rebuilt: the HTB model shapes
+    // in the classes, which the netem-rate model leaves at DEF_BW, and
+    // a netem change without a rate keeps the previous one
+    class = rtnl_class_get(class_cache, ln->ifb_index,
+            TC_HANDLE(shard_major(meteor_conf, 0), NETEM_MODEL_MINOR));
+    if (class) {
+        rtnl_class_put(class);
+    }
+    if ((class != NULL) != (meteor_conf->link_model == LINK_MODEL_NETEM)) {
+        ok = FALSE;
+    }
+    nl_cache_put(class_cache);
+
+    return ok;
+}
+
+// TRUE if the class, filter and netem of peer 'node' are in place in
+// shard 'shard_i'
+int
+check_peer_rule(struct meteor_config *meteor_conf, struct local_node *ln,
+        struct nl_cache *class_cache, struct nl_cache *cls_cache,
+        struct nl_cache *qdisc_cache, struct node_data *node, uint32_t shard_i)
+{
+    int ok = FALSE;
+    uint16_t parent = node->id + 10;
+    uint16_t major = shard_major(meteor_conf, shard_i);
+    struct rtnl_class *class;
+    struct rtnl_qdisc *qdisc;
+    struct rtnl_cls *cls;
+
+    if ((class = rtnl_class_get(class_cache, ln->ifb_index, TC_HANDLE(major, parent)))) {
+        ok = rtnl_tc_get_parent(TC_CAST(class)) == TC_HANDLE(major, 0);
+        rtnl_class_put(class);
+    }
+
+    cls = find_class_filter(cls_cache, TC_HANDLE(major, parent));
+    ok = ok && cls && (meteor_conf->filter_mode != ETH_P_IP || filter_matches_src(cls, node));
+
+    if (ok && (qdisc = rtnl_qdisc_get(qdisc_cache, ln->ifb_index,
+                    TC_HANDLE(netem_major(meteor_conf, parent, shard_i), 0)))) {
+        ok = rtnl_tc_get_parent(TC_CAST(qdisc)) == TC_HANDLE(major, parent) &&
+            strcmp(rtnl_tc_get_kind(TC_CAST(qdisc)), "netem") == 0;
+        rtnl_qdisc_put(qdisc);
     }
     else {
-        bin_hdr_if_num = bin_hdr->if_num;
+        ok = FALSE;
     }
 
-    if (!adjusted_recs_ucast) {
-        adjusted_recs_ucast = (struct bin_rec_cls *)calloc(bin_hdr_if_num, sizeof (struct bin_rec_cls));
-        if (adjusted_recs_ucast == NULL) {
-            fprintf(meteor_conf->logfd, "[%s] Cannot allocate memory for adjusted_recs_ucast", __func__);
-            exit(1);
+    return ok;
+}
+
+// diff the per-peer classes, filters and netem qdiscs of a local node
+// against the settings; only missing or changed peers are reinstalled
+// and peers that are no longer in the scenario are removed
+int
+reconcile_peer_rules(struct meteor_config *meteor_conf, struct local_node *ln,
+        struct nl_cache *qdisc_cache)
+{
+    int ok, node_i;
+    int ret = SUCCESS;
+    int kept = 0, added = 0, removed = 0;
+    uint32_t shard_i;
+    uint16_t major, parent;
+    uint8_t *wanted;
+    struct node_data *node;
+    struct nl_object *obj;
+    struct nl_cache *class_cache = NULL;
+    struct nl_cache **cls_caches;
+    struct nl_sock *sock = meteor_conf->nlsock;
+
+    wanted = calloc(65536, sizeof (uint8_t));
+    cls_caches = calloc(meteor_conf->shards, sizeof (struct nl_cache *));
+    if (!wanted || !cls_caches) {
+        perror("calloc");
+        exit(1);
+    }
+
+    if (rtnl_class_alloc_cache(sock, ln->ifb_index, &class_cache) < 0) {
+        class_cache = NULL;
+        ret = ERROR;
+        goto out;
+    }
+    for (shard_i = 0; shard_i < meteor_conf->shards; shard_i++) {
+        major = shard_major(meteor_conf, shard_i);
+        if (rtnl_cls_alloc_cache(sock, ln->ifb_index, TC_HANDLE(major, 0), &cls_caches[shard_i]) < 0) {
+            cls_caches[shard_i] = NULL;
+            ret = ERROR;
+            goto out;
         }
     }
 
-    if (!recs_ucast_changed) {
-        recs_ucast_changed = (int32_t *)calloc(bin_hdr_if_num, sizeof (int32_t));
-        if (recs_ucast_changed == NULL) {
-            fprintf(meteor_conf->logfd, "Cannot allocate memory for recs_ucast_changed\n");
+    node = meteor_conf->node_list_head;
+    for (node_i = 0; node_i < meteor_conf->node_cnt; node_i++, node++) {
+        if (node->id == ln->id) {
+            continue;
+        }
+        parent = node->id + 10;
+        wanted[parent] = TRUE;
+
+        ok = TRUE;
+        for (shard_i = 0; ok && shard_i < meteor_conf->shards; shard_i++) {
+            ok = check_peer_rule(meteor_conf, ln, class_cache, cls_caches[shard_i],
+                    qdisc_cache, node, shard_i);
+        }
+        if (ok) {
+            kept++;
+            continue;
+        }
+
+        for (shard_i = 0; shard_i < meteor_conf->shards; shard_i++) {
+            delete_rule(meteor_conf, ln, cls_caches[shard_i],
+                    shard_major(meteor_conf, shard_i), parent);
+        }
+        if (add_rule(meteor_conf, ln, parent, parent, node, NULL) < 0) {
+            fprintf(meteor_conf->logfd, "Could not add rule %d from source %s\n", 
+                    node->id, inet_ntoa(node->ipv4addr));
             exit(1);
         }
+        added++;
     }
 
-emulation_start:
-    for (int time_i = 0; time_i < bin_hdr->time_rec_num; time_i++) {
-        int rec_i;
+    for (obj = nl_cache_get_first(class_cache); obj; obj = nl_cache_get_next(obj)) {
+        uint32_t handle = rtnl_tc_get_handle(TC_CAST(obj));
 
-        if (meteor_conf->verbose >= 2) {
-            printf("Reading QOMET data from file... Time : %d/%d\n",
-                    time_i, bin_hdr->time_rec_num);
+        major = TC_H_MAJ(handle) >> 16;
+        parent = TC_H_MIN(handle);
+        if (!is_tree_major(meteor_conf, major) || parent == 1 || parent == NETEM_MODEL_MINOR ||
+                parent == 65535 || wanted[parent]) {
+            continue;
         }
+        shard_i = meteor_conf->shards > 1 ? major - SHARD_HTB_MAJOR : 0;
+        delete_rule(meteor_conf, ln, cls_caches[shard_i], major, parent);
+        removed++;
+    }
 
-        if (io_binary_read_time_record_from_file(&bin_time_rec, meteor_conf->deltaq_fd) == ERROR) {
-            fprintf(meteor_conf->logfd, "Aborting on input error (time record)\n");
-            exit (1);
-        }
-        io_binary_print_time_record(&bin_time_rec);
-        crt_record_time = bin_time_rec.time;
+    if (meteor_conf->verbose >= 1) {
+        fprintf(meteor_conf->logfd, "Reconciled ifb%d: %d rules kept, %d added, %d removed\n",
+                ln->id, kept, added, removed);
+    }
 
-        if (bin_time_rec.record_number > bin_recs_max_cnt) {
-            fprintf(meteor_conf->logfd, "The number of records to be read exceeds allocated size (%d)\n", bin_recs_max_cnt);
-            exit (1);
+out:
+    for (shard_i = 0; shard_i < meteor_conf->shards; shard_i++) {
+        if (cls_caches[shard_i]) {
+            nl_cache_put(cls_caches[shard_i]);
         }
+    }
+    if (class_cache) {
+        nl_cache_put(class_cache);
+    }
+    free(cls_caches);
+    free(wanted);
+
+    return ret;
+}
+
+// bring the tc state of a local node to the desired tree, rebuilding
+// it only when its base structure is missing or of another layout
+int
+reconcile_rule(struct meteor_config *meteor_conf, struct local_node *ln)
+{
+    int ret;
+    struct nl_cache *qdisc_cache;
+
+    if (rtnl_qdisc_alloc_cache(meteor_conf->nlsock, &qdisc_cache) < 0) {
+        return ERROR;
+    }
 
-        if (io_binary_read_records_from_file(bin_recs_all, bin_time_rec.record_number, meteor_conf->deltaq_fd) == ERROR) {
-            fprintf(meteor_conf->logfd, "Aborting on input error (records)\n");
-            exit (1);
+    if (check_base_rule(meteor_conf, ln, qdisc_cache) != TRUE) {
+        if (meteor_conf->verbose >= 1) {
+            fprintf(meteor_conf->logfd, "Rebuilding tc tree of ifb%d\n", ln->id);
         }
+        init_rule(meteor_conf, ln);
+        nl_cache_refill(meteor_conf->nlsock, qdisc_cache);
+    }
+    ret = reconcile_peer_rules(meteor_conf, ln, qdisc_cache);
+    nl_cache_put(qdisc_cache);
 
-        for (rec_i = 0; rec_i < bin_time_rec.record_number; rec_i++) {
-            if (bin_recs_all[rec_i].from_id < FIRST_NODE_ID) {
-                INFO("Source with id = %d is smaller first node id : %d", bin_recs_all[rec_i].from_id, assign_id);
-                exit(1);
-            }
-            if (bin_recs_all[rec_i].from_id > bin_hdr->if_num) {
-                INFO("Source with id = %d is out of the valid range [%d, %d] rec_i : %d\n", 
-                    bin_recs_all[rec_i].from_id, assign_id, bin_hdr->if_num + assign_id - 1, rec_i);
-                exit(1);
-            }
+    return ret;
+}
 
-            int32_t src_id;
-            int32_t dst_id;
-            if (meteor_conf->direction == INGRESS) {
-                if (bin_recs_all[rec_i].to_id == meteor_conf->id || bin_recs_all[rec_i].from_id == meteor_conf->id) {
-                    src_id = bin_recs_all[rec_i].to_id;
-                    dst_id = bin_recs_all[rec_i].from_id;
+void
+finalize_rule(struct meteor_config *meteor_conf)
+{
+    int local_i;
+    struct local_node *ln;
+
+    // keep the tree for the next run to reconcile against
+    for (local_i = 0; !meteor_conf->reconcile && local_i < meteor_conf->local_cnt; local_i++) {
+        ln = &meteor_conf->local[local_i];
+        delete_qdisc(meteor_conf->nlsock, ln->ifb_index, TC_H_ROOT, 0);
+        delete_qdisc(meteor_conf->nlsock, ln->pif_index, TC_H_INGRESS, 0);
+        delete_ifb(meteor_conf->nlsock, ln->ifb_index);
+    }
 
-                    io_bin_cp_rec(&(recs_ucast[src_id][dst_id]), &bin_recs_all[rec_i]);
-                    io_bin_cp_rec(&(recs_ucast[dst_id][src_id]), &bin_recs_all[rec_i]);
-                    recs_ucast_changed[bin_recs_all[rec_i].to_id] = TRUE;
+    nl_close(meteor_conf->nlsock);
+}
 
-                    if(meteor_conf->verbose >= 3) {
-                        io_binary_print_record(&(recs_ucast[src_id][dst_id]));
-                    }
-                }
-            }
-            else if (meteor_conf->direction == BRIDGE) {
-            }
+int
+is_local_node(struct meteor_config *meteor_conf, int32_t id)
+{
+    if (id < 0 || id >= meteor_conf->node_cnt) {
+        return FALSE;
+    }
+
+    return meteor_conf->local_map[id];
+}
+
+// scenario replay driven by the event loop: the next time record is
+// read ahead, and applied when the timerfd of 'timer' expires
+struct meteor_replay {
+    struct meteor_config *meteor_conf;
+    struct timer_handle timer;
+    ev_io timer_watch;
+
+    // time record read ahead
+    int time_i;
+    float crt_record_time;
+
+    int32_t bin_recs_max_cnt;
+    uint32_t bin_hdr_if_num;
+    struct bin_rec_cls *bin_recs_all;
+    struct bin_rec_cls **recs_ucast;
+    struct bin_rec_cls *adjusted_recs_ucast;
+    int *recs_ucast_changed;
+
+    // records of the time record applied last, kept to re-apply them
+    // when the time scale changes
+    struct bin_rec_cls *applied_recs_ucast;
+    float applied_record_time;
+    int applied;
+
+    // real time of the armed deadline, and the wake-up lateness of the
+    // records applied since the scenario (re)started, in s
+    double deadline;
+    double *lateness;
+    int lateness_cnt;
+    int missed_cnt;
+};
+
+// read time record 'time_i' and its records into the replay state
+void
+replay_read(struct meteor_replay *rp)
+{
+    int local_i, rec_i;
+    struct meteor_config *meteor_conf = rp->meteor_conf;
+    struct bin_hdr_cls *bin_hdr = meteor_conf->bin_hdr;
+    struct bin_time_rec_cls bin_time_rec;
+    struct bin_rec_cls *bin_recs_all = rp->bin_recs_all;
+    struct bin_rec_cls **recs_ucast = rp->recs_ucast;
+    struct bin_rec_cls *adjusted_recs_ucast = rp->adjusted_recs_ucast;
+    struct connection_list *conn_list = NULL;
+    struct node_data *node;
+    struct local_node *ln;
+    struct bin_rec_cls *adjusted;
+
+    if (meteor_conf->verbose >= 2) {
+        printf("Reading QOMET data from file... Time : %d/%d\n",
+                rp->time_i, bin_hdr->time_rec_num);
+    }
+
+    if (io_binary_read_time_record_from_file(&bin_time_rec, meteor_conf->deltaq_fd) == ERROR) {
+        fprintf(meteor_conf->logfd, "Aborting on input error (time record)\n");
+        exit (1);
+    }
+    io_binary_print_time_record(&bin_time_rec);
+    rp->crt_record_time = bin_time_rec.time;
+
+    if (bin_time_rec.record_number > rp->bin_recs_max_cnt) {
+        fprintf(meteor_conf->logfd, "The number of records to be read exceeds allocated size (%d)\n", rp->bin_recs_max_cnt);
+        exit (1);
+    }
+
+    if (io_binary_read_records_from_file(bin_recs_all, bin_time_rec.record_number, meteor_conf->deltaq_fd) == ERROR) {
+        fprintf(meteor_conf->logfd, "Aborting on input error (records)\n");
+        exit (1);
+    }
+
+    for (rec_i = 0; rec_i < bin_time_rec.record_number; rec_i++) {
+        if (bin_recs_all[rec_i].from_id < FIRST_NODE_ID) {
+            INFO("Source with id = %d is smaller first node id : %d", bin_recs_all[rec_i].from_id, assign_id);
+            exit(1);
+        }
+        if (bin_recs_all[rec_i].from_id > bin_hdr->if_num) {
+            INFO("Source with id = %d is out of the valid range [%d, %d] rec_i : %d\n", 
+                bin_recs_all[rec_i].from_id, assign_id, bin_hdr->if_num + assign_id - 1, rec_i);
+            exit(1);
         }
 
-        if (time_i == 0 && re_flag == -1) {
-            if (meteor_conf->direction == BRIDGE) {
-                uint32_t rec_index;
-                int32_t src_id, dst_id;
-                conn_list = meteor_conf->conn_list_head;
-                while (conn_list) {
-                    src_id = conn_list->src_id;
-                    dst_id = conn_list->dst_id;
-                    rec_index = conn_list->rec_i;
-                    io_bin_cp_rec(&(adjusted_recs_ucast[rec_index]), &(recs_ucast[src_id][dst_id]));
-                    DEBUG("Copied recs_ucast to adjusted_recs_ucast (index is rec_i=%d).", rec_index);
+        int32_t src_id;
+        int32_t dst_id;
+        if (meteor_conf->direction == INGRESS) {
+            if (is_local_node(meteor_conf, bin_recs_all[rec_i].to_id) ||
+                    is_local_node(meteor_conf, bin_recs_all[rec_i].from_id)) {
+                src_id = bin_recs_all[rec_i].to_id;
+                dst_id = bin_recs_all[rec_i].from_id;
 
-                    conn_list = conn_list->next_ptr;
+                io_bin_cp_rec(&(recs_ucast[src_id][dst_id]), &bin_recs_all[rec_i]);
+                io_bin_cp_rec(&(recs_ucast[dst_id][src_id]), &bin_recs_all[rec_i]);
+                rp->recs_ucast_changed[bin_recs_all[rec_i].to_id] = TRUE;
+
+                if(meteor_conf->verbose >= 3) {
+                    io_binary_print_record(&(recs_ucast[src_id][dst_id]));
                 }
             }
-            else {
-                int i;
+        }
+        else if (meteor_conf->direction == BRIDGE) {
+        }
+    }
+
+    if (rp->time_i == 0 && re_flag == -1) {
+        if (meteor_conf->direction == BRIDGE) {
+            uint32_t rec_index;
+            int32_t src_id, dst_id;
+            conn_list = meteor_conf->conn_list_head;
+            while (conn_list) {
+                src_id = conn_list->src_id;
+                dst_id = conn_list->dst_id;
+                rec_index = conn_list->rec_i;
+                io_bin_cp_rec(&(adjusted_recs_ucast[rec_index]), &(recs_ucast[src_id][dst_id]));
+                DEBUG("Copied recs_ucast to adjusted_recs_ucast (index is rec_i=%d).", rec_index);
+
+                conn_list = conn_list->next_ptr;
+            }
+        }
+        else {
+            int i;
+            for (local_i = 0; local_i < meteor_conf->local_cnt; local_i++) {
+                ln = &meteor_conf->local[local_i];
+                adjusted = adjusted_recs_ucast + local_i * rp->bin_hdr_if_num;
                 node = meteor_conf->node_list_head;
                 for (i = 1; i < meteor_conf->node_cnt; i++) {
-                     if (node->id != meteor_conf->id) {
+                     if (node->id != ln->id) {
                         printf("node->id => %d\n", node->id);
-                        io_bin_cp_rec(&(adjusted_recs_ucast[node->id]), &(recs_ucast[meteor_conf->id][node->id]));
+                        io_bin_cp_rec(&(adjusted[node->id]), &(recs_ucast[ln->id][node->id]));
                         DEBUG("Copied recs_ucast to adjusted_recs_ucast (index is rec_i=%d).", node->id);
                     }
                     node++;
                 }
             }
         }
+    }
+    else {
+        INFO("Adjustment of deltaQ is disabled.");
+        if (meteor_conf->direction == BRIDGE) {
+            //uint32_t rec_index;
+        }
         else {
-            INFO("Adjustment of deltaQ is disabled.");
-            if (meteor_conf->direction == BRIDGE) {
-                //uint32_t rec_index;
-            }
-            else {
-                int i;
+            int i;
+            for (local_i = 0; local_i < meteor_conf->local_cnt; local_i++) {
+                ln = &meteor_conf->local[local_i];
+                adjusted = adjusted_recs_ucast + local_i * rp->bin_hdr_if_num;
                 node = meteor_conf->node_list_head;
                 for (i = 0 ; i < meteor_conf->node_cnt; i++) {
-                    if (node->id != meteor_conf->id) {
-                        io_bin_cp_rec(&(adjusted_recs_ucast[node->id]), &(recs_ucast[meteor_conf->id][node->id]));
+                    if (node->id != ln->id) {
+                        io_bin_cp_rec(&(adjusted[node->id]), &(recs_ucast[ln->id][node->id]));
                         DEBUG("Copied recs_ucast to adjusted_recs_ucast (index is rec_i=%d).", node->id);
                     }
                     node++;
                 }
             }
         }
+    }
+}
 
-        if (time_i == 0) {
-            timer_reset(timer, crt_record_time);
-        }
-        else {
-            if (SCALING_FACTOR == 10.0) {
-                INFO("Waiting to reach time %.6fs...", crt_record_time);
-            }
-            else {
-                INFO("Waiting to reach real time %.6fs (scenario time %.6f)\n",
-                        crt_record_time * SCALING_FACTOR, crt_record_time);
-
-                if ((ret = timer_wait_rdtsc(timer, crt_record_time * 1000000)) < 0) {
-                    fprintf(meteor_conf->logfd, 
-                            "Timer deadline missed at time=%.6f s ",
-                            crt_record_time);
-                    fprintf(meteor_conf->logfd, "This rule is skip.\n");
-                    continue;
-                }
-                if (ret == 2) {
-                    fseek(meteor_conf->deltaq_fd, 0L, SEEK_SET);
-                    if ((timer = timer_init_rdtsc()) == NULL) {
-                        fprintf(meteor_conf->logfd, "Could not initialize timer\n");
-                        exit(1);
-                    }
-                    io_binary_read_header_from_file(bin_hdr, meteor_conf->deltaq_fd);
-                    if (meteor_conf->verbose >= 1) {
-                        io_binary_print_header(bin_hdr);
-                    }
-                    re_flag = FALSE;
-                    goto emulation_start;
+// configure the rules of all local nodes from 'recs', the records of
+// the time record at 'record_time'
+void
+replay_configure(struct meteor_replay *rp, struct bin_rec_cls *recs, float record_time)
+{
+    int ret, local_i;
+    double bandwidth, delay, lossrate;
+    struct meteor_config *meteor_conf = rp->meteor_conf;
+    struct bin_hdr_cls *bin_hdr = meteor_conf->bin_hdr;
+    struct node_data *node;
+    struct local_node *ln;
+    struct bin_rec_cls *adjusted;
+
+    if (meteor_conf->direction == BRIDGE) {
+    }
+    else {
+        int i;
+        for (local_i = 0; local_i < meteor_conf->local_cnt; local_i++) {
+            ln = &meteor_conf->local[local_i];
+            adjusted = recs + local_i * rp->bin_hdr_if_num;
+            node = meteor_conf->node_list_head;
+            for (i = 0; i < meteor_conf->node_cnt; i++) {
+                if (node->id == ln->id) {
+                    node++;
+                    continue;
                 }
-/*
-                if (timer_wait(timer, crt_record_time * SCALING_FACTOR) != 0) {
-                    fprintf(meteor_conf->logfd, "Timer deadline missed at time=%.2f s\n", crt_record_time);
+
+                if (node->id < 0 || (node->id > bin_hdr->if_num - 1)) {
+                    WARNING("Next hop with id = %d is out of the valid range [%d, %d]",
+                            rp->bin_recs_all[node->id].to_id, 0, bin_hdr->if_num - 1);
+                    exit(1);
                 }
-*/
-            }
 
-            if (meteor_conf->direction == BRIDGE) {
+                bandwidth = adjusted[node->id].bandwidth;
+                // delays shrink or stretch with the scenario clock
+                delay = adjusted[node->id].delay * 1000 / meteor_conf->time_scale;
+                lossrate = adjusted[node->id].loss_rate * 100;
+
+                if (bandwidth != UNDEFINED_BANDWIDTH) {
+                    INFO("-- Meteor id = %d #%d to me (time=%.2f s): bandwidth=%.2fbit/s lossrate=%.4f delay=%.4f ms",
+                        ln->id, node->id, record_time, bandwidth, lossrate, delay);
+                }
+                else {
+                    INFO("-- Meteor id = %d #%d to me (time=%.2f s): no valid record could be found => configure with no degradation", 
+                        ln->id, node->id, record_time);
+                }
+                ret = configure_rule(meteor_conf, ln, node->id, node->id + 10, node->id + 10, bandwidth, delay, lossrate);
+                if (ret != SUCCESS) {
+                    WARNING("Error configuring Meteor rule %d.", node->id);
+                    exit (1);
+                }
+                node++;
             }
-            else {
-                int i;
-                node = meteor_conf->node_list_head;
-                for (i = 0; i < meteor_conf->node_cnt; i++) {
-                    if (node->id == meteor_conf->id) {
-                        node++;
-                        continue;
-                    }
+        }
+    }
+}
 
-                    if (node->id < 0 || (node->id > bin_hdr->if_num - 1)) {
-                        WARNING("Next hop with id = %d is out of the valid range [%d, %d]",
-                                bin_recs_all[node->id].to_id, 0, bin_hdr->if_num - 1);
-                        exit(1);
-                    }
+// configure the rules of all local nodes for the record read ahead
+void
+replay_apply(struct meteor_replay *rp)
+{
+    struct bin_rec_cls *recs = rp->adjusted_recs_ucast;
 
-                    bandwidth = adjusted_recs_ucast[node->id].bandwidth;
-                    delay = adjusted_recs_ucast[node->id].delay * 1000;
-                    lossrate = adjusted_recs_ucast[node->id].loss_rate * 100;
+    replay_configure(rp, recs, rp->crt_record_time);
 
-                    if (bandwidth != UNDEFINED_BANDWIDTH) {
-                        INFO("-- Meteor id = %d #%d to me (time=%.2f s): bandwidth=%.2fbit/s lossrate=%.4f delay=%.4f ms",
-                            meteor_conf->id, node->id, crt_record_time, bandwidth, lossrate, delay);
-                    }
-                    else {
-                        INFO("-- Meteor id = %d #%d to me (time=%.2f s): no valid record could be found => configure with no degradation", 
-                            meteor_conf->id, node->id, crt_record_time);
-                    }
-                    ret = configure_rule(meteor_conf->nlsock, meteor_conf->ifb_index, node->id + 10, node->id + 10, bandwidth, delay, lossrate);
-                    if (ret != SUCCESS) {
-                        WARNING("Error configuring Meteor rule %d.", node->id);
-                        exit (1);
-                    }
-                    node++;
-                }
+    // replay_read() rewrites every adjusted record, so the two buffers
+    // are swapped instead of copied
+    rp->adjusted_recs_ucast = rp->applied_recs_ucast;
+    rp->applied_recs_ucast = recs;
+    rp->applied_record_time = rp->crt_record_time;
+    rp->applied = TRUE;
+    rp->meteor_conf->cur_recs = recs;
+}
+
+int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// lateness quantile 'fraction' of the sorted samples, in us
+double
+lateness_quantile(double *sorted, int cnt, double fraction)
+{
+    int i = (int)ceil(fraction * cnt) - 1;
+
+    return sorted[i < 0 ? 0 : i] * 1e6;
+}
+
+// print the wake-up lateness of the records applied since the scenario
+// (re)started, so that runs with and without -P can be compared
+void
+replay_report(struct meteor_replay *rp)
+{
+    struct meteor_config *meteor_conf = rp->meteor_conf;
+    int cnt = rp->lateness_cnt;
+
+    if (cnt == 0) {
+        return;
+    }
+
+    qsort(rp->lateness, cnt, sizeof (double), compare_double);
+    fprintf(meteor_conf->logfd,
+            "Deadline lateness (%s): %d records, %d missed, "
+            "p50=%.1f us p99=%.1f us p99.9=%.1f us max=%.1f us\n",
+            meteor_conf->rt_cpu >= 0 ? "real-time profile" : "no real-time profile",
+            cnt, rp->missed_cnt,
+            lateness_quantile(rp->lateness, cnt, 0.5),
+            lateness_quantile(rp->lateness, cnt, 0.99),
+            lateness_quantile(rp->lateness, cnt, 0.999),
+            rp->lateness[cnt - 1] * 1e6);
+}
+
+// go back to the first time record of the scenario
+void
+replay_rewind(struct meteor_replay *rp)
+{
+    struct meteor_config *meteor_conf = rp->meteor_conf;
+
+    re_flag = FALSE;
+    rp->lateness_cnt = 0;
+    rp->missed_cnt = 0;
+    fseek(meteor_conf->deltaq_fd, 0L, SEEK_SET);
+    reset_time_scale(meteor_conf);
+    io_binary_read_header_from_file(meteor_conf->bin_hdr, meteor_conf->deltaq_fd);
+    if (meteor_conf->verbose >= 1) {
+        io_binary_print_header(meteor_conf->bin_hdr);
+    }
+    rp->time_i = 0;
+}
+
+// read ahead to the next time record whose time has not passed yet and
+// arm the timer for it; stop the loop at the end of the scenario
+void
+replay_next(EV_P_ struct meteor_replay *rp)
+{
+    double real_time;
+    struct meteor_config *meteor_conf = rp->meteor_conf;
+
+    while (TRUE) {
+        if (rp->time_i >= meteor_conf->bin_hdr->time_rec_num) {
+            replay_report(rp);
+            if (meteor_conf->loop != TRUE) {
+                ev_break(EV_A_ EVBREAK_ALL);
+                return;
             }
+            replay_rewind(rp);
+        }
+
+        replay_read(rp);
+        // the first record only sets the timer zero
+        if (rp->time_i == 0) {
+            timer_reset(&rp->timer, 0.0);
+            rp->time_i++;
+            continue;
+        }
+
+        real_time = scenario_to_real_time(meteor_conf, rp->crt_record_time);
+        if (real_time < timer_elapsed_time(&rp->timer)) {
+            fprintf(meteor_conf->logfd, 
+                    "Timer deadline missed at time=%.6f s ",
+                    rp->crt_record_time);
+            fprintf(meteor_conf->logfd, "This rule is skip.\n");
+            rp->missed_cnt++;
+            rp->time_i++;
+            continue;
+        }
+
+        INFO("Waiting to reach real time %.6fs (scenario time %.6f)\n",
+                real_time, rp->crt_record_time);
+        if (timer_arm_fd(&rp->timer, real_time) < 0) {
+            fprintf(meteor_conf->logfd, "Could not arm timer\n");
+            exit(1);
+        }
+        rp->deadline = real_time;
+        return;
+    }
+}
+
+void
+replay_timer_cb(EV_P_ ev_io *w, int revents)
+{
+    struct meteor_replay *rp = w->data;
+
+    if (timer_read_fd(&rp->timer) <= 0) {
+        return;
+    }
+
+    if (rp->lateness_cnt < rp->meteor_conf->bin_hdr->time_rec_num) {
+        rp->lateness[rp->lateness_cnt++] = timer_elapsed_time(&rp->timer) - rp->deadline;
+    }
+    replay_apply(rp);
+    rp->time_i++;
+    replay_next(EV_A_ rp);
+}
+
+// act on the flags set by the SIGUSR1 and SIGRTMIN handlers
+void
+signal_cb(EV_P_ ev_async *w, int revents)
+{
+    struct meteor_replay *rp = w->data;
+    struct meteor_config *meteor_conf = rp->meteor_conf;
+
+    if (re_flag == TRUE) {
+        timer_disarm_fd(&rp->timer);
+        replay_rewind(rp);
+        replay_next(EV_A_ rp);
+    }
+    if (rescale_flag == TRUE) {
+        apply_time_scale(meteor_conf, &rp->timer);
+        // the delays in force are scaled again at once, and the
+        // pending record moves with the new scale
+        if (rp->applied) {
+            replay_configure(rp, rp->applied_recs_ucast, rp->applied_record_time);
         }
+        rp->deadline = scenario_to_real_time(meteor_conf, rp->crt_record_time);
+        timer_arm_fd(&rp->timer, rp->deadline);
+    }
+}
+
+// touch every page of a buffer so that it is mapped before the first
+// deadline
+void
+prefault(void *buf, size_t len)
+{
+    volatile char *p = buf;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t off;
+
+    for (off = 0; off < len; off += page) {
+        p[off] = p[off];
+    }
+    if (len > 0) {
+        p[len - 1] = p[len - 1];
+    }
+}
+
+// grow the stack to RT_STACK_PREFAULT so that deeper calls at a
+// deadline do not fault
+void __attribute__ ((noinline))
+prefault_stack(void)
+{
+    volatile char stack[RT_STACK_PREFAULT];
+
+    memset((char *)stack, 0, sizeof (stack));
+}
+
+// enter the real-time profile: pin the replay loop to its CPU, lock
+// and pre-fault its memory, then make it a SCHED_FIFO task
+void
+rt_enter(struct meteor_replay *rp)
+{
+    int node_i;
+    cpu_set_t cpus;
+    struct sched_param param;
+    struct meteor_config *meteor_conf = rp->meteor_conf;
+    uint32_t if_num = meteor_conf->bin_hdr->if_num;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(meteor_conf->rt_cpu, &cpus);
+    if (sched_setaffinity(0, sizeof (cpus), &cpus) != 0) {
+        fprintf(meteor_conf->logfd, "Cannot pin meteor to CPU %d: %s\n",
+                meteor_conf->rt_cpu, strerror(errno));
+        exit(1);
+    }
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        fprintf(meteor_conf->logfd, "Cannot lock meteor memory: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    prefault(rp->bin_recs_all, rp->bin_recs_max_cnt * sizeof (struct bin_rec_cls));
+    prefault(rp->recs_ucast, if_num * sizeof (struct bin_rec_cls *));
+    for (node_i = 0; node_i < if_num; node_i++) {
+        prefault(rp->recs_ucast[node_i], if_num * sizeof (struct bin_rec_cls));
+    }
+    prefault(rp->adjusted_recs_ucast,
+            rp->bin_hdr_if_num * meteor_conf->local_cnt * sizeof (struct bin_rec_cls));
+    prefault(rp->applied_recs_ucast,
+            rp->bin_hdr_if_num * meteor_conf->local_cnt * sizeof (struct bin_rec_cls));
+    prefault(rp->recs_ucast_changed, rp->bin_hdr_if_num * sizeof (int32_t));
+    prefault(rp->lateness, meteor_conf->bin_hdr->time_rec_num * sizeof (double));
+    prefault_stack();
+    // time records are read from the scenario file as they come due
+    posix_fadvise(fileno(meteor_conf->deltaq_fd), 0, 0, POSIX_FADV_WILLNEED);
+
+    param.sched_priority = meteor_conf->rt_priority;
+    if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+        fprintf(meteor_conf->logfd, "Cannot set SCHED_FIFO priority %d: %s\n",
+                meteor_conf->rt_priority, strerror(errno));
+        exit(1);
+    }
+
+    if (meteor_conf->verbose >= 1) {
+        fprintf(meteor_conf->logfd, "Real-time profile: CPU %d, SCHED_FIFO priority %d\n",
+                meteor_conf->rt_cpu, meteor_conf->rt_priority);
     }
+}
 
-    if (meteor_conf->loop == TRUE) {
-        re_flag = FALSE;
-        fseek(meteor_conf->deltaq_fd, 0L, SEEK_SET);
-        if ((timer = timer_init_rdtsc()) == NULL) {
-            WARNING("Could not initialize timer");
+// replay the scenario; returns at its end unless in loop mode
+int
+meteor_loop(struct meteor_config *meteor_conf)
+{
+    int node_i;
+    struct meteor_replay *rp;
+    struct bin_hdr_cls *bin_hdr = meteor_conf->bin_hdr;
+    struct ev_loop *loop = EV_DEFAULT;
+
+    if (!(rp = calloc(1, sizeof (struct meteor_replay)))) {
+        fprintf(meteor_conf->logfd, "[%s] Cannot allocate memory\n", __func__);
+        exit(1);
+    }
+    rp->meteor_conf = meteor_conf;
+    if (timer_open_fd(&rp->timer) < 0) {
+        fprintf(meteor_conf->logfd, "[%s] Could not initialize timer", __func__);
+        exit(1);
+    }
+    reset_time_scale(meteor_conf);
+
+    rp->bin_recs_max_cnt = bin_hdr->if_num * (bin_hdr->if_num - 1);
+    rp->bin_recs_all = (struct bin_rec_cls *)calloc(rp->bin_recs_max_cnt, sizeof (struct bin_rec_cls));
+    if (!rp->bin_recs_all) {
+        WARNING("[%s] Cannot allocate memory for binary records", __func__);
+        exit(1);
+    }
+
+    rp->recs_ucast = (struct bin_rec_cls**)calloc(bin_hdr->if_num, sizeof (struct bin_rec_cls*));
+    if (!rp->recs_ucast) {
+        fprintf(meteor_conf->logfd, "[%s] Cannot allocate memory for recs_ucast\n", __func__);
+        exit(1);
+    }
+
+    for (node_i = 0; node_i < bin_hdr->if_num; node_i++) {
+        rp->recs_ucast[node_i] = (struct bin_rec_cls *)calloc(bin_hdr->if_num, sizeof (struct bin_rec_cls));
+        if (!rp->recs_ucast[node_i]) {
+            fprintf(meteor_conf->logfd, "[%s] Cannot allocate memory for recs_ucast[%d]\n",
+                            __func__, node_i);
             exit(1);
         }
-        io_binary_read_header_from_file(bin_hdr, meteor_conf->deltaq_fd);
-        if (meteor_conf->verbose >= 1) {
-            io_binary_print_header(bin_hdr);
+
+        int node_j;
+        for (node_j = 0; node_j < bin_hdr->if_num; node_j++) {
+            rp->recs_ucast[node_i][node_j].bandwidth = UNDEFINED_BANDWIDTH;
         }
-        goto emulation_start;
     }
 
+    if (meteor_conf->direction == BRIDGE) {
+        rp->bin_hdr_if_num = bin_hdr->if_num * bin_hdr->if_num;
+    }
+    else {
+        rp->bin_hdr_if_num = bin_hdr->if_num;
+    }
+
+    // one row of adjusted records per local node
+    rp->adjusted_recs_ucast = (struct bin_rec_cls *)calloc(rp->bin_hdr_if_num * meteor_conf->local_cnt,
+            sizeof (struct bin_rec_cls));
+    if (rp->adjusted_recs_ucast == NULL) {
+        fprintf(meteor_conf->logfd, "[%s] Cannot allocate memory for adjusted_recs_ucast", __func__);
+        exit(1);
+    }
+    rp->applied_recs_ucast = (struct bin_rec_cls *)calloc(rp->bin_hdr_if_num * meteor_conf->local_cnt,
+            sizeof (struct bin_rec_cls));
+    if (rp->applied_recs_ucast == NULL) {
+        fprintf(meteor_conf->logfd, "[%s] Cannot allocate memory for applied_recs_ucast", __func__);
+        exit(1);
+    }
+    meteor_conf->cur_recs_stride = rp->bin_hdr_if_num;
+    meteor_conf->cur_recs = NULL;
+
+    rp->recs_ucast_changed = (int32_t *)calloc(rp->bin_hdr_if_num, sizeof (int32_t));
+    if (rp->recs_ucast_changed == NULL) {
+        fprintf(meteor_conf->logfd, "Cannot allocate memory for recs_ucast_changed\n");
+        exit(1);
+    }
+
+    rp->lateness = (double *)calloc(bin_hdr->time_rec_num, sizeof (double));
+    if (rp->lateness == NULL) {
+        fprintf(meteor_conf->logfd, "Cannot allocate memory for lateness\n");
+        exit(1);
+    }
+
+    if (meteor_conf->rt_cpu >= 0) {
+        rt_enter(rp);
+    }
+
+    // deadlines, signals and, without the real-time profile,
+    // statistics are all served by this loop
+    rp->timer_watch.data = rp;
+    ev_io_init(&rp->timer_watch, replay_timer_cb, rp->timer.fd, EV_READ);
+    ev_io_start(loop, &rp->timer_watch);
+    signal_watch.data = rp;
+    ev_async_init(&signal_watch, signal_cb);
+    ev_async_start(loop, &signal_watch);
+
+    replay_next(loop, rp);
+    ev_run(loop, 0);
+
+    ev_io_stop(loop, &rp->timer_watch);
+    ev_async_stop(loop, &signal_watch);
+    timer_close_fd(&rp->timer);
+
     return 0;
 }
 
+// parse a node id list such as "3,4,5-20" into meteor_conf->local;
+// return SUCCESS on success, ERROR on error
+int
+parse_id_list(struct meteor_config *meteor_conf, char *list)
+{
+    char *tok, *save, *end;
+    long first, last, id;
+    struct local_node *local;
+
+    for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        first = strtol(tok, &end, 10);
+        if (end == tok) {
+            return ERROR;
+        }
+        last = first;
+        if (*end == '-') {
+            tok = end + 1;
+            last = strtol(tok, &end, 10);
+            if (end == tok) {
+                return ERROR;
+            }
+        }
+        if (*end != '\0' || first < 0 || last < first) {
+            return ERROR;
+        }
+
+        local = realloc(meteor_conf->local,
+                sizeof (struct local_node) * (meteor_conf->local_cnt + last - first + 1));
+        if (!local) {
+            perror("realloc");
+            exit(1);
+        }
+        meteor_conf->local = local;
+        for (id = first; id <= last; id++) {
+            local = &meteor_conf->local[meteor_conf->local_cnt++];
+            local->id = id;
+            local->pif_index = 0;
+            local->ifb_index = 0;
+        }
+    }
+
+    if (meteor_conf->local_cnt == 0) {
+        return ERROR;
+    }
+    meteor_conf->id = meteor_conf->local[0].id;
+
+    return SUCCESS;
+}
+
+// resolve the interfaces of the local nodes and build the id lookup map;
+// a single node uses the interface given by -I, several nodes use the
+// interface of each node in the settings file
+int
+init_local_nodes(struct meteor_config *meteor_conf)
+{
+    int local_i, other_i, node_i;
+    struct local_node *ln;
+    struct node_data *node;
+
+    meteor_conf->local_map = calloc(meteor_conf->node_cnt, sizeof (uint8_t));
+    if (!meteor_conf->local_map) {
+        perror("calloc");
+        exit(1);
+    }
+
+    if (meteor_conf->local_cnt > 1 && meteor_conf->pif_index) {
+        fprintf(meteor_conf->logfd, "Option -I cannot be used with several node ids\n");
+        return ERROR;
+    }
+
+    for (local_i = 0; local_i < meteor_conf->local_cnt; local_i++) {
+        ln = &meteor_conf->local[local_i];
+        if (ln->id >= meteor_conf->node_cnt) {
+            fprintf(meteor_conf->logfd, "Invalid Node ID: %d\n", ln->id);
+            return ERROR;
+        }
+        if (meteor_conf->local_map[ln->id]) {
+            fprintf(meteor_conf->logfd, "Duplicate Node ID: %d\n", ln->id);
+            return ERROR;
+        }
+        meteor_conf->local_map[ln->id] = TRUE;
+
+        if (meteor_conf->local_cnt == 1) {
+            ln->pif_index = meteor_conf->pif_index;
+            continue;
+        }
+
+        node = meteor_conf->node_list_head;
+        for (node_i = 0; node_i < meteor_conf->node_cnt; node_i++, node++) {
+            if (node->id == ln->id) {
+                ln->pif_index = get_ifindex(meteor_conf->cache, node->ifname);
+                break;
+            }
+        }
+        if (ln->pif_index <= 0) {
+            fprintf(meteor_conf->logfd, "No interface found for node %d\n", ln->id);
+            return ERROR;
+        }
+        // the ingress redirect of a node replaces that of any other
+        // node on the same interface
+        for (other_i = 0; other_i < local_i; other_i++) {
+            if (meteor_conf->local[other_i].pif_index == ln->pif_index) {
+                fprintf(meteor_conf->logfd, "Duplicate Interface: nodes %d and %d\n",
+                        meteor_conf->local[other_i].id, ln->id);
+                return ERROR;
+            }
+        }
+    }
+
+    return SUCCESS;
+}
+
 void
 mode_select(struct meteor_config *meteor_conf, char *mode)
 {
@@ -706,6 +1534,72 @@ mode_select(struct meteor_config *meteor_conf, char *mode)
 }
 
 
+// sample the tc counters of every peer and exchange snapshots with the
+// other meteor instances over the statistics multicast group
+void
+stats_send_cb(EV_P_ ev_timer *w, int revents)
+{
+    stats_send(w->data);
+}
+
+void
+stats_receive_cb(EV_P_ ev_io *w, int revents)
+{
+    stats_receive(w->data);
+}
+
+void *
+stats_thread(void *arg)
+{
+    ev_run((struct ev_loop *)arg, 0);
+
+    return NULL;
+}
+
+// the statistics share the replay loop, except with the real-time
+// profile: their netlink dumps would delay its deadlines, so they get
+// a loop of their own on a normal thread, started before the replay
+// thread becomes SCHED_FIFO
+void
+start_statistics(struct meteor_config *meteor_conf)
+{
+    static ev_timer send_watch;
+    static ev_io receive_watch;
+    struct stats_context *ctx;
+    struct ev_loop *loop = EV_DEFAULT;
+    pthread_t thread;
+
+    if (meteor_conf->rt_cpu >= 0 && !(loop = ev_loop_new(EVFLAG_AUTO))) {
+        fprintf(meteor_conf->logfd, "[%s] Cannot create statistics event loop\n", __func__);
+        exit(1);
+    }
+
+    if (!(ctx = stats_init(meteor_conf, meteor_conf->stats_interval))) {
+        fprintf(meteor_conf->logfd, "[%s] Cannot allocate statistics context\n", __func__);
+        exit(1);
+    }
+    if (stats_open(ctx) != SUCCESS) {
+        fprintf(meteor_conf->logfd, "[%s] Cannot open statistics sockets\n", __func__);
+        exit(1);
+    }
+
+    send_watch.data = ctx;
+    ev_timer_init(&send_watch, stats_send_cb,
+            ctx->interval_ms / 1000.0, ctx->interval_ms / 1000.0);
+    ev_timer_start(loop, &send_watch);
+    receive_watch.data = ctx;
+    ev_io_init(&receive_watch, stats_receive_cb, ctx->listen_sock, EV_READ);
+    ev_io_start(loop, &receive_watch);
+
+    if (meteor_conf->rt_cpu >= 0) {
+        if (pthread_create(&thread, NULL, stats_thread, loop) != 0) {
+            fprintf(meteor_conf->logfd, "[%s] Cannot start statistics thread\n", __func__);
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+}
+
 struct option options[] = 
 {
     {"connection", required_argument, NULL, 'c'},
@@ -718,7 +1612,13 @@ struct option options[] =
     {"Log", required_argument, NULL, 'L'},
     {"use_mac_address", no_argument, NULL, 'M'},
     {"qomet_scenario", required_argument, NULL, 'q'},
+    {"netem_rate", no_argument, NULL, 'R'},
+    {"reconcile", no_argument, NULL, 'r'},
     {"settings", required_argument, NULL, 's'},
+    {"shards", required_argument, NULL, 'S'},
+    {"stats", required_argument, NULL, 't'},
+    {"rt", required_argument, NULL, 'P'},
+    {"time-scale", required_argument, NULL, 'T'},
     {"verbose", no_argument, NULL, 'v'},
     {0, 0, 0, 0}
 };
@@ -739,6 +1639,14 @@ main(int argc, char **argv)
         exit(1);
     }
 
+    memset(&sa, 0, sizeof (struct sigaction));
+    sa.sa_sigaction = &change_time_scale;
+    sa.sa_flags |= SA_RESTART | SA_SIGINFO;
+    if (sigaction(SIGRTMIN, &sa, NULL) != 0) {
+        fprintf(stderr, "Cannot set signal.\n");
+        exit(1);
+    }
+
     meteor_conf = init_meteor_conf();
     meteor_conf->nlsock = nl_socket_alloc();
     if (!meteor_conf->nlsock) {
@@ -755,8 +1663,9 @@ main(int argc, char **argv)
     }
 
     char ch;
+    char *end;
     int index;
-    while ((ch = getopt_long(argc, argv, "c:dhi:I:lL:m:Mq:s:v", options, &index)) != -1) {
+    while ((ch = getopt_long(argc, argv, "c:dhi:I:lL:m:MP:q:rRs:S:t:T:v", options, &index)) != -1) {
         switch (ch) {
             case 'c':
                 meteor_conf->connection_fd = fopen(optarg, "r");
@@ -768,7 +1677,10 @@ main(int argc, char **argv)
                 usage();
                 exit(0);
             case 'i':
-                meteor_conf->id = strtol(optarg, NULL, 10);
+                if (parse_id_list(meteor_conf, optarg) == ERROR) {
+                    fprintf(stderr, "Invalid node id list '%s'\n", optarg);
+                    exit(1);
+                }
                 break;
             case 'I':
                 meteor_conf->pif_index = get_ifindex(meteor_conf->cache, optarg);
@@ -785,12 +1697,30 @@ main(int argc, char **argv)
             case 'M':
                 meteor_conf->filter_mode = ETH_P_ALL;
                 break;
+            case 'P':
+                meteor_conf->rt_cpu = strtol(optarg, &end, 10);
+                if (*end == ':') {
+                    meteor_conf->rt_priority = strtol(end + 1, &end, 10);
+                }
+                if (*end != '\0' || meteor_conf->rt_cpu < 0 || meteor_conf->rt_cpu >= CPU_SETSIZE ||
+                        meteor_conf->rt_priority < sched_get_priority_min(SCHED_FIFO) ||
+                        meteor_conf->rt_priority > sched_get_priority_max(SCHED_FIFO)) {
+                    fprintf(stderr, "Invalid real-time profile '%s'\n", optarg);
+                    exit(1);
+                }
+                break;
             case 'q':
                 if (!(meteor_conf->deltaq_fd = fopen(optarg, "rb"))) {
                     WARNING("Could not open QOMET output file '%s'", optarg);
                     exit(1);
                 }
                 break;
+            case 'r':
+                meteor_conf->reconcile = TRUE;
+                break;
+            case 'R':
+                meteor_conf->link_model = LINK_MODEL_NETEM;
+                break;
             case 's':
                 if (!(meteor_conf->node_cnt = get_node_cnt(optarg))) {
                     fprintf(stderr, "Settings file '%s' is invalid", optarg);
@@ -798,6 +1728,29 @@ main(int argc, char **argv)
                 }
                 meteor_conf->node_list_head = create_node_list(optarg, meteor_conf->node_cnt);
                 break;
+            case 'S':
+                meteor_conf->shards = strtol(optarg, NULL, 10);
+                if (meteor_conf->shards < 1 || meteor_conf->shards > MAX_SHARDS) {
+                    fprintf(stderr, "Number of shards must be in [1, %d]\n", MAX_SHARDS);
+                    exit(1);
+                }
+                break;
+            case 't':
+                meteor_conf->stats_interval = strtol(optarg, NULL, 10);
+                if (meteor_conf->stats_interval == 0) {
+                    fprintf(stderr, "Statistics interval must be a positive number of ms\n");
+                    exit(1);
+                }
+                break;
+            case 'T':
+                meteor_conf->time_scale = strtod(optarg, NULL);
+                if (meteor_conf->time_scale < MIN_TIME_SCALE || meteor_conf->time_scale > MAX_TIME_SCALE) {
+                    fprintf(stderr, "Time scale must be in [%.1f, %.1f]\n",
+                            MIN_TIME_SCALE, MAX_TIME_SCALE);
+                    exit(1);
+                }
+                meteor_conf->time_scale_def = meteor_conf->time_scale;
+                break;
             case 'v':
                 meteor_conf->verbose += 1;
                 break;
@@ -811,12 +1764,17 @@ main(int argc, char **argv)
         meteor_conf->logfd = stdout;
     }
 
-    if (meteor_conf->node_cnt < meteor_conf->id) {
-        fprintf(meteor_conf->logfd, "Invalid Node ID: %d\n", meteor_conf->id);
+    if (meteor_conf->local_cnt == 0) {
+        fprintf(meteor_conf->logfd, "Please specify node id. option: -i ID\n");
         exit(1);
     }
-    else if (meteor_conf->id == -1) {
-        fprintf(meteor_conf->logfd, "Please specify node id. option: -i ID\n");
+    if (init_local_nodes(meteor_conf) == ERROR) {
+        exit(1);
+    }
+
+    if (meteor_conf->shards > 1 && meteor_conf->node_cnt > SHARD_NETEM_STRIDE(meteor_conf->shards)) {
+        fprintf(meteor_conf->logfd, "At most %d nodes can be spread over %d shards\n",
+                SHARD_NETEM_STRIDE(meteor_conf->shards), meteor_conf->shards);
         exit(1);
     }
 
@@ -840,28 +1798,46 @@ main(int argc, char **argv)
         ret = daemon(0, 0);
     }
 
-    meteor_conf->ifb_index = create_ifb(meteor_conf->nlsock, meteor_conf->id);
-    init_rule(meteor_conf);
-
-    if (meteor_conf->direction == INGRESS) {
-        struct node_data *node = meteor_conf->node_list_head;
+    for (int local_i = 0; local_i < meteor_conf->local_cnt; local_i++) {
+        struct local_node *ln = &meteor_conf->local[local_i];
 
-        for (int i = 0; i < meteor_conf->node_cnt; i++) {
-            if (node->id == meteor_conf->id) {
-                node++;
-                continue;
-            }
-            if (meteor_conf->verbose >= 1) {
-                fprintf(meteor_conf->logfd, "Add rule %d from source %s\n",
-                        node->id, inet_ntoa(node->ipv4addr));
+        ln->ifb_index = create_ifb(meteor_conf->nlsock, ln->id, meteor_conf->shards);
+        if (ln->ifb_index <= 0) {
+            fprintf(meteor_conf->logfd, "Could not set up ifb%d\n", ln->id);
+            exit(1);
+        }
+        if (meteor_conf->reconcile && meteor_conf->direction == INGRESS) {
+            if (reconcile_rule(meteor_conf, ln) != SUCCESS) {
+                fprintf(meteor_conf->logfd, "Could not reconcile rules of ifb%d\n", ln->id);
+                exit(1);
             }
+            continue;
+        }
+        init_rule(meteor_conf, ln);
+    }
 
-            if (add_rule(meteor_conf, node->id + 10, node->id + 10, node, NULL) < 0) {
-                fprintf(meteor_conf->logfd, "Could not add rule %d from source %s\n", 
-                        node->id, inet_ntoa(node->ipv4addr));
-                exit(1);
+    if (meteor_conf->direction == INGRESS && !meteor_conf->reconcile) {
+        for (int local_i = 0; local_i < meteor_conf->local_cnt; local_i++) {
+            struct local_node *ln = &meteor_conf->local[local_i];
+            struct node_data *node = meteor_conf->node_list_head;
+
+            for (int i = 0; i < meteor_conf->node_cnt; i++) {
+                if (node->id == ln->id) {
+                    node++;
+                    continue;
+                }
+                if (meteor_conf->verbose >= 1) {
+                    fprintf(meteor_conf->logfd, "Add rule %d from source %s on ifb%d\n",
+                            node->id, inet_ntoa(node->ipv4addr), ln->id);
+                }
+
+                if (add_rule(meteor_conf, ln, node->id + 10, node->id + 10, node, NULL) < 0) {
+                    fprintf(meteor_conf->logfd, "Could not add rule %d from source %s\n", 
+                            node->id, inet_ntoa(node->ipv4addr));
+                    exit(1);
+                }
+                node++;
             }
-            node++;
         }
     }
     else if (meteor_conf->direction == BRIDGE) {
@@ -895,6 +1871,10 @@ main(int argc, char **argv)
         exit(1);
     }
 
+    if (meteor_conf->stats_interval && meteor_conf->direction == INGRESS) {
+        start_statistics(meteor_conf);
+    }
+
     meteor_loop(meteor_conf);
 
     finalize_rule(meteor_conf);
@@ -8,10 +8,19 @@
 
 #include <net/if.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
 #include <ev.h>
+#include <jansson.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
+#include <endian.h>
 #include <getopt.h>
 #include <string.h>
 #include <unistd.h>
@@ -23,11 +32,39 @@
 #include "timer.h"
 #include "meteor.h"
 #include "json_parse.h"
+#include "meteord_proto.h"
 #include "utils.h"
 #include "libnlwrap.h"
 
 #define MAX_BUF 65535
 
+#define CLIENT_BUF_INIT     4096
+#define CLIENT_BUF_MIN_FREE 1500
+#define CLIENT_BUF_MAX      (16 * 1024 * 1024)
+
+// one entry per valid link id of both control protocols
+#define LINK_TABLE_SIZE     (METEORD_MAX_LINK_ID + 1)
+#define DEF_MAX_UPDATE_RATE 1000
+#define DEF_PORT            10000
+
+#define LINK_INSTALLED      0x01
+#define LINK_DIRTY          0x02
+
+// scheduled commands wake the loop this early and sleep the rest on
+// the monotonic clock, as libev timers are only ms accurate
+#define SCHED_EARLY_NS      1000000
+#define SCHED_MAX           (1024 * 1024)
+
+// applied jobs kept for reuse instead of being freed
+#define JOB_POOL_MAX        256
+#define JOB_CHANGES_INIT    16
+// s between queue statistics reports
+#define QUEUE_REPORT_INTERVAL 1.0
+
+#define PROTO_UNKNOWN       0
+#define PROTO_JSON          1
+#define PROTO_BINARY        2
+
 #ifdef __amd64__
 #define rdtsc(t)                                                              \
     __asm__ __volatile__ ("rdtsc; movq %%rdx, %0; salq $32, %0;orq %%rax, %0" \
@@ -36,14 +73,169 @@
 #define rdtsc(t) asm volatile("rdtsc" : "=A" (t))
 #endif
 
+// one controller connection; the watcher must stay the first member
+// so that callbacks can cast it back to the connection
+struct client_conn {
+    ev_io watch;
+    int proto;
+    // binary frames are applied as tc batches (METEORD_HELLO_BATCH)
+    int batch;
+
+    // buf[head, tail) holds received bytes not yet consumed; newlines
+    // are only searched in [scan, tail)
+    char *buf;
+    size_t size;
+    size_t head;
+    size_t scan;
+    size_t tail;
+
+    // monotonic time of the last read
+    uint64_t rx_ns;
+    // jobs not yet answered; a closed connection is freed once the
+    // last of them is done
+    uint32_t pending;
+    int closed;
+};
+
+// node of the lock-free queues between the loop and the netlink worker
+struct mpsc_node {
+    struct mpsc_node *_Atomic next;
+};
+
+// intrusive multi-producer single-consumer queue (D. Vyukov):
+// producers only exchange 'head', 'tail' belongs to the consumer
+struct mpsc_queue {
+    struct mpsc_node *_Atomic head;
+    struct mpsc_node *tail;
+    struct mpsc_node stub;
+};
+
+struct link_change {
+    struct meteord_iface *iface;
+    uint8_t op;
+    uint16_t id;
+    struct in_addr addr;
+    int32_t rate;
+    double delay;
+    double loss;
+};
+
+// link changes handed to the netlink worker; the node must stay the
+// first member so that queue entries can be cast back to the job
+struct apply_job {
+    struct mpsc_node node;
+    // connection to answer with a commit, or NULL
+    struct client_conn *conn;
+    // apply as one tc batch
+    int batch;
+    // monotonic times: command received, earliest start, worker start
+    // and end
+    uint64_t rx_ns;
+    uint64_t not_before_ns;
+    uint64_t start_ns;
+    uint64_t done_ns;
+    struct meteord_commit commit;
+    uint32_t cnt;
+    uint32_t size;
+    struct link_change *changes;
+};
+
+// applied and latest requested parameters of one link; updates only
+// touch the latter and the flusher sends the difference
+struct link_state {
+    uint8_t flags;
+    int32_t rate;
+    double delay;
+    double loss;
+    int32_t next_rate;
+    double next_delay;
+    double next_loss;
+    ev_tstamp applied_at;
+};
+
+// one physical interface whose ingress traffic is shaped on ifb<id>
+struct meteord_iface {
+    char name[IFNAMSIZ];
+    int32_t id;
+    int pif_index;
+    int ifb_index;
+
+    struct link_state *links;
+    // ids of links with LINK_DIRTY set, each listed once
+    uint16_t *dirty_links;
+    uint32_t dirty_cnt;
+};
+
+// a link change held until its deadline
+struct sched_cmd {
+    uint64_t at_ns;
+    // keeps commands with the same deadline in arrival order
+    uint64_t seq;
+    struct meteord_iface *iface;
+    uint8_t op;
+    uint16_t id;
+    struct in_addr addr;
+    int32_t rate;
+    double delay;
+    double loss;
+};
+
 int session = 0;
 struct meteor_config *mc;
+// only used by the netlink worker once the loop runs
+struct tc_batch *batch;
+
+struct mpsc_queue work_queue;
+struct mpsc_queue done_queue;
+sem_t work_sem;
+ev_async done_watch;
+atomic_uint queue_depth;
+uint32_t queue_depth_max = 0;
+struct apply_job *job_pool[JOB_POOL_MAX];
+uint32_t job_pool_cnt = 0;
+// end-to-end latency of the jobs done since the last report
+uint64_t jobs_done = 0;
+uint64_t job_latency_sum_ns = 0;
+uint64_t job_latency_max_ns = 0;
+
+// from the config file; commands without an interface go to the first
+struct meteord_iface *ifaces;
+uint32_t iface_cnt = 0;
+uint16_t port = DEF_PORT;
+// 0 until set on the command line or in the config file
+uint32_t max_update_rate = 0;
+uint64_t coalesced_cnt = 0;
+
+// binary min-heap of scheduled commands, ordered by (at_ns, seq)
+struct sched_cmd *sched;
+uint32_t sched_cnt = 0;
+uint32_t sched_size = 0;
+uint64_t sched_seq = 0;
+ev_timer sched_watch;
+// monotonic time of scenario time 0
+uint64_t epoch_ns;
+
+// local control channels, both optional
+char *unix_path = NULL;
+char *ring_name = NULL;
+struct meteord_ring *ring;
+// deadline and interface set by the last AT and IFACE records of the ring
+uint64_t ring_at_ns = 0;
+struct meteord_iface *ring_iface;
 
 void
 usage()
 {
     fprintf(stderr, "meteord. Wireless network emulator daemon.\n\n");
-    fprintf(stderr, "\tUsage: meteord -c <CONFIG_FILE>\n");
+    fprintf(stderr, "\tUsage: meteord -c <CONFIG_FILE> [-u <RATE>] [-U <PATH>] [-s <NAME>] [-v]\n");
+    fprintf(stderr, "\t-c, --config: JSON file with the interfaces to emulate on, e.g.\n"
+            "\t\t{ \"port\": 10000, \"interface0\": { \"interface\": \"eth2\", \"id\": 0 } }\n"
+            "\t\tCommand line options take precedence over its settings.\n");
+    fprintf(stderr, "\t-u, --max_update_rate: Changes per second applied to one link (default %d).\n"
+            "\t\tUpdates arriving faster are coalesced to the latest one.\n", DEF_MAX_UPDATE_RATE);
+    fprintf(stderr, "\t-U, --unix: Also accept controllers on the Unix domain socket PATH.\n");
+    fprintf(stderr, "\t-s, --shm: Create the shared-memory command ring NAME (see meteord_proto.h).\n");
+    fprintf(stderr, "\t-v, --verbose: Verbose mode; report queue depth and command latency.\n");
 }
 
 struct meteor_config *
@@ -51,8 +243,7 @@ init_meteor_conf()
 {
     struct meteor_config *mc;
 
-    mc = malloc(sizeof (struct meteor_config));
-    memset(mc, '0', sizeof (struct meteor_config));
+    mc = calloc(1, sizeof (struct meteor_config));
     if (!mc) {
         fprintf(stderr, "[%s] Cannot allocate memory\n", __func__);
         exit(1);
@@ -102,7 +293,7 @@ get_cpu_frequency(void)
 }
 
 int32_t
-create_ifb(struct meteor_config *mc)
+create_ifb(struct nl_sock *sock, int32_t id)
 {
     char *ifbdevname;
     int err;
@@ -111,8 +302,8 @@ create_ifb(struct meteor_config *mc)
     struct rtnl_link *link;
 
     ifbdevname = (char *)malloc(15);
-    sprintf(ifbdevname, "ifb%d", mc->id);
-    rtnl_link_alloc_cache(mc->nlsock, AF_UNSPEC, &cache);
+    sprintf(ifbdevname, "ifb%d", id);
+    rtnl_link_alloc_cache(sock, AF_UNSPEC, &cache);
     if_index = rtnl_link_name2i(cache, ifbdevname);
     nl_cache_put(cache);
 
@@ -124,11 +315,11 @@ create_ifb(struct meteor_config *mc)
         rtnl_link_set_type(link, "ifb");
         rtnl_link_set_num_tx_queues(link, 8);
         rtnl_link_set_num_rx_queues(link, 8);
-        if ((err = rtnl_link_add(mc->nlsock, link, NLM_F_CREATE)) < 0) {
+        if ((err = rtnl_link_add(sock, link, NLM_F_CREATE)) < 0) {
             nl_perror(err, "Unable to add link");
             return err;
         }
-        rtnl_link_alloc_cache(mc->nlsock, AF_UNSPEC, &cache);
+        rtnl_link_alloc_cache(sock, AF_UNSPEC, &cache);
         if_index = rtnl_link_name2i(cache, ifbdevname);
         rtnl_link_put(link);
         nl_cache_put(cache);
@@ -143,7 +334,7 @@ create_ifb(struct meteor_config *mc)
     if (!flags) {
         rtnl_link_set_flags(link, IFF_UP);
         flags = rtnl_link_get_flags(link);
-        if ((err = rtnl_link_add(mc->nlsock, link, RTM_SETLINK)) < 0) {
+        if ((err = rtnl_link_add(sock, link, RTM_SETLINK)) < 0) {
             nl_perror(err, "Unable to modify link");
             return err;
         }
@@ -172,11 +363,10 @@ delete_ifb(struct nl_sock *sock, int32_t if_index)
 }
 
 int
-init_rule(struct meteor_config *mc)
+init_rule(struct nl_sock *sock, struct meteord_iface *iface)
 {
-    struct nl_sock *sock = mc->nlsock;
-    int pif_index = mc->pif_index;
-    int ifb_index = mc->ifb_index;
+    int pif_index = iface->pif_index;
+    int ifb_index = iface->ifb_index;
 
     delete_qdisc(sock, pif_index, TC_H_INGRESS, 0);
     add_ingress_qdisc(sock, pif_index);
@@ -193,7 +383,7 @@ init_rule(struct meteor_config *mc)
     int delay     = DEF_DELAY; // us
     int jitter    = DEF_DELAY; // us
     uint32_t loss = DEF_LOSS;  // %
-    add_netem_qdisc(sock, mc->ifb_index, 
+    add_netem_qdisc(sock, ifb_index, 
             TC_HANDLE(1, 65535), TC_HANDLE(65535, 0),
             delay, jitter, loss, 1000);
 
@@ -267,110 +457,1016 @@ delete_rule(struct nl_sock *sock, int ifb_index, uint16_t parent, uint16_t handl
     return;
 }
 
+uint64_t
+monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
 void
-command_cb(EV_P_ ev_io *client_watch, int revents)
+mpsc_init(struct mpsc_queue *q)
 {
-    char *c, *buf_ptr; 
-    ssize_t size;
-    char buf[MAX_BUF];
-    struct meteor_params *mp = NULL;
-    struct link_params *lp;
+    atomic_store(&q->stub.next, NULL);
+    atomic_store(&q->head, &q->stub);
+    q->tail = &q->stub;
+}
 
-    if (EV_ERROR & revents) {
-        perror("everror");
+// wait-free, any thread
+void
+mpsc_push(struct mpsc_queue *q, struct mpsc_node *node)
+{
+    struct mpsc_node *prev;
+
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    prev = atomic_exchange_explicit(&q->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+// consumer thread only; NULL if empty or a push is half done
+struct mpsc_node *
+mpsc_pop(struct mpsc_queue *q)
+{
+    struct mpsc_node *tail = q->tail;
+    struct mpsc_node *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &q->stub) {
+        if (!next) {
+            return NULL;
+        }
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire)) {
+        return NULL;
+    }
+    // 'tail' is the last node; put the stub behind it to detach it
+    mpsc_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+struct apply_job *
+get_job(int batch, uint64_t rx_ns)
+{
+    struct apply_job *job;
+
+    if (job_pool_cnt) {
+        job = job_pool[--job_pool_cnt];
+    }
+    else if (!(job = calloc(1, sizeof (struct apply_job)))) {
+        fprintf(mc->logfd, "[%s] Cannot allocate memory\n", __func__);
+        return NULL;
+    }
+    job->conn = NULL;
+    job->batch = batch;
+    job->rx_ns = rx_ns;
+    job->not_before_ns = 0;
+    job->cnt = 0;
+    memset(&job->commit, 0, sizeof (job->commit));
+
+    return job;
+}
+
+void
+put_job(struct apply_job *job)
+{
+    if (job_pool_cnt < JOB_POOL_MAX) {
+        job_pool[job_pool_cnt++] = job;
         return;
     }
+    free(job->changes);
+    free(job);
+}
+
+int
+job_add(struct apply_job *job, struct meteord_iface *iface, int op, uint16_t id,
+        struct in_addr *addr, int32_t rate, double delay, double loss)
+{
+    uint32_t size;
+    struct link_change *changes, *c;
+
+    if (job->cnt == job->size) {
+        size = job->size ? job->size * 2 : JOB_CHANGES_INIT;
+        if (!(changes = realloc(job->changes, size * sizeof (struct link_change)))) {
+            fprintf(mc->logfd, "[%s] Cannot allocate memory, dropping %s link %d change\n",
+                    __func__, iface->name, id);
+            return -1;
+        }
+        job->changes = changes;
+        job->size = size;
+    }
+
+    c = &job->changes[job->cnt++];
+    c->iface = iface;
+    c->op = op;
+    c->id = id;
+    if (addr) {
+        c->addr = *addr;
+    }
+    c->rate = rate;
+    c->delay = delay;
+    c->loss = loss;
 
-    size = recv(client_watch->fd, buf, 1500, 0);
-    if (size <= 0) {
-        close(client_watch->fd);
-        ev_io_stop(EV_A_ client_watch);
-        free(client_watch);
+    return 0;
+}
+
+// hand a job to the netlink worker; 'conn' is answered once it is done
+void
+submit_job(struct apply_job *job, struct client_conn *conn)
+{
+    uint32_t depth;
+
+    if (!job->cnt && !conn) {
+        put_job(job);
         return;
     }
-    if (size < 5) {
-        close(client_watch->fd);
-        ev_io_stop(EV_A_ client_watch);
-        free(client_watch);
+    if ((job->conn = conn)) {
+        conn->pending++;
+    }
+
+    depth = atomic_fetch_add(&queue_depth, 1) + 1;
+    if (depth > queue_depth_max) {
+        queue_depth_max = depth;
+    }
+    mpsc_push(&work_queue, &job->node);
+    sem_post(&work_sem);
+}
+
+// record parameters sent to the kernel; a pending update for the same
+// values becomes a no-op for the flusher
+void
+set_link_applied(struct link_state *ls, int32_t rate, double delay, double loss)
+{
+    ls->rate = ls->next_rate = rate;
+    ls->delay = ls->next_delay = delay;
+    ls->loss = ls->next_loss = loss;
+    ls->applied_at = ev_now(EV_DEFAULT);
+}
+
+// store the latest parameters of a link for the flusher
+void
+update_link(struct meteord_iface *iface, uint16_t id, int32_t rate, double delay, double loss)
+{
+    struct link_state *ls = &iface->links[id];
+
+    if (ls->flags & LINK_DIRTY) {
+        coalesced_cnt++;
+    }
+    else if (ls->rate == rate && ls->delay == delay && ls->loss == loss) {
+        coalesced_cnt++;
         return;
     }
+    else {
+        ls->flags |= LINK_DIRTY;
+        iface->dirty_links[iface->dirty_cnt++] = id;
+    }
+
+    ls->next_rate = rate;
+    ls->next_delay = delay;
+    ls->next_loss = loss;
+}
+
+// queue the net change of every dirty link that has not been changed
+// within the last 1/max_update_rate s, of all interfaces as one tc batch
+void
+flush_cb(EV_P_ ev_timer *flush_watch, int revents)
+{
+    uint16_t id;
+    uint32_t i, dirty_i, keep, applied = 0, deferred = 0;
+    ev_tstamp now = ev_now(EV_A);
+    struct meteord_iface *iface;
+    struct link_state *ls;
+    struct apply_job *job = NULL;
+
+    for (i = 0; i < iface_cnt; i++) {
+        iface = &ifaces[i];
+        if (!iface->dirty_cnt) {
+            continue;
+        }
+        if (!job && !(job = get_job(TRUE, monotonic_ns()))) {
+            return;
+        }
 
-    buf_ptr = c = buf;
-    for (int buf_i = 0; buf_i < size; buf_i++) {
-        if (strncmp(c, "\n", 1) == 0) {
-            *c = '\0';
+        keep = 0;
+        for (dirty_i = 0; dirty_i < iface->dirty_cnt; dirty_i++) {
+            id = iface->dirty_links[dirty_i];
+            ls = &iface->links[id];
+            if (now - ls->applied_at < 1.0 / max_update_rate) {
+                iface->dirty_links[keep++] = id;
+                continue;
+            }
+
+            ls->flags &= ~LINK_DIRTY;
+            if (ls->next_rate == ls->rate && ls->next_delay == ls->delay &&
+                    ls->next_loss == ls->loss) {
+                continue;
+            }
+            job_add(job, iface, METEORD_OP_UPDATE, id, NULL,
+                    ls->next_rate, ls->next_delay, ls->next_loss);
+            set_link_applied(ls, ls->next_rate, ls->next_delay, ls->next_loss);
+            applied++;
         }
-        else {
-            c++;
+        iface->dirty_cnt = keep;
+        deferred += keep;
+    }
+    if (!job) {
+        return;
+    }
+    submit_job(job, NULL);
+
+    if (mc->verbose >= 2) {
+        fprintf(mc->logfd, "Flushed %u links, %u deferred, %llu updates coalesced so far\n",
+                applied, deferred, (unsigned long long)coalesced_cnt);
+    }
+}
+
+// add one link change of any control protocol to 'job'; the link
+// table already reflects it when this returns
+void
+apply_link(struct apply_job *job, struct meteord_iface *iface, int op, uint16_t id,
+        struct in_addr *addr, int32_t rate, double delay, double loss)
+{
+    struct link_state *ls = &iface->links[id];
+
+    switch (op) {
+        case METEORD_OP_ADD:
+            job_add(job, iface, op, id, addr, rate, delay, loss);
+            ls->flags |= LINK_INSTALLED;
+            set_link_applied(ls, rate, delay, loss);
+            break;
+        case METEORD_OP_UPDATE:
+            // a batch is applied as a whole, right now
+            if (job->batch) {
+                job_add(job, iface, op, id, NULL, rate, delay, loss);
+                set_link_applied(ls, rate, delay, loss);
+            }
+            else {
+                update_link(iface, id, rate, delay, loss);
+            }
+            break;
+        case METEORD_OP_DELETE:
+            job_add(job, iface, op, id, NULL, 0, 0, 0);
+            ls->flags &= ~LINK_INSTALLED;
+            set_link_applied(ls, 0, 0, 0);
+            break;
+        default:
+            fprintf(mc->logfd, "Unknown operation %d for %s link %d\n", op, iface->name, id);
+    }
+}
+
+// netlink worker side of a link change
+void
+apply_change(struct link_change *c)
+{
+    int ifb_index = c->iface->ifb_index;
+
+    switch (c->op) {
+        case METEORD_OP_ADD:
+            add_rule(mc->nlsock, ifb_index, c->id + 10, c->id + 10, ETH_P_IP, &c->addr, NULL);
+            configure_rule(mc->nlsock, ifb_index, c->id + 10, c->id + 10,
+                    c->rate, c->delay, c->loss);
+            break;
+        case METEORD_OP_UPDATE:
+            configure_rule(mc->nlsock, ifb_index, c->id + 10, c->id + 10,
+                    c->rate, c->delay, c->loss);
+            break;
+        case METEORD_OP_DELETE:
+            delete_rule(mc->nlsock, ifb_index, c->id + 10, c->id + 10);
+            break;
+    }
+}
+
+// the only thread talking to the kernel once the loop runs; takes
+// jobs in submission order and returns them through done_queue
+void *
+apply_worker(void *arg)
+{
+    uint32_t i;
+    struct timespec ts;
+    struct mpsc_node *node;
+    struct apply_job *job;
+
+    while (TRUE) {
+        if (sem_wait(&work_sem) != 0) {
             continue;
         }
+        // the producer may not have linked its node yet
+        while (!(node = mpsc_pop(&work_queue))) {
+            sched_yield();
+        }
+        atomic_fetch_sub(&queue_depth, 1);
+        job = (struct apply_job *)node;
+
+        // scheduled jobs are queued early; sleep out the rest here
+        if (job->not_before_ns) {
+            ts.tv_sec = job->not_before_ns / 1000000000;
+            ts.tv_nsec = job->not_before_ns % 1000000000;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        }
 
-        debug("buf => %s\n", buf_ptr);
-        mp = parse_json(buf_ptr);
-        if (mp == NULL) {
-            fprintf(mc->logfd, "invalid parameter => %s\n", buf);
-            memset(buf, 0, MAX_BUF);
-            return;
+        job->start_ns = monotonic_ns();
+        if (job->batch) {
+            tc_batch_begin(batch);
         }
-    
-        lp = mp->add_params;
-        while (lp) {
-            add_rule(mc->nlsock, mc->ifb_index, lp->id + 10, lp->id + 10, ETH_P_IP, 
-                    &lp->addr, NULL);
-            configure_rule(mc->nlsock, mc->ifb_index, lp->id + 10, lp->id + 10,
-                    lp->rate, lp->delay, lp->loss);
-            lp = lp->next;
-        }
-    
-        lp = mp->update_params;
-        while (lp) {
-            configure_rule(mc->nlsock, mc->ifb_index, lp->id + 10, lp->id + 10,
-                    lp->rate, lp->delay, lp->loss);
-            lp = lp->next;
-        }
-        if (mp->delete_params != NULL) {
-            struct node_array *dp;
-            dp = mp->delete_params;
-            if (dp->size != 0) {
-                for (int i = 0; i < dp->size; i++) {
-                    delete_rule(mc->nlsock, mc->ifb_index, dp->id[i] + 10, dp->id[i] + 10);
-                }
+        for (i = 0; i < job->cnt; i++) {
+            apply_change(&job->changes[i]);
+        }
+        if (job->batch) {
+            tc_batch_commit(batch);
+            job->commit.ops = batch->ops;
+            job->commit.errors = batch->errors;
+            if (batch->errors && mc->verbose >= 1) {
+                fprintf(mc->logfd, "%d of %u tc requests failed: %s\n",
+                        batch->errors, batch->ops, nl_geterror(batch->first_error));
+            }
+        }
+        job->done_ns = monotonic_ns();
+
+        mpsc_push(&done_queue, &job->node);
+        ev_async_send(EV_DEFAULT, &done_watch);
+    }
+
+    return NULL;
+}
+
+// replies are small and rare; one that does not fit in the socket
+// buffer of a controller that never reads them is dropped
+void
+send_reply(struct client_conn *conn, const void *reply, size_t len)
+{
+    if (send(conn->watch.fd, reply, len, MSG_NOSIGNAL) != (ssize_t)len) {
+        fprintf(mc->logfd, "Cannot send reply to controller\n");
+    }
+}
+
+void
+send_commit(struct client_conn *conn, struct apply_job *job)
+{
+    int len;
+    char reply[160];
+    struct meteord_commit *commit = &job->commit;
+
+    commit->latency_us = (job->done_ns - job->start_ns) / 1000;
+    commit->queue_us = (job->start_ns - job->rx_ns) / 1000;
+
+    if (conn->proto == PROTO_JSON) {
+        len = snprintf(reply, sizeof (reply),
+                "{\"commit\": {\"ops\": %u, \"errors\": %u, \"latency_us\": %u, \"queue_us\": %u}}\n",
+                commit->ops, commit->errors, commit->latency_us, commit->queue_us);
+        send_reply(conn, reply, len);
+        return;
+    }
+
+    commit->ops = htonl(commit->ops);
+    commit->errors = htonl(commit->errors);
+    commit->latency_us = htonl(commit->latency_us);
+    commit->queue_us = htonl(commit->queue_us);
+    send_reply(conn, commit, sizeof (*commit));
+}
+
+// collect jobs the worker is done with: answer, account and recycle
+void
+done_cb(EV_P_ ev_async *w, int revents)
+{
+    uint64_t latency;
+    struct mpsc_node *node;
+    struct apply_job *job;
+    struct client_conn *conn;
+
+    while ((node = mpsc_pop(&done_queue))) {
+        job = (struct apply_job *)node;
+
+        latency = job->done_ns - job->rx_ns;
+        jobs_done++;
+        job_latency_sum_ns += latency;
+        if (latency > job_latency_max_ns) {
+            job_latency_max_ns = latency;
+        }
+        if (job->not_before_ns && mc->verbose >= 1) {
+            fprintf(mc->logfd, "Scheduled batch applied %.3f us after its deadline (%u requests)\n",
+                    (job->start_ns - job->not_before_ns) / 1e3, job->commit.ops);
+        }
+
+        if ((conn = job->conn)) {
+            conn->pending--;
+            if (!conn->closed) {
+                send_commit(conn, job);
             }
+            else if (!conn->pending) {
+                free(conn);
+            }
+        }
+        put_job(job);
+    }
+}
+
+void
+report_cb(EV_P_ ev_timer *w, int revents)
+{
+    if (mc->verbose >= 1 && jobs_done) {
+        fprintf(mc->logfd, "Queue depth %u (max %u), %llu jobs, latency avg %.1f us max %.1f us\n",
+                atomic_load(&queue_depth), queue_depth_max, (unsigned long long)jobs_done,
+                job_latency_sum_ns / 1e3 / jobs_done, job_latency_max_ns / 1e3);
+    }
+
+    queue_depth_max = atomic_load(&queue_depth);
+    jobs_done = 0;
+    job_latency_sum_ns = 0;
+    job_latency_max_ns = 0;
+}
+
+// monotonic deadline of a time given on clock 'clock'
+uint64_t
+sched_deadline(int clock, uint64_t at_ns)
+{
+    if (clock == METEORD_CLOCK_SCENARIO) {
+        return epoch_ns + at_ns;
+    }
+
+    return at_ns;
+}
+
+int
+sched_before(struct sched_cmd *a, struct sched_cmd *b)
+{
+    return a->at_ns < b->at_ns || (a->at_ns == b->at_ns && a->seq < b->seq);
+}
+
+void
+sched_swap(uint32_t i, uint32_t j)
+{
+    struct sched_cmd tmp = sched[i];
+
+    sched[i] = sched[j];
+    sched[j] = tmp;
+}
+
+// arm the libev timer for the earliest command
+void
+sched_arm(void)
+{
+    uint64_t now = monotonic_ns();
+    ev_tstamp after = 0.0;
+
+    ev_timer_stop(EV_DEFAULT, &sched_watch);
+    if (!sched_cnt) {
+        return;
+    }
+    if (sched[0].at_ns > now + SCHED_EARLY_NS) {
+        after = (sched[0].at_ns - now - SCHED_EARLY_NS) / 1e9;
+    }
+    ev_timer_set(&sched_watch, after, 0.0);
+    ev_timer_start(EV_DEFAULT, &sched_watch);
+}
+
+int
+sched_push(uint64_t at_ns, struct meteord_iface *iface, int op, uint16_t id,
+        struct in_addr *addr, int32_t rate, double delay, double loss)
+{
+    uint32_t i;
+    uint32_t size;
+    struct sched_cmd *cmds;
+
+    if (sched_cnt == sched_size) {
+        if (sched_size == SCHED_MAX) {
+            fprintf(mc->logfd, "Too many scheduled commands, dropping %s link %d change\n",
+                    iface->name, id);
+            return -1;
+        }
+        size = sched_size ? sched_size * 2 : 1024;
+        if (!(cmds = realloc(sched, size * sizeof (struct sched_cmd)))) {
+            fprintf(mc->logfd, "[%s] Cannot allocate memory\n", __func__);
+            return -1;
+        }
+        sched = cmds;
+        sched_size = size;
+    }
+
+    i = sched_cnt++;
+    sched[i].at_ns = at_ns;
+    sched[i].seq = sched_seq++;
+    sched[i].iface = iface;
+    sched[i].op = op;
+    sched[i].id = id;
+    if (addr) {
+        sched[i].addr = *addr;
+    }
+    sched[i].rate = rate;
+    sched[i].delay = delay;
+    sched[i].loss = loss;
+
+    while (i > 0 && sched_before(&sched[i], &sched[(i - 1) / 2])) {
+        sched_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    if (i == 0) {
+        sched_arm();
+    }
+
+    return 0;
+}
+
+void
+sched_pop(void)
+{
+    uint32_t i = 0, child;
+
+    sched[0] = sched[--sched_cnt];
+    while ((child = 2 * i + 1) < sched_cnt) {
+        if (child + 1 < sched_cnt && sched_before(&sched[child + 1], &sched[child])) {
+            child++;
+        }
+        if (!sched_before(&sched[child], &sched[i])) {
+            break;
+        }
+        sched_swap(i, child);
+        i = child;
+    }
+}
+
+// queue every command due by the deadline of the earliest one as one
+// tc batch; the worker sleeps out the last part of the wait
+void
+sched_cb(EV_P_ ev_timer *w, int revents)
+{
+    uint64_t deadline;
+    struct apply_job *job;
+
+    while (sched_cnt && sched[0].at_ns <= monotonic_ns() + SCHED_EARLY_NS) {
+        deadline = sched[0].at_ns;
+        if (!(job = get_job(TRUE, monotonic_ns()))) {
+            break;
+        }
+        job->not_before_ns = deadline;
+        while (sched_cnt && sched[0].at_ns <= deadline) {
+            apply_link(job, sched[0].iface, sched[0].op, sched[0].id, &sched[0].addr,
+                    sched[0].rate, sched[0].delay, sched[0].loss);
+            sched_pop();
+        }
+        submit_job(job, NULL);
+    }
+
+    sched_arm();
+}
+
+// add a link change to 'job', or hold it until 'at_ns' if not 0
+void
+submit_link(struct apply_job *job, uint64_t at_ns, struct meteord_iface *iface,
+        int op, uint16_t id, struct in_addr *addr, int32_t rate, double delay, double loss)
+{
+    if (at_ns) {
+        sched_push(at_ns, iface, op, id, addr, rate, delay, loss);
+        return;
+    }
+
+    apply_link(job, iface, op, id, addr, rate, delay, loss);
+}
+
+// interface with config id 'id', or with name 'name' if not NULL
+struct meteord_iface *
+find_iface(const char *name, int32_t id)
+{
+    uint32_t i;
+
+    for (i = 0; i < iface_cnt; i++) {
+        if (name ? strcmp(ifaces[i].name, name) == 0 : ifaces[i].id == id) {
+            return &ifaces[i];
         }
+    }
+
+    return NULL;
+}
+
+// queue one newline-terminated JSON command
+void
+process_command(struct client_conn *conn, char *line)
+{
+    int batch;
+    uint64_t at_ns = 0;
+    struct meteord_iface *iface = &ifaces[0];
+    struct apply_job *job;
+    struct meteor_params *mp;
+    struct link_params *lp;
+
+    debug("buf => %s\n", line);
+    mp = parse_json(line);
+    if (mp == NULL) {
+        fprintf(mc->logfd, "invalid parameter => %s\n", line);
+        return;
+    }
+    if (mp->ifname[0] && !(iface = find_iface(mp->ifname, 0))) {
+        fprintf(mc->logfd, "Unknown interface %s, command dropped\n", mp->ifname);
+        clear_meteor_params(mp);
+        return;
+    }
 
-        c++;
-        buf_ptr = c;
+    if (mp->epoch) {
+        epoch_ns = mp->epoch_at < 0 ? monotonic_ns() : mp->epoch_at * 1e9;
+    }
+    // scheduled changes are applied as one batch at their deadline
+    if (mp->at_clock) {
+        at_ns = sched_deadline(mp->at_clock, mp->at * 1e9);
+    }
+    batch = mp->batch && !mp->at_clock;
+    if (!(job = get_job(batch, conn->rx_ns))) {
         clear_meteor_params(mp);
+        return;
+    }
+
+    for (lp = mp->add_params; lp; lp = lp->next) {
+        submit_link(job, at_ns, iface, METEORD_OP_ADD, lp->id, &lp->addr, lp->rate, lp->delay, lp->loss);
+    }
+    for (lp = mp->update_params; lp; lp = lp->next) {
+        submit_link(job, at_ns, iface, METEORD_OP_UPDATE, lp->id, NULL, lp->rate, lp->delay, lp->loss);
+    }
+    if (mp->delete_params != NULL) {
+        struct node_array *dp;
+        dp = mp->delete_params;
+        for (int i = 0; i < dp->size; i++) {
+            submit_link(job, at_ns, iface, METEORD_OP_DELETE, dp->id[i], NULL, 0, 0, 0);
+        }
+    }
+    submit_job(job, batch ? conn : NULL);
+
+    clear_meteor_params(mp);
+}
+
+// decode one binary record; AT and IFACE records set the deadline
+// '*at_ns' and the interface '*iface' of the records after them
+void
+process_rec(struct apply_job *job, uint64_t *at_ns, struct meteord_iface **iface,
+        const char *buf)
+{
+    struct meteord_rec rec;
+    struct meteord_at_rec at;
+    struct in_addr addr;
+
+    memcpy(&rec, buf, sizeof (rec));
+    if (rec.op == METEORD_OP_IFACE) {
+        if (!(*iface = find_iface(NULL, ntohs(rec.id)))) {
+            fprintf(mc->logfd, "Unknown interface id %d, dropping its records\n", ntohs(rec.id));
+        }
+        return;
+    }
+    // records for an unknown interface
+    if (!*iface) {
+        return;
+    }
+    if (rec.op == METEORD_OP_AT || rec.op == METEORD_OP_EPOCH) {
+        memcpy(&at, buf, sizeof (at));
+        if (rec.op == METEORD_OP_EPOCH) {
+            epoch_ns = at.at_ns ? be64toh(at.at_ns) : monotonic_ns();
+        }
+        else {
+            *at_ns = sched_deadline(at.clock, be64toh(at.at_ns));
+        }
+        return;
+    }
+    if (ntohs(rec.id) > METEORD_MAX_LINK_ID) {
+        fprintf(mc->logfd, "Link id %d out of range, record dropped\n", ntohs(rec.id));
+        return;
+    }
+    addr.s_addr = rec.addr;
+    submit_link(job, *at_ns, *iface, rec.op, ntohs(rec.id), &addr, ntohl(rec.rate),
+            ntohl(rec.delay), ntohl(rec.loss) / 10000.0);
+}
+
+// queue the records of one binary frame; decoded in place
+void
+process_frame(struct client_conn *conn, char *payload, uint32_t len)
+{
+    uint32_t off;
+    uint64_t at_ns = 0;
+    struct meteord_iface *iface = &ifaces[0];
+    struct apply_job *job;
+
+    if (!(job = get_job(conn->batch, conn->rx_ns))) {
+        return;
+    }
+    for (off = 0; off + sizeof (struct meteord_rec) <= len; off += sizeof (struct meteord_rec)) {
+        process_rec(job, &at_ns, &iface, payload + off);
+    }
+    submit_job(job, conn->batch ? conn : NULL);
+}
+
+// create the shared-memory ring 'name' for local controllers
+struct meteord_ring *
+create_ring(const char *name)
+{
+    int fd;
+    size_t len = sizeof (struct meteord_ring) +
+        METEORD_RING_RECS * sizeof (struct meteord_rec);
+    struct meteord_ring *ring;
+
+    // a ring left over by an earlier meteord may still hold records
+    shm_unlink(name);
+    if ((fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600)) < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+    if (ftruncate(fd, len) < 0) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+    ring = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    ring->version = METEORD_PROTO_VERSION;
+    ring->size = METEORD_RING_RECS;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(ring->magic, METEORD_RING_MAGIC, sizeof (ring->magic));
+
+    return ring;
+}
+
+// drain the shared-memory ring into one job; a poll of an idle ring
+// costs one load and no system call
+void
+ring_cb(EV_P_ ev_timer *w, int revents)
+{
+    uint64_t head, tail = ring->tail;
+    struct apply_job *job;
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return;
+    }
+    if (head - tail > METEORD_RING_RECS) {
+        fprintf(mc->logfd, "Ring head %llu is ahead of tail %llu by more than the ring, skipping\n",
+                (unsigned long long)head, (unsigned long long)tail);
+        __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+        return;
+    }
+    if (!(job = get_job(ring->flags & METEORD_HELLO_BATCH, monotonic_ns()))) {
+        return;
+    }
+
+    for (; tail != head; tail++) {
+        process_rec(job, &ring_at_ns, &ring_iface,
+                (const char *)&ring->recs[tail & (METEORD_RING_RECS - 1)]);
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    submit_job(job, NULL);
+}
+
+// decide the protocol of a connection from its first bytes;
+// return -1 if the connection must be closed
+int
+negotiate_proto(struct client_conn *conn)
+{
+    struct meteord_hello hello;
+
+    if (conn->tail == conn->head) {
+        return 0;
+    }
+    if (conn->buf[conn->head] != METEORD_MAGIC[0]) {
+        conn->proto = PROTO_JSON;
+        return 0;
+    }
+    if (conn->tail - conn->head < sizeof (hello)) {
+        return 0;
+    }
+
+    memcpy(&hello, conn->buf + conn->head, sizeof (hello));
+    if (memcmp(hello.magic, METEORD_MAGIC, sizeof (hello.magic)) != 0) {
+        conn->proto = PROTO_JSON;
+        return 0;
+    }
+    if (ntohs(hello.version) != METEORD_PROTO_VERSION) {
+        fprintf(mc->logfd, "Unsupported protocol version %d\n", ntohs(hello.version));
+        return -1;
+    }
+
+    conn->batch = ntohs(hello.flags) & METEORD_HELLO_BATCH;
+    hello.flags = htons(conn->batch ? METEORD_HELLO_BATCH : 0);
+    if (send(conn->watch.fd, &hello, sizeof (hello), 0) != sizeof (hello)) {
+        return -1;
+    }
+    conn->proto = PROTO_BINARY;
+    conn->head += sizeof (hello);
+    conn->scan = conn->head;
+
+    return 0;
+}
+
+// consume all complete frames; return -1 on a malformed frame
+int
+consume_frames(struct client_conn *conn)
+{
+    uint32_t len;
+
+    while (conn->tail - conn->head >= sizeof (len)) {
+        memcpy(&len, conn->buf + conn->head, sizeof (len));
+        len = ntohl(len);
+        if (len > METEORD_FRAME_MAX || len % sizeof (struct meteord_rec) != 0) {
+            fprintf(mc->logfd, "Invalid frame length %u\n", len);
+            return -1;
+        }
+        if (conn->tail - conn->head < sizeof (len) + len) {
+            break;
+        }
+        process_frame(conn, conn->buf + conn->head + sizeof (len), len);
+        conn->head += sizeof (len) + len;
+    }
+    conn->scan = conn->head;
+
+    return 0;
+}
+
+// consume all complete JSON lines
+void
+consume_lines(struct client_conn *conn)
+{
+    char *nl;
+
+    while ((nl = memchr(conn->buf + conn->scan, '\n', conn->tail - conn->scan))) {
+        *nl = '\0';
+        if (nl > conn->buf + conn->head) {
+            process_command(conn, conn->buf + conn->head);
+        }
+        conn->head = nl - conn->buf + 1;
+        conn->scan = conn->head;
+    }
+    // the partial line stays buffered; don't search it twice
+    conn->scan = conn->tail;
+}
+
+void
+close_client(EV_P_ struct client_conn *conn)
+{
+    ev_io_stop(EV_A_ &conn->watch);
+    close(conn->watch.fd);
+    free(conn->buf);
+    conn->buf = NULL;
+    // done_cb frees it once the worker is through with its jobs
+    if (conn->pending) {
+        conn->closed = TRUE;
+        return;
+    }
+    free(conn);
+}
+
+// make room for at least one more read; data between head and tail
+// is kept, consumed bytes are reclaimed before the buffer grows
+int
+reserve_client_buf(struct client_conn *conn)
+{
+    char *buf;
+    size_t size;
+
+    if (conn->head > 0) {
+        memmove(conn->buf, conn->buf + conn->head, conn->tail - conn->head);
+        conn->tail -= conn->head;
+        conn->scan -= conn->head;
+        conn->head = 0;
+    }
+    if (conn->size - conn->tail >= CLIENT_BUF_MIN_FREE) {
+        return 0;
+    }
+    if (conn->size >= CLIENT_BUF_MAX) {
+        return -1;
+    }
+
+    size = conn->size ? conn->size * 2 : CLIENT_BUF_INIT;
+    if (!(buf = realloc(conn->buf, size))) {
+        return -1;
+    }
+    conn->buf = buf;
+    conn->size = size;
+
+    return 0;
+}
+
+void
+command_cb(EV_P_ ev_io *client_watch, int revents)
+{
+    ssize_t size;
+    struct client_conn *conn = (struct client_conn *)client_watch;
+
+    if (EV_ERROR & revents) {
+        perror("everror");
+        return;
     }
 
-    memset(buf, 0, MAX_BUF);
+    // drain the socket; a command may straddle any number of reads
+    while (TRUE) {
+        if (reserve_client_buf(conn) < 0) {
+            fprintf(mc->logfd, "Command longer than %d bytes, closing connection\n",
+                    CLIENT_BUF_MAX);
+            close_client(EV_A_ conn);
+            return;
+        }
+
+        size = recv(client_watch->fd, conn->buf + conn->tail, conn->size - conn->tail, 0);
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size <= 0) {
+            close_client(EV_A_ conn);
+            return;
+        }
+        conn->tail += size;
+        conn->rx_ns = monotonic_ns();
+
+        if (conn->proto == PROTO_UNKNOWN && negotiate_proto(conn) < 0) {
+            close_client(EV_A_ conn);
+            return;
+        }
+        if (conn->proto == PROTO_JSON) {
+            consume_lines(conn);
+        }
+        else if (conn->proto == PROTO_BINARY && consume_frames(conn) < 0) {
+            close_client(EV_A_ conn);
+            return;
+        }
+    }
 }
 
 void
 meteor_cb(EV_P_ ev_io *meteor_watch, int revents)
 {
     int client_fd;
-    struct sockaddr_in caddr;
-    socklen_t caddrlen = sizeof (caddr);
     struct ev_loop *client_loop;
-    ev_io *client_watch;
+    struct client_conn *conn;
 
     if (EV_ERROR & revents) {
         perror("everror");
         return;
     }
 
-    if ((client_fd = accept(meteor_watch->fd, (struct sockaddr *)&caddr, &caddrlen)) < 0) {
+    // TCP and Unix domain listeners alike
+    if ((client_fd = accept(meteor_watch->fd, NULL, NULL)) < 0) {
         perror("accept");
         return;
     }
 
-    client_watch = (ev_io *)malloc(sizeof (ev_io));
-    memset(client_watch, 0, sizeof (ev_io));
+    fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL) | O_NONBLOCK);
+
+    if (!(conn = calloc(1, sizeof (struct client_conn)))) {
+        fprintf(mc->logfd, "[%s] Cannot allocate memory\n", __func__);
+        close(client_fd);
+        return;
+    }
     client_loop = meteor_watch->data;
 
-    ev_io_init(client_watch, command_cb, client_fd, EV_READ);
-    ev_io_start(client_loop, client_watch);
+    ev_io_init(&conn->watch, command_cb, client_fd, EV_READ);
+    ev_io_start(client_loop, &conn->watch);
+}
+
+int
+listen_unix(const char *path)
+{
+    int sock;
+    struct sockaddr_un saddr;
+
+    if (strlen(path) >= sizeof (saddr.sun_path)) {
+        fprintf(mc->logfd, "Unix socket path %s is too long\n", path);
+        return -1;
+    }
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&saddr, 0, sizeof (saddr));
+    saddr.sun_family = AF_UNIX;
+    strcpy(saddr.sun_path, path);
+    unlink(path);
+
+    if (bind(sock, (struct sockaddr *)&saddr, sizeof (struct sockaddr_un)) != 0) {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+    if (listen(sock, 2) < 0) {
+        perror("listen");
+        close(sock);
+        return -1;
+    }
+
+    return sock;
 }
 
 int
@@ -380,7 +1476,13 @@ init_meteor(struct meteor_config *mc)
     int reuse = 1;
     struct sockaddr_in saddr;
     struct ev_loop *meteor_loop = ev_default_loop(0); //ev_loop_new(ev_recommended_backends());
+    int unix_sock = -1;
     ev_io meteor_watch;
+    ev_io unix_watch;
+    ev_timer ring_watch;
+    ev_timer flush_watch;
+    ev_timer report_watch;
+    pthread_t worker;
 
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         perror("socket");
@@ -389,7 +1491,7 @@ init_meteor(struct meteor_config *mc)
 
     memset(&saddr, 0, sizeof (saddr));
     saddr.sin_family = AF_INET;
-    saddr.sin_port = htons(10000);
+    saddr.sin_port = htons(port);
     saddr.sin_addr.s_addr = INADDR_ANY;
     setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
 
@@ -406,9 +1508,53 @@ init_meteor(struct meteor_config *mc)
     ev_io_init(&meteor_watch, meteor_cb, sock, EV_READ);
     ev_io_start(meteor_loop, &meteor_watch);
 
+    if (unix_path) {
+        if ((unix_sock = listen_unix(unix_path)) < 0) {
+            return -1;
+        }
+        unix_watch.data = meteor_loop;
+        ev_io_init(&unix_watch, meteor_cb, unix_sock, EV_READ);
+        ev_io_start(meteor_loop, &unix_watch);
+    }
+    // polled as often as the flusher runs; changes to a link are not
+    // applied more often than that anyway
+    if (ring_name) {
+        if (!(ring = create_ring(ring_name))) {
+            return -1;
+        }
+        ring_iface = &ifaces[0];
+        ev_timer_init(&ring_watch, ring_cb, 1.0 / max_update_rate, 1.0 / max_update_rate);
+        ev_timer_start(meteor_loop, &ring_watch);
+    }
+
+    ev_timer_init(&flush_watch, flush_cb, 1.0 / max_update_rate, 1.0 / max_update_rate);
+    ev_timer_start(meteor_loop, &flush_watch);
+    ev_timer_init(&sched_watch, sched_cb, 0.0, 0.0);
+    ev_timer_init(&report_watch, report_cb, QUEUE_REPORT_INTERVAL, QUEUE_REPORT_INTERVAL);
+    ev_timer_start(meteor_loop, &report_watch);
+
+    // from here on only the worker uses mc->nlsock
+    mpsc_init(&work_queue);
+    mpsc_init(&done_queue);
+    sem_init(&work_sem, 0, 0);
+    ev_async_init(&done_watch, done_cb);
+    ev_async_start(meteor_loop, &done_watch);
+    if (pthread_create(&worker, NULL, apply_worker, NULL) != 0) {
+        fprintf(mc->logfd, "[%s] Cannot start netlink worker\n", __func__);
+        return -1;
+    }
+    pthread_detach(worker);
+
     ev_loop(meteor_loop, 0);
 
     close(sock);
+    if (unix_sock >= 0) {
+        close(unix_sock);
+        unlink(unix_path);
+    }
+    if (ring_name) {
+        shm_unlink(ring_name);
+    }
 
     return 0;
 }
@@ -429,23 +1575,141 @@ mode_select(struct meteor_config *mc, char *mode)
 }
 
 
+// add the interface described by config object 'key'
+int
+add_iface(const char *key, json_t *conf)
+{
+    json_t *name = json_object_get(conf, "interface");
+    json_t *id = json_object_get(conf, "id");
+    struct meteord_iface *iface;
+
+    if (!json_is_string(name) || !json_is_integer(id) || json_integer_value(id) < 0 ||
+            strlen(json_string_value(name)) >= IFNAMSIZ) {
+        fprintf(stderr, "%s needs an \"interface\" name and a non-negative \"id\"\n", key);
+        return -1;
+    }
+    if (find_iface(json_string_value(name), 0) || find_iface(NULL, json_integer_value(id))) {
+        fprintf(stderr, "%s: interface %s or id %d is configured twice\n",
+                key, json_string_value(name), (int)json_integer_value(id));
+        return -1;
+    }
+
+    if (!(iface = realloc(ifaces, (iface_cnt + 1) * sizeof (struct meteord_iface)))) {
+        fprintf(stderr, "[%s] Cannot allocate memory\n", __func__);
+        return -1;
+    }
+    ifaces = iface;
+    iface = &ifaces[iface_cnt++];
+    memset(iface, 0, sizeof (struct meteord_iface));
+    strcpy(iface->name, json_string_value(name));
+    iface->id = json_integer_value(id);
+
+    return 0;
+}
+
+// read the daemon settings and the interfaces to emulate on:
+//   { "port": 10000, "unix": "/run/meteord.sock", "shm": "/meteord",
+//     "max_update_rate": 1000, "verbose": 1,
+//     "interface0": { "interface": "eth2", "id": 0 },
+//     "interface1": { "interface": "eth3", "id": 1 } }
+// Every interface gets its own ifb<id>. Settings already given on the
+// command line are kept.
+int
+load_config(const char *path, int *verbose)
+{
+    const char *key;
+    json_t *root, *val;
+    json_error_t err;
+
+    if (!(root = json_load_file(path, 0, &err))) {
+        fprintf(stderr, "%s:%d: %s\n", path, err.line, err.text);
+        return -1;
+    }
+
+    json_object_foreach(root, key, val) {
+        if (strcmp(key, "port") == 0 && json_is_integer(val)) {
+            port = json_integer_value(val);
+        }
+        else if (strcmp(key, "unix") == 0 && json_is_string(val)) {
+            if (!unix_path) {
+                unix_path = strdup(json_string_value(val));
+            }
+        }
+        else if (strcmp(key, "shm") == 0 && json_is_string(val)) {
+            if (!ring_name) {
+                ring_name = strdup(json_string_value(val));
+            }
+        }
+        else if (strcmp(key, "max_update_rate") == 0 && json_integer_value(val) > 0) {
+            if (!max_update_rate) {
+                max_update_rate = json_integer_value(val);
+            }
+        }
+        else if (strcmp(key, "verbose") == 0 && json_is_integer(val)) {
+            if (!*verbose) {
+                *verbose = json_integer_value(val);
+            }
+        }
+        else if (strncmp(key, "interface", 9) == 0 && json_is_object(val)) {
+            if (add_iface(key, val) < 0) {
+                json_decref(root);
+                return -1;
+            }
+        }
+        else {
+            fprintf(stderr, "%s: ignoring invalid setting %s\n", path, key);
+        }
+    }
+    json_decref(root);
+
+    if (!iface_cnt) {
+        fprintf(stderr, "%s: no interface configured\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
 struct option options[] = 
 {
     {"config", required_argument, NULL, 'c'},
+    {"max_update_rate", required_argument, NULL, 'u'},
+    {"unix", required_argument, NULL, 'U'},
+    {"shm", required_argument, NULL, 's'},
+    {"verbose", no_argument, NULL, 'v'},
     {0, 0, 0, 0}
 };
 
 int
 main(int argc, char **argv)
 {
-    FILE *conf;
+    char *conf_file = NULL;
+    uint32_t i;
+    struct meteord_iface *iface;
 
     char ch;
     int index;
-    while ((ch = getopt_long(argc, argv, "c:", options, &index)) != -1) {
+    int verbose = 0;
+    while ((ch = getopt_long(argc, argv, "c:s:u:U:v", options, &index)) != -1) {
         switch (ch) {
             case 'c':
-                conf = fopen(optarg, "r");
+                conf_file = optarg;
+                break;
+            case 'u':
+                max_update_rate = strtol(optarg, NULL, 10);
+                if (max_update_rate == 0) {
+                    fprintf(stderr, "Maximum update rate must be a positive number\n");
+                    exit(1);
+                }
+                break;
+            case 'U':
+                unix_path = optarg;
+                break;
+            case 's':
+                ring_name = optarg;
+                break;
+            case 'v':
+                verbose += 1;
                 break;
             default:
                 usage();
@@ -453,8 +1717,24 @@ main(int argc, char **argv)
         }
     }
 
+    if (!conf_file) {
+        usage();
+        exit(1);
+    }
+    if (load_config(conf_file, &verbose) < 0) {
+        exit(1);
+    }
+    if (!max_update_rate) {
+        max_update_rate = DEF_MAX_UPDATE_RATE;
+    }
+
     mc = init_meteor_conf();
+    mc->verbose = verbose;
+    if (!mc->logfd) {
+        mc->logfd = stdout;
+    }
 
+    // one netlink socket and tc batch serve all interfaces
     mc->nlsock = nl_socket_alloc();
     if (!mc->nlsock) {
         perror("nl_socket_alloc");
@@ -468,27 +1748,39 @@ main(int argc, char **argv)
         perror("rtnl_link_alloc_cache");
         exit(1);
     }
-
-    mc->id = 0;
-    mc->pif_index = get_ifindex(mc->cache, "eth2");
-    mc->ifb_index = create_ifb(mc);
-
-
-    if (!mc->logfd) {
-        mc->logfd = stdout;
+    if (!(batch = tc_batch_alloc(mc->nlsock))) {
+        fprintf(mc->logfd, "Cannot allocate tc batch\n");
+        exit(1);
     }
+    epoch_ns = monotonic_ns();
 
-    if (mc->id == -1) {
-        fprintf(mc->logfd, "Please specify node id.\n");
-        exit(1);
+    for (i = 0; i < iface_cnt; i++) {
+        iface = &ifaces[i];
+        if (!(iface->pif_index = rtnl_link_name2i(mc->cache, iface->name))) {
+            fprintf(mc->logfd, "Interface %s not found\n", iface->name);
+            exit(1);
+        }
+        if ((iface->ifb_index = create_ifb(mc->nlsock, iface->id)) <= 0) {
+            fprintf(mc->logfd, "Cannot create ifb%d for %s\n", iface->id, iface->name);
+            exit(1);
+        }
+        iface->links = calloc(LINK_TABLE_SIZE, sizeof (struct link_state));
+        iface->dirty_links = calloc(LINK_TABLE_SIZE, sizeof (uint16_t));
+        if (!iface->links || !iface->dirty_links) {
+            fprintf(mc->logfd, "Cannot allocate link table\n");
+            exit(1);
+        }
+        init_rule(mc->nlsock, iface);
     }
 
-    init_rule(mc);
     init_meteor(mc);
 
-    delete_qdisc(mc->nlsock, mc->ifb_index, TC_H_ROOT, 0);
-    delete_qdisc(mc->nlsock, mc->pif_index, TC_H_INGRESS, 0);
-    delete_ifb(mc->nlsock, mc->ifb_index);
+    for (i = 0; i < iface_cnt; i++) {
+        iface = &ifaces[i];
+        delete_qdisc(mc->nlsock, iface->ifb_index, TC_H_ROOT, 0);
+        delete_qdisc(mc->nlsock, iface->pif_index, TC_H_INGRESS, 0);
+        delete_ifb(mc->nlsock, iface->ifb_index);
+    }
 
     nl_close(mc->nlsock);
 
@@ -0,0 +1,433 @@
+/************************************************************************
+ *
+ * Meteor Emulator Implementation
+ *
+ * Authors : Kunio AKASHI
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "global.h"
+#include "message.h"
+#include "wlan.h"
+#include "statistics.h"
+#include "meteor.h"
+#include "libnlwrap.h"
+
+// per-frame channel time in us besides the payload itself: DIFS,
+// PHY header of the data frame, SIFS and PHY header of the ACK
+static float
+frame_overhead_us(int32_t standard)
+{
+    switch (standard) {
+        case WLAN_802_11B:
+            return SIFS_802_11B + 2 * SLOT_802_11B + 2 * PHY_OVERHEAD_802_11BG_SHORT + SIFS_802_11B;
+        case WLAN_802_11G:
+            return SIFS_802_11G + 2 * SLOT_802_11G_SHORT + 2 * 20 + SIFS_802_11G;
+        case WLAN_802_11A:
+            return SIFS_802_11A + 2 * SLOT_802_11A + 2 * 20 + SIFS_802_11A;
+        default:
+            return 0.0;
+    }
+}
+
+float
+compute_channel_utilization(struct bin_rec_cls *binary_record,
+        long long unsigned int delta_pkt_counter,
+        long long unsigned int delta_byte_counter,
+        float time_interval)
+{
+    float rate, busy_time;
+
+    if (time_interval <= 0.0 || delta_pkt_counter == 0) {
+        return 0.0;
+    }
+
+    rate = binary_record->operating_rate;
+    if (rate <= 0.0) {
+        rate = binary_record->bandwidth;
+    }
+    if (rate <= 0.0) {
+        return 0.0;
+    }
+
+    busy_time = delta_byte_counter * 8 / rate +
+        delta_pkt_counter * frame_overhead_us(binary_record->standard) / 1e6;
+    busy_time *= 1 + binary_record->num_retransmissions;
+
+    return busy_time > time_interval ? 1.0 : busy_time / time_interval;
+}
+
+struct stats_context *
+stats_init(struct meteor_config *meteor_conf, uint32_t interval_ms)
+{
+    struct stats_context *ctx;
+
+    // snapshots carry the peer count in 16 bits
+    if (meteor_conf->node_cnt > STATISTICS_MAX_PEERS) {
+        fprintf(meteor_conf->logfd, "[%s] Statistics support at most %d nodes\n",
+                __func__, STATISTICS_MAX_PEERS);
+        return NULL;
+    }
+    if (!(ctx = calloc(1, sizeof (struct stats_context)))) {
+        return NULL;
+    }
+    ctx->meteor_conf = meteor_conf;
+    ctx->interval_ms = interval_ms;
+    ctx->remote_cnt = meteor_conf->node_cnt;
+    ctx->send_sock = -1;
+    ctx->listen_sock = -1;
+    ctx->peers = calloc(meteor_conf->local_cnt * meteor_conf->node_cnt,
+            sizeof (struct stats_peer_state));
+    ctx->remote = calloc(ctx->remote_cnt, sizeof (struct stats_class));
+    if (!ctx->peers || !ctx->remote) {
+        free(ctx->peers);
+        free(ctx->remote);
+        free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+// peer id of a per-peer HTB class or netem qdisc of 'ln', or -1
+static int32_t
+stats_peer_id(struct meteor_config *meteor_conf, struct local_node *ln,
+        int32_t ifindex, uint32_t handle, int is_qdisc)
+{
+    int32_t id, stride;
+    uint16_t major = TC_H_MAJ(handle) >> 16;
+    uint16_t minor = TC_H_MIN(handle);
+
+    if (ifindex != ln->ifb_index) {
+        return -1;
+    }
+    // every shard holds a copy of the rules of each peer, whose
+    // counters add up
+    if (is_qdisc) {
+        stride = SHARD_NETEM_STRIDE(meteor_conf->shards);
+        id = (major - 10) % stride;
+        if (minor != 0 || major < 10 || (major - 10) / stride >= meteor_conf->shards ||
+                id >= meteor_conf->node_cnt) {
+            return -1;
+        }
+        return id;
+    }
+
+    id = minor - 10;
+    if (id < 0 || id >= meteor_conf->node_cnt || !is_tree_major(meteor_conf, major)) {
+        return -1;
+    }
+
+    return id;
+}
+
+// index of the local node whose ifb is 'ifindex', or -1
+static int
+stats_local_of(struct stats_context *ctx, int32_t ifindex)
+{
+    uint32_t slot = (uint32_t)ifindex & ctx->ifb_local_mask;
+
+    while (ctx->ifb_local[slot] != 0) {
+        if (ctx->meteor_conf->local[ctx->ifb_local[slot] - 1].ifb_index == ifindex) {
+            return ctx->ifb_local[slot] - 1;
+        }
+        slot = (slot + 1) & ctx->ifb_local_mask;
+    }
+
+    return -1;
+}
+
+// read the counters of all peers of all local nodes from one class dump
+// per ifb and one pass over the host-wide qdisc dump, in which every
+// qdisc is mapped to its local node by the ifindex of its ifb
+static int
+stats_sample(struct stats_context *ctx, struct nl_sock *sock,
+        struct nl_cache **class_caches, struct nl_cache *qdisc_cache,
+        struct stats_peer_state *cur)
+{
+    int local_i;
+    int32_t id;
+    struct nl_object *obj;
+    struct local_node *ln;
+    struct stats_peer_state *st;
+    struct meteor_config *meteor_conf = ctx->meteor_conf;
+
+    memset(cur, 0, sizeof (struct stats_peer_state) * meteor_conf->local_cnt * meteor_conf->node_cnt);
+
+    if (nl_cache_refill(sock, qdisc_cache) < 0) {
+        return ERROR;
+    }
+
+    for (local_i = 0; local_i < meteor_conf->local_cnt; local_i++) {
+        ln = &meteor_conf->local[local_i];
+        if (nl_cache_refill(sock, class_caches[local_i]) < 0) {
+            return ERROR;
+        }
+
+        for (obj = nl_cache_get_first(class_caches[local_i]); obj; obj = nl_cache_get_next(obj)) {
+            id = stats_peer_id(meteor_conf, ln, rtnl_tc_get_ifindex(TC_CAST(obj)),
+                    rtnl_tc_get_handle(TC_CAST(obj)), FALSE);
+            if (id < 0) {
+                continue;
+            }
+            st = &cur[local_i * meteor_conf->node_cnt + id];
+            st->bytes   += rtnl_tc_get_stat(TC_CAST(obj), RTNL_TC_BYTES);
+            st->packets += rtnl_tc_get_stat(TC_CAST(obj), RTNL_TC_PACKETS);
+            st->backlog += rtnl_tc_get_stat(TC_CAST(obj), RTNL_TC_BACKLOG);
+            st->drops  += rtnl_tc_get_stat(TC_CAST(obj), RTNL_TC_DROPS);
+        }
+    }
+
+    // netem losses are accounted on the qdisc, not on the HTB class
+    for (obj = nl_cache_get_first(qdisc_cache); obj; obj = nl_cache_get_next(obj)) {
+        if ((local_i = stats_local_of(ctx, rtnl_tc_get_ifindex(TC_CAST(obj)))) < 0) {
+            continue;
+        }
+        ln = &meteor_conf->local[local_i];
+        id = stats_peer_id(meteor_conf, ln, rtnl_tc_get_ifindex(TC_CAST(obj)),
+                rtnl_tc_get_handle(TC_CAST(obj)), TRUE);
+        if (id < 0) {
+            continue;
+        }
+        st = &cur[local_i * meteor_conf->node_cnt + id];
+        st->drops += rtnl_tc_get_stat(TC_CAST(obj), RTNL_TC_DROPS);
+    }
+
+    return SUCCESS;
+}
+
+// send the snapshot of local node 'local_i', split over datagrams
+static void
+stats_publish(struct stats_context *ctx, int sock, struct sockaddr_in *group,
+        int local_i, uint32_t seq, float utilization)
+{
+    int32_t id;
+    uint16_t peer_i = 0, rec_i = 0, peer_cnt;
+    char dgram[STATISTICS_DGRAM_SIZE];
+    struct timespec now;
+    struct stats_snapshot_hdr *hdr = (struct stats_snapshot_hdr *)dgram;
+    struct stats_peer_rec *rec = (struct stats_peer_rec *)(hdr + 1);
+    struct stats_peer_state *st;
+    struct meteor_config *meteor_conf = ctx->meteor_conf;
+    struct local_node *ln = &meteor_conf->local[local_i];
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    peer_cnt = meteor_conf->node_cnt - 1;
+
+    memset(hdr, 0, sizeof (struct stats_snapshot_hdr));
+    hdr->magic = htonl(STATISTICS_MAGIC);
+    hdr->version = htons(STATISTICS_VERSION);
+    hdr->node_id = htons(ln->id);
+    hdr->seq = htonl(seq);
+    hdr->timestamp_ns = htobe64((uint64_t)now.tv_sec * 1000000000 + now.tv_nsec);
+    hdr->peer_cnt = htons(peer_cnt);
+    hdr->channel_utilization = htonl(utilization * 1e6);
+
+    for (id = 0; id < meteor_conf->node_cnt; id++) {
+        if (id == ln->id) {
+            continue;
+        }
+        st = &ctx->peers[local_i * meteor_conf->node_cnt + id];
+        rec[rec_i].peer_id = htons(id);
+        rec[rec_i].reserved = 0;
+        rec[rec_i].drops = htonl(st->drops);
+        rec[rec_i].bytes = htobe64(st->bytes);
+        rec[rec_i].packets = htobe64(st->packets);
+        rec[rec_i].backlog = htonl(st->backlog);
+        rec[rec_i].channel_utilization = htonl(st->channel_utilization * 1e6);
+        rec_i++;
+        peer_i++;
+
+        if (rec_i == STATISTICS_RECS_PER_DGRAM || peer_i == peer_cnt) {
+            hdr->peer_offset = htons(peer_i - rec_i);
+            hdr->rec_cnt = htons(rec_i);
+            if (sendto(sock, dgram, sizeof (struct stats_snapshot_hdr) + rec_i * sizeof (struct stats_peer_rec),
+                        0, (struct sockaddr *)group, sizeof (struct sockaddr_in)) < 0) {
+                WARNING("[%s] sendto: %s", __func__, strerror(errno));
+            }
+            rec_i = 0;
+        }
+    }
+}
+
+// open the sockets and tc caches used by stats_send and
+// stats_receive and take the first sample; return SUCCESS or ERROR
+int
+stats_open(struct stats_context *ctx)
+{
+    int local_i;
+    int reuse = 1;
+    uint8_t ttl = 1;
+    uint32_t slot, index_size = 16;
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    struct meteor_config *meteor_conf = ctx->meteor_conf;
+
+    // sample on a socket of our own, apart from the one applying rules
+    ctx->nlsock = nl_socket_alloc();
+    if (!ctx->nlsock || nl_connect(ctx->nlsock, NETLINK_ROUTE) != 0) {
+        fprintf(meteor_conf->logfd, "[%s] Cannot open netlink socket\n", __func__);
+        return ERROR;
+    }
+    ctx->class_caches = calloc(meteor_conf->local_cnt, sizeof (struct nl_cache *));
+    ctx->cur = calloc(meteor_conf->local_cnt * meteor_conf->node_cnt, sizeof (struct stats_peer_state));
+    if (!ctx->class_caches || !ctx->cur) {
+        fprintf(meteor_conf->logfd, "[%s] Cannot allocate memory\n", __func__);
+        return ERROR;
+    }
+    if (rtnl_qdisc_alloc_cache(ctx->nlsock, &ctx->qdisc_cache) < 0) {
+        fprintf(meteor_conf->logfd, "[%s] Cannot dump qdiscs\n", __func__);
+        return ERROR;
+    }
+    for (local_i = 0; local_i < meteor_conf->local_cnt; local_i++) {
+        if (rtnl_class_alloc_cache(ctx->nlsock, meteor_conf->local[local_i].ifb_index,
+                    &ctx->class_caches[local_i]) < 0) {
+            fprintf(meteor_conf->logfd, "[%s] Cannot dump classes\n", __func__);
+            return ERROR;
+        }
+    }
+
+    // index the ifbs of the local nodes, keeping the table at most half full
+    while (index_size < 2 * (uint32_t)meteor_conf->local_cnt) {
+        index_size *= 2;
+    }
+    if (!(ctx->ifb_local = calloc(index_size, sizeof (int32_t)))) {
+        fprintf(meteor_conf->logfd, "[%s] Cannot allocate memory\n", __func__);
+        return ERROR;
+    }
+    ctx->ifb_local_mask = index_size - 1;
+    for (local_i = 0; local_i < meteor_conf->local_cnt; local_i++) {
+        slot = (uint32_t)meteor_conf->local[local_i].ifb_index & ctx->ifb_local_mask;
+        while (ctx->ifb_local[slot] != 0) {
+            slot = (slot + 1) & ctx->ifb_local_mask;
+        }
+        ctx->ifb_local[slot] = local_i + 1;
+    }
+
+    if ((ctx->send_sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket");
+        return ERROR;
+    }
+    setsockopt(ctx->send_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof (ttl));
+    memset(&ctx->group, 0, sizeof (ctx->group));
+    ctx->group.sin_family = AF_INET;
+    ctx->group.sin_port = htons(STATISTICS_PORT);
+    ctx->group.sin_addr.s_addr = inet_addr(STATISTICS_ADDRESS);
+
+    if ((ctx->listen_sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket");
+        return ERROR;
+    }
+    setsockopt(ctx->listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+    fcntl(ctx->listen_sock, F_SETFL, fcntl(ctx->listen_sock, F_GETFL) | O_NONBLOCK);
+
+    memset(&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(STATISTICS_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(ctx->listen_sock, (struct sockaddr *)&addr, sizeof (addr)) < 0) {
+        perror("bind");
+        return ERROR;
+    }
+
+    mreq.imr_multiaddr.s_addr = inet_addr(STATISTICS_ADDRESS);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(ctx->listen_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof (mreq)) < 0) {
+        perror("setsockopt");
+        return ERROR;
+    }
+
+    stats_sample(ctx, ctx->nlsock, ctx->class_caches, ctx->qdisc_cache, ctx->peers);
+
+    return SUCCESS;
+}
+
+// sample the tc counters of all peers and send them to the other
+// meteor instances; called every interval_ms
+void
+stats_send(struct stats_context *ctx)
+{
+    int local_i;
+    int32_t id;
+    float interval, utilization;
+    struct stats_peer_state *cur = ctx->cur, *prev;
+    struct bin_rec_cls *rec;
+    struct meteor_config *meteor_conf = ctx->meteor_conf;
+
+    interval = ctx->interval_ms / 1000.0;
+    if (stats_sample(ctx, ctx->nlsock, ctx->class_caches, ctx->qdisc_cache, cur) != SUCCESS) {
+        WARNING("[%s] Cannot sample tc statistics", __func__);
+        return;
+    }
+
+    for (local_i = 0; local_i < meteor_conf->local_cnt; local_i++) {
+        utilization = 0.0;
+        for (id = 0; id < meteor_conf->node_cnt; id++) {
+            prev = &ctx->peers[local_i * meteor_conf->node_cnt + id];
+            rec = NULL;
+            if (meteor_conf->cur_recs) {
+                rec = &meteor_conf->cur_recs[local_i * meteor_conf->cur_recs_stride + id];
+            }
+            if (rec && cur[local_i * meteor_conf->node_cnt + id].packets >= prev->packets) {
+                cur[local_i * meteor_conf->node_cnt + id].channel_utilization =
+                    compute_channel_utilization(rec,
+                            cur[local_i * meteor_conf->node_cnt + id].packets - prev->packets,
+                            cur[local_i * meteor_conf->node_cnt + id].bytes - prev->bytes,
+                            interval);
+                utilization += cur[local_i * meteor_conf->node_cnt + id].channel_utilization;
+            }
+        }
+        if (utilization > 1.0) {
+            utilization = 1.0;
+        }
+        memcpy(&ctx->peers[local_i * meteor_conf->node_cnt], &cur[local_i * meteor_conf->node_cnt],
+                sizeof (struct stats_peer_state) * meteor_conf->node_cnt);
+        stats_publish(ctx, ctx->send_sock, &ctx->group, local_i, ctx->seq, utilization);
+    }
+    ctx->seq++;
+}
+
+// take in all snapshots of other meteor instances received so far;
+// called when listen_sock is readable
+void
+stats_receive(struct stats_context *ctx)
+{
+    ssize_t size;
+    uint16_t node_id;
+    char dgram[STATISTICS_DGRAM_SIZE];
+    struct stats_snapshot_hdr *hdr = (struct stats_snapshot_hdr *)dgram;
+    struct meteor_config *meteor_conf = ctx->meteor_conf;
+
+    while ((size = recv(ctx->listen_sock, dgram, sizeof (dgram), 0)) >= 0 || errno == EINTR) {
+        if (size < (ssize_t)sizeof (struct stats_snapshot_hdr)) {
+            continue;
+        }
+        if (ntohl(hdr->magic) != STATISTICS_MAGIC || ntohs(hdr->version) != STATISTICS_VERSION) {
+            continue;
+        }
+
+        // only the first datagram of a snapshot is needed for the totals
+        node_id = ntohs(hdr->node_id);
+        if (node_id >= ctx->remote_cnt || ntohs(hdr->peer_offset) != 0) {
+            continue;
+        }
+        ctx->remote[node_id].channel_utilization = ntohl(hdr->channel_utilization) / 1e6;
+
+        if (meteor_conf->verbose >= 2) {
+            fprintf(meteor_conf->logfd, "Node %u: channel utilization %.4f (seq %u)\n",
+                    node_id, ctx->remote[node_id].channel_utilization, ntohl(hdr->seq));
+        }
+    }
+}
@@ -51,6 +51,9 @@ sta_association_timeout_routine (void *arg)
   double next_time_increment =
     ((double) (station->beacon_interval / 1e3) * ASSOCIATION_TIMEOUT_COUNT);
 
+  // beacon counter at the previous timeout check
+  uint32_t beacon_snapshot = 0;
+
   /////////////////////////////////////////////////////
   // start execution
 
@@ -73,43 +76,24 @@ sta_association_timeout_routine (void *arg)
       timer_wait (&timer, next_time);
 
 
-      // NOTE: could use pthread_cond_wait to prevent loops here
-      // when a node is not associated, and use pthread_cond_signal to 
-      // resume looping when a node becomes associated
-
-      // lock mutex
-      pthread_mutex_lock (&(station->association_mutex));
-
-      if (station->beacon_count < REQUIRED_BEACON_COUNT)
+      // the listen thread keeps counting beacons meanwhile; a beacon
+      // counted during the check makes the drop fail and the
+      // association continue
+      if (sta_state_timeout (station, &beacon_snapshot) == TRUE)
 	{
-	  if (station->is_associated == TRUE)
-	    {
-	      DEBUG ("Station '%u': received beacon count (%u) in the \
-interval %.2f-%.2f is less than the required threshold (%u) => considering \
-that association has been dropped.", station->id, station->beacon_count, next_time - next_time_increment, next_time, REQUIRED_BEACON_COUNT);
+	  DEBUG ("Station '%u': received beacon count in the interval \
+%.2f-%.2f is less than the required threshold (%u) => considering that \
+association has been dropped.", station->id, next_time - next_time_increment, next_time, REQUIRED_BEACON_COUNT);
 
-	      station->is_associated = FALSE;
-	      station->last_association_request_time = -MAX_DOUBLE;
-	      station->last_disassociation_time = next_time;
+	  station->last_disassociation_time = next_time;
 
-	      INFO ("Station '%u': association with AP '%s' dropped \
+	  INFO ("Station '%u': association with AP '%s' dropped \
 (time=%.2f).", station->id, inet_ntoa (station->associated_ip_address), next_time);
-	    }
-	  else
-	    DEBUG ("Station '%u': received beacon count (%u) in the \
-interval %.2f-%.2f is less than the required threshold (%u), but station is \
-not associated => doing nothing.", station->id, station->beacon_count, next_time - next_time_increment, next_time, REQUIRED_BEACON_COUNT);
 	}
       else
-	DEBUG ("Station '%u': received beacon count (%u) in the \
-interval %.2f-%.2f is larger or equal to the required threshold (%u) => \
-considering that association continues.", station->id, station->beacon_count, next_time - next_time_increment, next_time, REQUIRED_BEACON_COUNT);
-
-      // reset beacon counter
-      station->beacon_count = 0;
-
-      // unlock mutex
-      pthread_mutex_unlock (&(station->association_mutex));
+	DEBUG ("Station '%u': not associated, or received beacon count \
+(%u in total) in the interval %.2f-%.2f is larger or equal to the required \
+threshold (%u) => doing nothing.", station->id, beacon_snapshot, next_time - next_time_increment, next_time, REQUIRED_BEACON_COUNT);
     }
 
   // association timeout thread finished execution
@@ -328,6 +312,9 @@ sta_listen_message_routine (void *arg)
 
   int sockopt_val;
 
+  // result of accounting for a beacon
+  int beacon_state;
+
   double next_time = 0.0;
 
 
@@ -508,23 +495,20 @@ from AP '%s'.", station->id, message.timestamp, inet_ntoa (message.src_addr));
 		  // "refresh" beacon info by updating time
 		  //station->last_beacon_time = message.timestamp;
 
-		  // lock mutex
-		  pthread_mutex_lock (&(station->association_mutex));
+		  // count the beacon if received from the AP with which
+		  // we are associated
+		  beacon_state = sta_state_beacon (station, message.src_addr);
+
+		  // after a drop, associate again without waiting for
+		  // the request timeout
+		  if (beacon_state == STA_BEACON_DROPPED)
+		    station->last_association_request_time = -MAX_DOUBLE;
 
-		  // should test inside mutex?!
-		  if (station->is_associated == TRUE)
+		  if (beacon_state == STA_BEACON_COUNTED
+		      || beacon_state == STA_BEACON_IGNORED)
 		    {
 		      DEBUG ("Station '%u': already associated => \
 ignoring beacon.", station->id);
-
-		      // increment number of beacons if received from AP
-		      // with which we are associated
-		      if (station->associated_ip_address.s_addr ==
-			  message.src_addr.s_addr)
-			station->beacon_count++;
-
-		      // unlock mutex
-		      pthread_mutex_unlock (&(station->association_mutex));
 		    }
 		  else
 		    {
@@ -533,10 +517,6 @@ ignoring beacon.", station->id);
 			   - station->last_association_request_time)
 			  < ASSOCIATION_REQUEST_TIMEOUT)
 			{
-			  // unlock mutex
-			  pthread_mutex_unlock (&
-						(station->association_mutex));
-
 			  DEBUG ("Station '%u': has started \
 association with AP '%s' at time=%.2f => ignoring beacon.", station->id, inet_ntoa (message.src_addr), station->last_association_request_time);
 			}
@@ -547,11 +527,6 @@ sending association request to AP '%s'", station->id, inet_ntoa (message.src_add
 			  station->last_association_request_time
 			    = message.timestamp;
 
-			  // unlock mutex
-			  pthread_mutex_unlock (&
-						(station->association_mutex));
-
-
 
 			  message.type = ASSOCIATION_REQUEST;
 			  // copy AP address from source field to destination
@@ -656,17 +631,9 @@ from station '%s' => ignoring message because AP.", station->id, inet_ntoa (mess
 		  DEBUG ("Station '%u': received association response \
 from station '%s' => doing local configuration.", station->id, inet_ntoa (message.src_addr));
 
-		  // lock mutex
-		  pthread_mutex_lock (&(station->association_mutex));
-
-		  station->is_associated = TRUE;
-
-		  // unlock mutex
-		  pthread_mutex_unlock (&(station->association_mutex));
-
 		  // update local information
-		  station->associated_ip_address = message.src_addr;
 		  station->last_association_response_time = message.timestamp;
+		  sta_state_associate (station, message.src_addr);
 		  INFO ("Station '%u': associated with AP '%s' (time=%.2f).",
 			station->id,
 			inet_ntoa (station->associated_ip_address),
@@ -709,12 +676,10 @@ sta_init (struct station_class *station, int is_access_point,
   station->id = id;
   station->ip_address = ip_addresses[id];
   station->beacon_interval = beacon_interval;
-  station->beacon_count = 0;
-  station->is_associated = FALSE;
+  station->association_state = 0;
   station->do_interrupt = FALSE;
   //set to large "negative" time
   station->last_association_request_time = -MAX_DOUBLE;
-  pthread_mutex_init (&station->association_mutex, NULL);
 
   if (station->is_access_point == TRUE)
     {
@@ -809,8 +774,6 @@ not AP...", station->id);
       return ERROR;
     }
 
-  pthread_mutex_destroy (&station->association_mutex);
-
   return SUCCESS;
 }
 
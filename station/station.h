@@ -26,6 +26,7 @@
 #define	__STATION_H
 
 
+#include <stdint.h>
 #include <arpa/inet.h>
 #include <pthread.h>
 
@@ -63,6 +64,30 @@
 // timeout for association request in s
 #define ASSOCIATION_REQUEST_TIMEOUT      1
 
+/////////////////////////////////////////////
+// Association state constants
+/////////////////////////////////////////////
+
+// The association state of a regular station is packed in one 64-bit
+// word that the listen and association timeout threads update with
+// compare-and-swap instead of a mutex: the low bits are STA_STATE_*
+// flags, and the high 32 bits count the beacons received from the
+// associated AP; the counter never resets, and the timeout thread
+// compares it with its snapshot of the previous check
+
+// set while associated with an AP
+#define STA_STATE_ASSOCIATED             0x1ULL
+// set by the timeout thread when it drops an association, until the
+// listen thread sees it
+#define STA_STATE_DROPPED                0x2ULL
+#define STA_STATE_BEACON_SHIFT           32
+
+// results of sta_state_beacon
+#define STA_BEACON_COUNTED               0
+#define STA_BEACON_IGNORED               1
+#define STA_BEACON_UNASSOCIATED          2
+#define STA_BEACON_DROPPED               3
+
 struct station_class
 {
   // flag indicating whether the current station is access point or not
@@ -81,13 +106,10 @@ struct station_class
   // default value use in real devices is 100
   unsigned beacon_interval;
 
-  // beacon count during a predefined interval
-  // equal to beacon_interval * ASSOCIATION_TIMEOUT_COUNT
-  unsigned beacon_count;
-
-  // flag indicating whether the current station is associated to an AP or not
-  // (for regular stations only)
-  int is_associated;
+  // association flags and beacon counter, see STA_STATE_* above
+  // (for regular stations only); only access it through the
+  // sta_state_* functions
+  uint64_t association_state;
 
   // flag indicating that execution is to be interrupted
   int do_interrupt;
@@ -100,8 +122,6 @@ struct station_class
   // listen message thread structure (for regular stations only)
   pthread_t sta_listen_message_thread;
 
-  pthread_mutex_t association_mutex;
-
   // time when the last association request was sent (for regular stations only)
   float last_association_request_time;
 
@@ -143,5 +163,30 @@ void sta_print (struct station_class *station);
 
 void message_print (struct message_class *message);
 
+// return TRUE if the station is associated with an AP, FALSE otherwise
+int sta_state_is_associated (struct station_class *station);
+
+// return the number of beacons received from associated APs so far
+uint32_t sta_state_beacon_count (struct station_class *station);
+
+// account for a beacon from 'ap_address'; return STA_BEACON_COUNTED if
+// it comes from the associated AP, STA_BEACON_IGNORED if from another
+// AP while associated, STA_BEACON_UNASSOCIATED if not associated, or
+// STA_BEACON_DROPPED if not associated because the timeout thread
+// dropped the association since the previous beacon
+int sta_state_beacon (struct station_class *station,
+		      struct in_addr ap_address);
+
+// mark the station as associated with the AP at 'ap_address'; only
+// called by the thread that receives messages
+void sta_state_associate (struct station_class *station,
+			  struct in_addr ap_address);
+
+// drop the association if fewer than REQUIRED_BEACON_COUNT beacons
+// were counted since '*beacon_snapshot', which is updated; return TRUE
+// if the association was dropped, FALSE otherwise
+int sta_state_timeout (struct station_class *station,
+		       uint32_t * beacon_snapshot);
+
 
 #endif
@@ -0,0 +1,637 @@
+/*
+ * Copyright (c) 2006-2013 The StarBED Project  All rights reserved.
+ *
+ * See the file 'LICENSE' for licensing information.
+ *
+ */
+
+/************************************************************************
+ *
+ * QOMET Emulator Implementation
+ *
+ * File name: station_engine.c
+ * Function: Event-driven engine running many stations in one thread
+ *
+ ***********************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+
+#include "station.h"
+#include "station_global.h"
+#include "station_message.h"
+#include "station_engine.h"
+
+
+/////////////////////////////////////////////
+// Internal functions
+/////////////////////////////////////////////
+
+// TIMER_TYPE time in ns of engine time 'seconds'
+static uint64_t
+engine_time_ns (struct sta_engine *engine, double seconds)
+{
+  return engine->zero_ns + (uint64_t) (seconds * 1e9);
+}
+
+// slot of an IP address in the address index
+static unsigned
+address_slot (struct sta_engine *engine, struct in_addr address)
+{
+  return (address.s_addr * 2654435761U) & engine->address_mask;
+}
+
+// return the station with IP address 'address', or NULL
+static struct sta_engine_station *
+find_station (struct sta_engine *engine, struct in_addr address)
+{
+  unsigned slot = address_slot (engine, address);
+  unsigned index;
+
+  while ((index = engine->address_index[slot]) != 0)
+    {
+      if (engine->stations[index - 1].station.ip_address.s_addr
+	  == address.s_addr)
+	return &engine->stations[index - 1];
+      slot = (slot + 1) & engine->address_mask;
+    }
+
+  return NULL;
+}
+
+// send the queued messages with as few sendmmsg calls as possible;
+// return SUCCESS or ERROR
+static int
+engine_flush (struct sta_engine *engine)
+{
+  unsigned sent = 0;
+  int ret = 0;
+
+  while (sent < engine->out_count)
+    {
+      ret = sendmmsg (engine->bcast_out_socket_id, &engine->out_msgs[sent],
+		      engine->out_count - sent, 0);
+      engine->send_calls++;
+      if (ret < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  WARNING ("Cannot send %u messages to socket",
+		   engine->out_count - sent);
+	  perror ("sendmmsg");
+	  break;
+	}
+      sent += ret;
+    }
+
+  engine->sent_count += sent;
+  engine->out_count = 0;
+
+  return (ret < 0) ? ERROR : SUCCESS;
+}
+
+// queue a message for the shared outbound socket; it is sent at the
+// latest when the engine goes back to waiting; return SUCCESS or ERROR
+static int
+engine_send (struct sta_engine *engine, struct station_class *station,
+	     struct message_class *message)
+{
+#ifdef MESSAGE_DEBUG
+
+  message_print (message);
+
+#endif
+
+  engine->out_messages[engine->out_count++] = *message;
+  if (engine->out_count == STA_ENGINE_BATCH)
+    return engine_flush (engine);
+
+  return SUCCESS;
+}
+
+// beacon event of an AP station
+static void
+engine_beacon (struct timer_wheel_event *event, void *arg)
+{
+  struct sta_engine_station *engine_station =
+    (struct sta_engine_station *) arg;
+  struct station_class *station = &engine_station->station;
+  struct sta_engine *engine = engine_station->engine;
+  struct message_class message;
+
+  message.type = BEACON;
+  memset (&message.dst_addr, 0xFF, sizeof (message.dst_addr));
+  message.src_addr = station->ip_address;
+  memset (message.bssid, 0, sizeof (message.bssid));
+  message.bssid[0] = 1;
+  message.timestamp = engine_station->next_time;
+
+  engine_send (engine, station, &message);
+  DEBUG ("Station '%u': sent beacon at time=%.2f.", station->id,
+	 engine_station->next_time);
+
+  engine_station->next_time += (double) station->beacon_interval / 1e3;
+  timer_wheel_add (engine->wheel, event,
+		   engine_time_ns (engine, engine_station->next_time));
+}
+
+// association timeout event of a regular station
+static void
+engine_association_timeout (struct timer_wheel_event *event, void *arg)
+{
+  struct sta_engine_station *engine_station =
+    (struct sta_engine_station *) arg;
+  struct station_class *station = &engine_station->station;
+  struct sta_engine *engine = engine_station->engine;
+
+  if (sta_state_timeout (station, &engine_station->beacon_snapshot) == TRUE)
+    {
+      station->last_disassociation_time = engine_station->next_time;
+
+      INFO ("Station '%u': association with AP '%s' dropped (time=%.2f).",
+	    station->id, inet_ntoa (station->associated_ip_address),
+	    engine_station->next_time);
+    }
+
+  engine_station->next_time += ((double) station->beacon_interval / 1e3)
+    * ASSOCIATION_TIMEOUT_COUNT;
+  timer_wheel_add (engine->wheel, event,
+		   engine_time_ns (engine, engine_station->next_time));
+}
+
+// deliver a beacon to a regular station
+static void
+engine_receive_beacon (struct sta_engine *engine,
+		       struct sta_engine_station *engine_station,
+		       struct message_class *beacon)
+{
+  struct station_class *station = &engine_station->station;
+  struct message_class message;
+  int beacon_state;
+
+  // count beacons from the AP with which we are associated
+  beacon_state = sta_state_beacon (station, beacon->src_addr);
+  if (beacon_state == STA_BEACON_COUNTED
+      || beacon_state == STA_BEACON_IGNORED)
+    return;
+
+  // after a drop, associate again without waiting for the request
+  // timeout
+  if (beacon_state == STA_BEACON_DROPPED)
+    station->last_association_request_time = -MAX_DOUBLE;
+
+  // check whether we are during an association process
+  if ((beacon->timestamp - station->last_association_request_time)
+      < ASSOCIATION_REQUEST_TIMEOUT)
+    return;
+
+  DEBUG ("Station '%u': not associated => sending association request \
+to AP '%s'", station->id, inet_ntoa (beacon->src_addr));
+  station->last_association_request_time = beacon->timestamp;
+
+  message = *beacon;
+  message.type = ASSOCIATION_REQUEST;
+  message.dst_addr = beacon->src_addr;
+  message.src_addr = station->ip_address;
+  engine_send (engine, station, &message);
+}
+
+// handle a message received on the shared inbound socket
+static void
+engine_receive (struct sta_engine *engine, struct message_class *message)
+{
+  struct sta_engine_station *engine_station;
+  struct station_class *station;
+  unsigned regular_i;
+
+  switch (message->type)
+    {
+    case BEACON:
+      // every regular station hears every AP
+      for (regular_i = 0; regular_i < engine->regular_count; regular_i++)
+	engine_receive_beacon (engine,
+			       &engine->stations[engine->regular_stations
+						 [regular_i]], message);
+      break;
+
+    case ASSOCIATION_REQUEST:
+      engine_station = find_station (engine, message->dst_addr);
+      if (engine_station == NULL
+	  || engine_station->station.is_access_point != TRUE)
+	break;
+      station = &engine_station->station;
+
+      DEBUG ("Station '%u': received association request from station \
+'%s' => sending association response.", station->id, inet_ntoa (message->src_addr));
+      message->type = ASSOCIATION_RESPONSE;
+      message->dst_addr = message->src_addr;
+      message->src_addr = station->ip_address;
+      engine_send (engine, station, message);
+      break;
+
+    case ASSOCIATION_RESPONSE:
+      engine_station = find_station (engine, message->dst_addr);
+      if (engine_station == NULL
+	  || engine_station->station.is_access_point == TRUE)
+	break;
+      station = &engine_station->station;
+
+      station->last_association_response_time = message->timestamp;
+      sta_state_associate (station, message->src_addr);
+      INFO ("Station '%u': associated with AP '%s' (time=%.2f).",
+	    station->id, inet_ntoa (station->associated_ip_address),
+	    station->last_association_response_time);
+      break;
+
+    case DISASSOCIATION:
+      break;
+
+    default:
+      WARNING ("Received unknown message (type=%u)", message->type);
+    }
+}
+
+// drain the shared inbound socket, STA_ENGINE_BATCH messages per call
+static void
+engine_receive_all (struct sta_engine *engine)
+{
+  int message_count, message_i;
+
+  do
+    {
+      message_count = recvmmsg (engine->bcast_in_socket_id,
+				engine->in_msgs, STA_ENGINE_BATCH,
+				MSG_DONTWAIT, NULL);
+      engine->receive_calls++;
+      if (message_count < 0)
+	{
+	  if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+	    perror ("recvmmsg");
+	  return;
+	}
+
+      for (message_i = 0; message_i < message_count; message_i++)
+	{
+	  if (engine->in_msgs[message_i].msg_len
+	      != sizeof (struct message_class))
+	    {
+	      WARNING ("Failed to receive entire message from socket");
+	      continue;
+	    }
+	  engine->received_count++;
+	  engine_receive (engine, &engine->in_messages[message_i]);
+	}
+    }
+  while (message_count == STA_ENGINE_BATCH);
+}
+
+// arm the timerfd for the next tick of the wheel with work
+static int
+engine_arm_timer (struct sta_engine *engine)
+{
+  uint64_t next_ns = timer_wheel_next_ns (engine->wheel);
+
+  if (next_ns == UINT64_MAX)
+    return timer_disarm_fd (&engine->timer);
+
+  return timer_arm_fd (&engine->timer,
+		       (double) (next_ns - engine->zero_ns) / 1e9);
+}
+
+// open the shared broadcast sockets, as the threads of station.c do
+static int
+engine_open_sockets (struct sta_engine *engine)
+{
+  struct sockaddr_in bcast_in_socket_addr;
+  int sockopt_val = 1;
+
+  if ((engine->bcast_out_socket_id = socket (PF_INET, SOCK_DGRAM, 0)) == -1)
+    {
+      WARNING ("Could not open BCAST outbound socket of station engine");
+      perror ("socket");
+      return ERROR;
+    }
+  if (setsockopt (engine->bcast_out_socket_id, SOL_SOCKET, SO_BROADCAST,
+		  &sockopt_val, sizeof (sockopt_val)) < 0)
+    {
+      WARNING ("Error when setting socket option SO_BROADCAST");
+      perror ("setsockopt");
+      return ERROR;
+    }
+  memset (&engine->bcast_out_socket_addr, 0,
+	  sizeof (engine->bcast_out_socket_addr));
+  engine->bcast_out_socket_addr.sin_family = AF_INET;
+  inet_pton (AF_INET, BEACONS_ADDRESS,
+	     &engine->bcast_out_socket_addr.sin_addr);
+  engine->bcast_out_socket_addr.sin_port = htons (BEACONS_PORT);
+
+  if ((engine->bcast_in_socket_id = socket (PF_INET, SOCK_DGRAM, 0)) == -1)
+    {
+      WARNING ("Could not create BCAST inbound socket of station engine");
+      perror ("socket");
+      return ERROR;
+    }
+  if (setsockopt (engine->bcast_in_socket_id, SOL_SOCKET, SO_REUSEADDR,
+		  &sockopt_val, sizeof (sockopt_val)) < 0)
+    {
+      WARNING ("Error when setting socket option SO_REUSEADDR");
+      perror ("setsockopt");
+      return ERROR;
+    }
+  fcntl (engine->bcast_in_socket_id, F_SETFL, O_NONBLOCK);
+
+  // beyond net.core.rmem_max only with CAP_NET_ADMIN
+  sockopt_val = STA_ENGINE_RCVBUF;
+  if (setsockopt (engine->bcast_in_socket_id, SOL_SOCKET, SO_RCVBUFFORCE,
+		  &sockopt_val, sizeof (sockopt_val)) < 0)
+    setsockopt (engine->bcast_in_socket_id, SOL_SOCKET, SO_RCVBUF,
+		&sockopt_val, sizeof (sockopt_val));
+
+  memset (&bcast_in_socket_addr, 0, sizeof (bcast_in_socket_addr));
+  bcast_in_socket_addr.sin_family = AF_INET;
+  inet_pton (AF_INET, BEACONS_ADDRESS, &bcast_in_socket_addr.sin_addr);
+  bcast_in_socket_addr.sin_port = htons (BEACONS_PORT);
+  if (bind (engine->bcast_in_socket_id,
+	    (struct sockaddr *) &bcast_in_socket_addr,
+	    sizeof (bcast_in_socket_addr)) == -1)
+    {
+      WARNING ("Could not bind BCAST inbound socket of station engine");
+      perror ("bind");
+      return ERROR;
+    }
+
+  return SUCCESS;
+}
+
+
+/////////////////////////////////////////////
+// Functions implemented by the station engine
+/////////////////////////////////////////////
+
+// create an engine for up to 'station_max' stations, and open its
+// sockets; return NULL on error
+struct sta_engine *
+sta_engine_create (unsigned station_max)
+{
+  struct sta_engine *engine;
+  struct epoll_event event;
+  unsigned index_size = 2;
+  unsigned message_i;
+
+  engine = (struct sta_engine *) calloc (1, sizeof (struct sta_engine));
+  if (engine == NULL)
+    {
+      WARNING ("Cannot allocate memory for station engine");
+      return NULL;
+    }
+  engine->epoll_fd = -1;
+  engine->bcast_in_socket_id = -1;
+  engine->bcast_out_socket_id = -1;
+  engine->interrupt_fd = -1;
+  engine->timer.fd = -1;
+
+  // keep the address index at most half full
+  while (index_size < 2 * station_max)
+    index_size *= 2;
+  engine->station_max = station_max;
+  engine->address_mask = index_size - 1;
+  engine->stations = (struct sta_engine_station *)
+    calloc (station_max, sizeof (struct sta_engine_station));
+  engine->regular_stations = (unsigned *) calloc (station_max,
+						  sizeof (unsigned));
+  engine->address_index = (unsigned *) calloc (index_size,
+					       sizeof (unsigned));
+  if (engine->stations == NULL || engine->regular_stations == NULL
+      || engine->address_index == NULL)
+    {
+      WARNING ("Cannot allocate memory for %u stations", station_max);
+      sta_engine_destroy (engine);
+      return NULL;
+    }
+
+  if ((engine->wheel = timer_wheel_create (STA_ENGINE_TICK_NS)) == NULL
+      || engine_open_sockets (engine) == ERROR)
+    {
+      sta_engine_destroy (engine);
+      return NULL;
+    }
+
+  engine->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  engine->interrupt_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (engine->epoll_fd < 0 || engine->interrupt_fd < 0
+      || timer_open_fd (&engine->timer) < 0)
+    {
+      WARNING ("Cannot create the event sources of station engine");
+      sta_engine_destroy (engine);
+      return NULL;
+    }
+
+  // the message vectors point to fixed buffers once and for all
+  for (message_i = 0; message_i < STA_ENGINE_BATCH; message_i++)
+    {
+      engine->out_iov[message_i].iov_base = &engine->out_messages[message_i];
+      engine->out_iov[message_i].iov_len = sizeof (struct message_class);
+      engine->out_msgs[message_i].msg_hdr.msg_iov =
+	&engine->out_iov[message_i];
+      engine->out_msgs[message_i].msg_hdr.msg_iovlen = 1;
+      engine->out_msgs[message_i].msg_hdr.msg_name =
+	&engine->bcast_out_socket_addr;
+      engine->out_msgs[message_i].msg_hdr.msg_namelen =
+	sizeof (engine->bcast_out_socket_addr);
+
+      engine->in_iov[message_i].iov_base = &engine->in_messages[message_i];
+      engine->in_iov[message_i].iov_len = sizeof (struct message_class);
+      engine->in_msgs[message_i].msg_hdr.msg_iov = &engine->in_iov[message_i];
+      engine->in_msgs[message_i].msg_hdr.msg_iovlen = 1;
+    }
+
+  memset (&event, 0, sizeof (event));
+  event.events = EPOLLIN;
+  event.data.fd = engine->bcast_in_socket_id;
+  epoll_ctl (engine->epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event);
+  event.data.fd = engine->timer.fd;
+  epoll_ctl (engine->epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event);
+  event.data.fd = engine->interrupt_fd;
+  epoll_ctl (engine->epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event);
+
+  return engine;
+}
+
+// add a station to the engine, before sta_engine_run is called;
+// return SUCCESS or ERROR
+int
+sta_engine_add (struct sta_engine *engine, int is_access_point,
+		unsigned id, struct in_addr *ip_address,
+		unsigned beacon_interval)
+{
+  struct sta_engine_station *engine_station;
+  struct station_class *station;
+  unsigned slot;
+
+  if (engine->station_count >= engine->station_max)
+    {
+      WARNING ("Station engine is full (%u stations)", engine->station_max);
+      return ERROR;
+    }
+  if (find_station (engine, *ip_address) != NULL)
+    {
+      WARNING ("Station with IP address '%s' already exists",
+	       inet_ntoa (*ip_address));
+      return ERROR;
+    }
+
+  engine_station = &engine->stations[engine->station_count];
+  engine_station->engine = engine;
+
+  // same initial state as sta_init
+  station = &engine_station->station;
+  station->is_access_point = is_access_point;
+  station->id = id;
+  station->ip_address = *ip_address;
+  station->beacon_interval = beacon_interval;
+  station->association_state = 0;
+  station->do_interrupt = FALSE;
+  station->last_association_request_time = -MAX_DOUBLE;
+
+  if (is_access_point == TRUE)
+    {
+      // spread the first beacons of the APs over a beacon interval,
+      // as unsynchronized real APs would be
+      engine_station->next_time = (double) (id % beacon_interval) / 1e3;
+      timer_wheel_event_init (&engine_station->event, engine_beacon,
+			      engine_station);
+    }
+  else
+    {
+      engine_station->next_time = ((double) beacon_interval / 1e3)
+	* ASSOCIATION_TIMEOUT_COUNT;
+      timer_wheel_event_init (&engine_station->event,
+			      engine_association_timeout, engine_station);
+      engine->regular_stations[engine->regular_count++] =
+	engine->station_count;
+    }
+
+  slot = address_slot (engine, *ip_address);
+  while (engine->address_index[slot] != 0)
+    slot = (slot + 1) & engine->address_mask;
+  engine->address_index[slot] = ++engine->station_count;
+
+  return SUCCESS;
+}
+
+// run all stations until sta_engine_stop is called;
+// return SUCCESS or ERROR
+int
+sta_engine_run (struct sta_engine *engine)
+{
+  struct epoll_event events[3];
+  struct timespec zero_tp;
+  struct sta_engine_station *engine_station;
+  unsigned station_i;
+  uint64_t value;
+  int event_count, event_i;
+  int do_interrupt = FALSE;
+
+  // the engine time starts now for all stations
+  timer_reset (&engine->timer, 0.0);
+  zero_tp = engine->timer.zero_tp;
+  engine->zero_ns = (uint64_t) zero_tp.tv_sec * 1000000000ULL
+    + zero_tp.tv_nsec;
+  for (station_i = 0; station_i < engine->station_count; station_i++)
+    {
+      engine_station = &engine->stations[station_i];
+      timer_wheel_add (engine->wheel, &engine_station->event,
+		       engine_time_ns (engine, engine_station->next_time));
+    }
+
+  INFO ("Station engine started with %u stations (%u APs).",
+	engine->station_count, engine->station_count - engine->regular_count);
+
+  while (do_interrupt == FALSE)
+    {
+      if (engine_arm_timer (engine) != 0)
+	return ERROR;
+
+      event_count = epoll_wait (engine->epoll_fd, events, 3, -1);
+      if (event_count < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  perror ("epoll_wait");
+	  return ERROR;
+	}
+
+      for (event_i = 0; event_i < event_count; event_i++)
+	{
+	  if (events[event_i].data.fd == engine->bcast_in_socket_id)
+	    engine_receive_all (engine);
+	  else if (events[event_i].data.fd == engine->timer.fd)
+	    {
+	      timer_read_fd (&engine->timer);
+	      timer_wheel_advance (engine->wheel, timer_wheel_time_ns ());
+	    }
+	  else if (events[event_i].data.fd == engine->interrupt_fd)
+	    {
+	      if (read (engine->interrupt_fd, &value, sizeof (value)) > 0)
+		do_interrupt = TRUE;
+	    }
+	}
+
+      // everything the stations sent in this round leaves together
+      engine_flush (engine);
+    }
+
+  for (station_i = 0; station_i < engine->station_count; station_i++)
+    timer_wheel_cancel (engine->wheel, &engine->stations[station_i].event);
+
+  INFO ("Station engine finished execution (relative time=%.2f s, \
+%lu messages sent in %lu calls, %lu received in %lu calls).", timer_elapsed_time (&engine->timer), engine->sent_count, engine->send_calls, engine->received_count, engine->receive_calls);
+
+  return SUCCESS;
+}
+
+// make sta_engine_run return; may be called from another thread or
+// from a signal handler
+void
+sta_engine_stop (struct sta_engine *engine)
+{
+  uint64_t value = 1;
+
+  if (write (engine->interrupt_fd, &value, sizeof (value)) < 0)
+    perror ("write");
+}
+
+// close the sockets of the engine and free it
+void
+sta_engine_destroy (struct sta_engine *engine)
+{
+  if (engine == NULL)
+    return;
+
+  if (engine->timer.fd >= 0)
+    timer_close_fd (&engine->timer);
+  if (engine->interrupt_fd >= 0)
+    close (engine->interrupt_fd);
+  if (engine->epoll_fd >= 0)
+    close (engine->epoll_fd);
+  if (engine->bcast_in_socket_id >= 0)
+    close (engine->bcast_in_socket_id);
+  if (engine->bcast_out_socket_id >= 0)
+    close (engine->bcast_out_socket_id);
+  timer_wheel_destroy (engine->wheel);
+
+  free (engine->address_index);
+  free (engine->regular_stations);
+  free (engine->stations);
+  free (engine);
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2006-2013 The StarBED Project  All rights reserved.
+ *
+ * See the file 'LICENSE' for licensing information.
+ *
+ */
+
+/************************************************************************
+ *
+ * QOMET Emulator Implementation
+ *
+ * File name: station_engine.h
+ * Function: Header file of the event-driven station engine
+ *
+ ***********************************************************************/
+
+
+#ifndef	__STATION_ENGINE_H
+#define	__STATION_ENGINE_H
+
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "station.h"
+#include "timer.h"
+#include "timer_wheel.h"
+
+
+/////////////////////////////////////////////
+// Basic constants
+/////////////////////////////////////////////
+
+// tick of the engine timing wheel in ns
+#define STA_ENGINE_TICK_NS     1000000
+
+// receive buffer of the shared inbound socket in bytes; a beacon makes
+// every unassociated station answer at once
+#define STA_ENGINE_RCVBUF      (16 * 1024 * 1024)
+
+// messages per sendmmsg and recvmmsg call
+#define STA_ENGINE_BATCH       256
+
+
+/////////////////////////////////////////////
+// Structures of the station engine
+/////////////////////////////////////////////
+
+// The station engine runs the state machines of any number of AP and
+// regular stations in the thread that calls sta_engine_run. All
+// stations share one inbound and one outbound broadcast socket, which
+// are used with recvmmsg and sendmmsg so that e.g. all beacons due in
+// the same tick leave in one system call, and
+// their beacons and association timeouts are events of one timing
+// wheel, which is driven by a single timerfd; the wire format of the
+// messages is that of the thread-based stations, so both kinds of
+// stations can be mixed. Unlike those, the engine delivers association
+// requests and responses only to the station they are addressed to.
+
+struct sta_engine;
+
+// a station run by the engine
+struct sta_engine_station
+{
+  // association state, as for thread-based stations; the thread and
+  // mutex fields are not used
+  struct station_class station;
+
+  // beacon event (for AP stations) or association timeout event (for
+  // regular stations)
+  struct timer_wheel_event event;
+
+  // engine time of the next beacon or timeout check in s
+  double next_time;
+
+  // beacon counter at the previous timeout check
+  uint32_t beacon_snapshot;
+
+  struct sta_engine *engine;
+};
+
+// structure for the station engine
+struct sta_engine
+{
+  // stations, and the indices of the regular stations among them
+  struct sta_engine_station *stations;
+  unsigned station_count;
+  unsigned station_max;
+  unsigned *regular_stations;
+  unsigned regular_count;
+
+  // open-addressing index from IP address to station index + 1
+  unsigned *address_index;
+  unsigned address_mask;
+
+  // epoll instance, shared sockets, and eventfd used to interrupt
+  // sta_engine_run
+  int epoll_fd;
+  int bcast_in_socket_id;
+  int bcast_out_socket_id;
+  struct sockaddr_in bcast_out_socket_addr;
+  int interrupt_fd;
+
+  // common timer: its timerfd is armed for the next tick of the wheel
+  // with work; engine times are relative to its "zero"
+  struct timer_handle timer;
+  uint64_t zero_ns;
+  struct timer_wheel *wheel;
+
+  // messages queued for the next sendmmsg call, and the receive
+  // buffers of recvmmsg
+  struct message_class out_messages[STA_ENGINE_BATCH];
+  struct iovec out_iov[STA_ENGINE_BATCH];
+  struct mmsghdr out_msgs[STA_ENGINE_BATCH];
+  unsigned out_count;
+  struct message_class in_messages[STA_ENGINE_BATCH];
+  struct iovec in_iov[STA_ENGINE_BATCH];
+  struct mmsghdr in_msgs[STA_ENGINE_BATCH];
+
+  // messages sent and received, and the system calls used for them
+  unsigned long sent_count;
+  unsigned long received_count;
+  unsigned long send_calls;
+  unsigned long receive_calls;
+};
+
+
+/////////////////////////////////////////////
+// Functions implemented by the station engine
+/////////////////////////////////////////////
+
+// create an engine for up to 'station_max' stations, and open its
+// sockets; return NULL on error
+struct sta_engine *sta_engine_create (unsigned station_max);
+
+// add a station to the engine, before sta_engine_run is called;
+// return SUCCESS or ERROR
+int sta_engine_add (struct sta_engine *engine, int is_access_point,
+		    unsigned id, struct in_addr *ip_address,
+		    unsigned beacon_interval);
+
+// run all stations until sta_engine_stop is called;
+// return SUCCESS or ERROR
+int sta_engine_run (struct sta_engine *engine);
+
+// make sta_engine_run return; may be called from another thread or
+// from a signal handler
+void sta_engine_stop (struct sta_engine *engine);
+
+// close the sockets of the engine and free it
+void sta_engine_destroy (struct sta_engine *engine);
+
+#endif
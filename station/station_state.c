@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2006-2013 The StarBED Project  All rights reserved.
+ *
+ * See the file 'LICENSE' for licensing information.
+ *
+ */
+
+/************************************************************************
+ *
+ * QOMET Emulator Implementation
+ *
+ * File name: station_state.c
+ * Function: Lock-free association state of regular stations
+ *
+ ***********************************************************************/
+
+
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "station.h"
+#include "station_global.h"
+#include "station_message.h"
+
+
+// every change of the state word is a compare-and-swap of the whole
+// word, so a beacon can never be counted for an association that the
+// timeout thread has just dropped, and a drop never loses a beacon
+// that arrived after the check started
+#define STATE_LOAD(station) \
+  __atomic_load_n (&(station)->association_state, __ATOMIC_ACQUIRE)
+#define STATE_CAS(station, expected, desired)                         \
+  __atomic_compare_exchange_n (&(station)->association_state,         \
+			       (expected), (desired), TRUE,            \
+			       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+// return TRUE if the station is associated with an AP, FALSE otherwise
+int
+sta_state_is_associated (struct station_class *station)
+{
+  return (STATE_LOAD (station) & STA_STATE_ASSOCIATED) ? TRUE : FALSE;
+}
+
+// return the number of beacons received from associated APs so far
+uint32_t
+sta_state_beacon_count (struct station_class *station)
+{
+  return (uint32_t) (STATE_LOAD (station) >> STA_STATE_BEACON_SHIFT);
+}
+
+// account for a beacon from 'ap_address'; return STA_BEACON_COUNTED if
+// it comes from the associated AP, STA_BEACON_IGNORED if from another
+// AP while associated, STA_BEACON_UNASSOCIATED if not associated, or
+// STA_BEACON_DROPPED if not associated because the timeout thread
+// dropped the association since the previous beacon
+int
+sta_state_beacon (struct station_class *station, struct in_addr ap_address)
+{
+  uint64_t state = STATE_LOAD (station);
+
+  do
+    {
+      if (!(state & STA_STATE_ASSOCIATED))
+	{
+	  if (!(state & STA_STATE_DROPPED))
+	    return STA_BEACON_UNASSOCIATED;
+	  if (STATE_CAS (station, &state, state & ~STA_STATE_DROPPED))
+	    return STA_BEACON_DROPPED;
+	  continue;
+	}
+
+      // the address is written before the association is published
+      if (station->associated_ip_address.s_addr != ap_address.s_addr)
+	return STA_BEACON_IGNORED;
+    }
+  while (!STATE_CAS (station, &state,
+		     state + (1ULL << STA_STATE_BEACON_SHIFT)));
+
+  return STA_BEACON_COUNTED;
+}
+
+// mark the station as associated with the AP at 'ap_address'; only
+// called by the thread that receives messages
+void
+sta_state_associate (struct station_class *station, struct in_addr ap_address)
+{
+  uint64_t state = STATE_LOAD (station);
+
+  station->associated_ip_address = ap_address;
+  while (!STATE_CAS (station, &state,
+		     (state | STA_STATE_ASSOCIATED) & ~STA_STATE_DROPPED))
+    ;
+}
+
+// drop the association if fewer than REQUIRED_BEACON_COUNT beacons
+// were counted since '*beacon_snapshot', which is updated; return TRUE
+// if the association was dropped, FALSE otherwise
+int
+sta_state_timeout (struct station_class *station, uint32_t * beacon_snapshot)
+{
+  uint64_t state = STATE_LOAD (station);
+  uint32_t beacon_count;
+
+  do
+    {
+      beacon_count = (uint32_t) (state >> STA_STATE_BEACON_SHIFT);
+      if (!(state & STA_STATE_ASSOCIATED)
+	  || beacon_count - *beacon_snapshot >= REQUIRED_BEACON_COUNT)
+	{
+	  *beacon_snapshot = beacon_count;
+	  return FALSE;
+	}
+    }
+  while (!STATE_CAS (station, &state,
+		     (state & ~STA_STATE_ASSOCIATED) | STA_STATE_DROPPED));
+
+  *beacon_snapshot = beacon_count;
+
+  return TRUE;
+}
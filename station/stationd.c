@@ -27,10 +27,12 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <math.h>
+#include <signal.h>
 
 #include "station.h"
 #include "station_global.h"
 #include "station_message.h"
+#include "station_engine.h"
 
 //unsigned ID_AP=0;
 //unsigned ID_REGULAR=1;
@@ -40,6 +42,53 @@
 //float EXPECTED_ASSOCIATION_TIME = 0.10;
 //float EXPECTED_DISASSOCIATION_TIME = 3.20;
 
+// engine of the ENGINE mode, stopped by signals
+static struct sta_engine *engine = NULL;
+
+static void
+stop_engine (int signal_number)
+{
+  sta_engine_stop (engine);
+}
+
+// run 'ap_count' AP and 'sta_count' regular stations in one engine;
+// consecutive IP addresses starting at 'first_ip' are given to the APs
+// first, then to the regular stations
+static int
+run_engine (unsigned ap_count, unsigned sta_count, struct in_addr first_ip,
+	    unsigned execution_duration)
+{
+  struct in_addr station_ip;
+  unsigned station_i;
+  int result;
+
+  if ((engine = sta_engine_create (ap_count + sta_count)) == NULL)
+    return ERROR;
+
+  for (station_i = 0; station_i < ap_count + sta_count; station_i++)
+    {
+      station_ip.s_addr = htonl (ntohl (first_ip.s_addr) + station_i);
+      if (sta_engine_add (engine, station_i < ap_count, station_i,
+			  &station_ip, BEACON_INTERVAL) == ERROR)
+	{
+	  sta_engine_destroy (engine);
+	  return ERROR;
+	}
+    }
+
+  signal (SIGINT, stop_engine);
+  signal (SIGTERM, stop_engine);
+  signal (SIGALRM, stop_engine);
+  alarm (execution_duration);
+
+  INFO ("Executing %u APs and %u regular stations for %u s...",
+	ap_count, sta_count, execution_duration);
+  result = sta_engine_run (engine);
+  sta_engine_destroy (engine);
+
+  return result;
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -55,14 +104,28 @@ main (int argc, char *argv[])
   //////////////////////////////////////////////////////////////////
   // Initial operations
 
-  if (argc < 3)
+  if (argc < 4)
     {
       WARNING ("You must provide the node type, id and IP address:");
       WARNING ("stationd AP|STA id ip_address");
+      WARNING ("or the station counts and first IP address of an engine:");
+      WARNING ("stationd ENGINE ap_count sta_count first_ip_address \
+[duration_s]");
       return ERROR;
     }
 
-  if (strncmp (argv[1], "AP", 2) == 0)
+  if (strncmp (argv[1], "ENGINE", 6) == 0)
+    {
+      if (argc < 5 || inet_aton (argv[4], &station_ip) == 0)
+	{
+	  WARNING ("stationd ENGINE ap_count sta_count first_ip_address \
+[duration_s]");
+	  return ERROR;
+	}
+      return run_engine (atoi (argv[2]), atoi (argv[3]), station_ip,
+			 (argc > 5) ? atoi (argv[5]) : 10);
+    }
+  else if (strncmp (argv[1], "AP", 2) == 0)
     is_ap = TRUE;
   else if (strncmp (argv[1], "STA", 3) == 0)
     is_ap = FALSE;
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2006-2013 The StarBED Project  All rights reserved.
+ *
+ * See the file 'LICENSE' for licensing information.
+ *
+ */
+
+/************************************************************************
+ *
+ * QOMET Emulator Implementation
+ *
+ * File name: test_station_stress.c
+ * Function: Stress test of the lock-free association state
+ *
+ ***********************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "station.h"
+#include "station_global.h"
+#include "station_message.h"
+
+// default number of AP threads and test duration in s
+#define DEF_AP_COUNT            16
+#define DEF_DURATION            2
+
+// interval of the association timeout checks in us
+#define TIMEOUT_CHECK_US        10000
+
+// state of an AP thread; AP 0 is the one the station associates with,
+// and its thread also plays the listen thread by associating again
+// after a drop; with one CPU, the timeout thread may drop the
+// association whenever AP 0 is not scheduled for TIMEOUT_CHECK_US
+struct ap_thread
+{
+  pthread_t thread;
+  unsigned id;
+  struct in_addr ip_address;
+  unsigned long beacon_count;
+  unsigned long counted_count;
+  unsigned long dropped_count;
+};
+
+// the regular station shared by all threads
+static struct station_class station;
+
+// set to stop the threads
+static volatile int do_interrupt = FALSE;
+
+// drops done by the timeout thread, and its beacon snapshot
+static unsigned long timeout_drop_count = 0;
+static uint32_t beacon_snapshot = 0;
+
+// send beacons as fast as possible until interrupted
+static void *
+ap_routine (void *arg)
+{
+  struct ap_thread *ap = (struct ap_thread *) arg;
+  int beacon_state;
+
+  while (do_interrupt == FALSE)
+    {
+      beacon_state = sta_state_beacon (&station, ap->ip_address);
+      ap->beacon_count++;
+
+      if (beacon_state == STA_BEACON_COUNTED)
+	ap->counted_count++;
+      else if (beacon_state == STA_BEACON_DROPPED)
+	ap->dropped_count++;
+
+      // any beacon reports a drop, but only AP 0 is associated with
+      if (ap->id == 0 && beacon_state != STA_BEACON_COUNTED
+	  && beacon_state != STA_BEACON_IGNORED)
+	sta_state_associate (&station, ap->ip_address);
+    }
+
+  return NULL;
+}
+
+// check the association every TIMEOUT_CHECK_US until interrupted
+static void *
+timeout_routine (void *arg)
+{
+  while (do_interrupt == FALSE)
+    {
+      usleep (TIMEOUT_CHECK_US);
+      if (sta_state_timeout (&station, &beacon_snapshot) == TRUE)
+	timeout_drop_count++;
+    }
+
+  return NULL;
+}
+
+// main function of the program
+int
+main (int argc, char *argv[])
+{
+  unsigned ap_count = (argc > 1) ? atoi (argv[1]) : DEF_AP_COUNT;
+  unsigned duration = (argc > 2) ? atoi (argv[2]) : DEF_DURATION;
+  struct ap_thread *aps;
+  pthread_t timeout_thread;
+  unsigned long beacon_total = 0, counted_total = 0, dropped_total = 0;
+  unsigned ap_i;
+  int result = SUCCESS;
+
+  if (ap_count == 0 || duration == 0)
+    {
+      WARNING ("Usage: test_station_stress [ap_count] [duration_s]");
+      return ERROR;
+    }
+
+  INFO ("STRESS TEST STARTED FOR station LIBRARY: %u APs for %u s.",
+	ap_count, duration);
+
+  aps = (struct ap_thread *) calloc (ap_count, sizeof (struct ap_thread));
+  if (aps == NULL)
+    {
+      WARNING ("Cannot allocate memory for %u APs", ap_count);
+      return ERROR;
+    }
+
+  station.is_access_point = FALSE;
+  station.association_state = 0;
+  for (ap_i = 0; ap_i < ap_count; ap_i++)
+    {
+      aps[ap_i].id = ap_i;
+      aps[ap_i].ip_address.s_addr = htonl (0x0a000001 + ap_i);
+    }
+  sta_state_associate (&station, aps[0].ip_address);
+
+  if (pthread_create (&timeout_thread, NULL, timeout_routine, NULL) != 0)
+    {
+      WARNING ("Could not create association timeout thread.");
+      return ERROR;
+    }
+  for (ap_i = 0; ap_i < ap_count; ap_i++)
+    if (pthread_create (&aps[ap_i].thread, NULL, ap_routine, &aps[ap_i])
+	!= 0)
+      {
+	WARNING ("Could not create AP thread %u.", ap_i);
+	return ERROR;
+      }
+
+  sleep (duration);
+  do_interrupt = TRUE;
+
+  for (ap_i = 0; ap_i < ap_count; ap_i++)
+    {
+      pthread_join (aps[ap_i].thread, NULL);
+      beacon_total += aps[ap_i].beacon_count;
+      counted_total += aps[ap_i].counted_count;
+      dropped_total += aps[ap_i].dropped_count;
+      if (ap_i != 0 && aps[ap_i].counted_count != 0)
+	{
+	  WARNING ("AP %u is not associated but %lu of its beacons were \
+counted.", ap_i, aps[ap_i].counted_count);
+	  result = ERROR;
+	}
+    }
+  pthread_join (timeout_thread, NULL);
+
+  INFO ("Processed %lu beacons (%.1f M/s), %lu counted, %lu drops by \
+timeout.", beacon_total, beacon_total / 1e6 / duration, counted_total,
+	timeout_drop_count);
+
+  // no beacon count was lost or duplicated
+  if (sta_state_beacon_count (&station) != (uint32_t) counted_total)
+    {
+      WARNING ("Beacon counter is %u but %lu beacons were counted.",
+	       sta_state_beacon_count (&station), counted_total);
+      result = ERROR;
+    }
+
+  // without beacons, the next check drops the association, and the
+  // next beacon of AP 0 sees the drop once
+  if (sta_state_is_associated (&station) == TRUE)
+    {
+      if (sta_state_timeout (&station, &beacon_snapshot) == TRUE)
+	timeout_drop_count++;
+      else
+	{
+	  WARNING ("Association was not dropped without beacons.");
+	  result = ERROR;
+	}
+    }
+  if (sta_state_timeout (&station, &beacon_snapshot) == TRUE)
+    {
+      WARNING ("Association was dropped twice.");
+      result = ERROR;
+    }
+  if (sta_state_beacon (&station, aps[0].ip_address) == STA_BEACON_DROPPED)
+    dropped_total++;
+  if (sta_state_beacon (&station, aps[0].ip_address)
+      != STA_BEACON_UNASSOCIATED)
+    {
+      WARNING ("Station is still associated after the drop.");
+      result = ERROR;
+    }
+
+  // every drop was seen exactly once
+  if (dropped_total != timeout_drop_count)
+    {
+      WARNING ("%lu drops by timeout but %lu seen by beacons.",
+	       timeout_drop_count, dropped_total);
+      result = ERROR;
+    }
+
+  free (aps);
+
+  if (result == ERROR)
+    INFO ("TEST RESULT: completed with ERRORS.");
+  else
+    INFO ("TEST RESULT: completed successfully.");
+
+  return result;
+}
@@ -11,7 +11,8 @@
  * QOMET Emulator Implementation
  *
  * File name: test_timer.c
- * Function: Tests the timer library implementation
+ * Function: Tests the timer library implementation and benchmarks
+ *           the wake-up lateness of the timer backends
  *
  * Author: Razvan Beuran
  *
@@ -25,14 +26,24 @@
 #include <stdio.h>
 #include <time.h>
 #include <math.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #include "timer_global.h"
 #include "timer_message.h"
 #include "timer.h"
+#include "timer_wheel.h"
 
-// main function of the program
-int
-main ()
+// test the accuracy of a long sequence of timer_wait calls; return
+// SUCCESS or ERROR
+static int
+test_duration (void)
 {
   // timer handle
   struct timer_handle timer;
@@ -131,3 +142,561 @@ exceeds threshold (%.4f ms)", duration_error_ms, DURATION_ERROR_MS_THRESH);
   else
     return SUCCESS;
 }
+
+
+/////////////////////////////////////////////
+// Wake-up lateness benchmark
+/////////////////////////////////////////////
+
+// default number of wake-ups per run
+#define BENCH_DEF_SAMPLES       10000
+
+// default spin margin of the hybrid backend in us
+#define BENCH_DEF_SPIN_US       50
+
+// maximum number of periods in a benchmark
+#define BENCH_MAX_PERIODS       16
+
+// parameters of a benchmark run
+struct bench_run
+{
+  // the timer used by the library backends
+  struct timer_handle timer;
+
+  // wake-up period in s, number of wake-ups, and spin margin in ns
+  double period;
+  int samples;
+  uint64_t spin_ns;
+
+  // lateness of each wake-up in ns; negative if early
+  int64_t *lateness;
+};
+
+// a timer backend: wait for wake-ups at logical times 'period',
+// 2 * 'period', ... of 'timer' and record their lateness; return
+// SUCCESS or ERROR
+struct bench_backend
+{
+  const char *name;
+  int (*run) (struct bench_run *run);
+};
+
+// a synthetic load
+struct bench_load
+{
+  const char *name;
+  void *(*thread) (void *arg);
+};
+
+// set to stop the load threads
+static volatile int load_stop;
+
+// convert a timespec to ns
+static uint64_t
+timespec2ns (struct timespec *time_spec)
+{
+  return (uint64_t) time_spec->tv_sec * 1000000000ULL + time_spec->tv_nsec;
+}
+
+// return the current TIMER_TYPE time in ns
+static uint64_t
+now_ns (void)
+{
+  struct timespec crt_tp;
+
+  clock_gettime (TIMER_TYPE, &crt_tp);
+  return timespec2ns (&crt_tp);
+}
+
+// return the TIMER_TYPE time in ns of logical time 'seconds'
+static uint64_t
+deadline_ns (struct bench_run *run, double seconds)
+{
+  struct timespec next_tp;
+
+  next_tp = compute_next_time (&run->timer, seconds);
+  return timespec2ns (&next_tp);
+}
+
+// clock_nanosleep, through timer_wait; note that timer_wait takes
+// the time as a float, hence the deadline is rounded the same way
+static int
+bench_nanosleep (struct bench_run *run)
+{
+  float next_time;
+  int i;
+
+  for (i = 0; i < run->samples; i++)
+    {
+      next_time = (i + 1) * run->period;
+      if (timer_wait (&run->timer, next_time) != 0)
+	return ERROR;
+      run->lateness[i] = now_ns () - deadline_ns (run, next_time);
+    }
+
+  return SUCCESS;
+}
+
+// timerfd, through timer_arm_fd, waited for by poll
+static int
+bench_timerfd (struct bench_run *run)
+{
+  struct pollfd pfd;
+  double next_time;
+  int i;
+
+  if ((pfd.fd = timer_open_fd (&run->timer)) < 0)
+    return ERROR;
+  pfd.events = POLLIN;
+
+  for (i = 0; i < run->samples; i++)
+    {
+      next_time = (i + 1) * run->period;
+      if (timer_arm_fd (&run->timer, next_time) != 0)
+	break;
+      while (poll (&pfd, 1, -1) < 0 && errno == EINTR)
+	;
+      timer_read_fd (&run->timer);
+      run->lateness[i] = now_ns () - deadline_ns (run, next_time);
+    }
+
+  timer_close_fd (&run->timer);
+
+  return (i == run->samples) ? SUCCESS : ERROR;
+}
+
+// hybrid: clock_nanosleep until 'spin_ns' before the deadline, then
+// busy-wait on the clock
+static int
+bench_spin (struct bench_run *run)
+{
+  struct timespec sleep_tp;
+  uint64_t deadline, crt_ns;
+  int i;
+
+  for (i = 0; i < run->samples; i++)
+    {
+      deadline = deadline_ns (run, (i + 1) * run->period);
+      if (deadline > run->spin_ns)
+	{
+	  sleep_tp.tv_sec = (deadline - run->spin_ns) / 1000000000ULL;
+	  sleep_tp.tv_nsec = (deadline - run->spin_ns) % 1000000000ULL;
+	  clock_nanosleep (TIMER_TYPE, TIMER_ABSTIME, &sleep_tp, NULL);
+	}
+      while ((crt_ns = now_ns ()) < deadline)
+	;
+      run->lateness[i] = crt_ns - deadline;
+    }
+
+  return SUCCESS;
+}
+
+// callback and state of the timing wheel backend
+struct bench_wheel_event
+{
+  struct timer_wheel_event event;
+  uint64_t wakeup_ns;
+  sem_t done;
+};
+
+static void
+bench_wheel_callback (struct timer_wheel_event *event, void *arg)
+{
+  struct bench_wheel_event *wheel_event = (struct bench_wheel_event *) arg;
+
+  wheel_event->wakeup_ns = now_ns ();
+  sem_post (&wheel_event->done);
+}
+
+// timing wheel, with the default tick, run by its clock thread
+static int
+bench_wheel (struct bench_run *run)
+{
+  struct timer_wheel *wheel;
+  struct bench_wheel_event wheel_event;
+  uint64_t deadline;
+  int i;
+
+  if ((wheel = timer_wheel_create (0)) == NULL)
+    return ERROR;
+  if (timer_wheel_start (wheel) == ERROR)
+    {
+      timer_wheel_destroy (wheel);
+      return ERROR;
+    }
+  timer_wheel_event_init (&wheel_event.event, bench_wheel_callback,
+			  &wheel_event);
+  sem_init (&wheel_event.done, 0, 0);
+
+  for (i = 0; i < run->samples; i++)
+    {
+      deadline = deadline_ns (run, (i + 1) * run->period);
+      timer_wheel_add (wheel, &wheel_event.event, deadline);
+      while (sem_wait (&wheel_event.done) < 0 && errno == EINTR)
+	;
+      run->lateness[i] = wheel_event.wakeup_ns - deadline;
+    }
+
+  sem_destroy (&wheel_event.done);
+  timer_wheel_destroy (wheel);
+
+  return SUCCESS;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// read the time stamp counter
+static __inline uint64_t
+rdtsc (void)
+{
+  uint32_t low, high;
+
+  __asm__ __volatile__ ("rdtsc":"=a" (low), "=d" (high));
+  return ((uint64_t) high << 32) | low;
+}
+
+// return the CPU frequency in Hz from /proc/cpuinfo, or 0
+static uint64_t
+cpu_frequency (void)
+{
+  char line[256];
+  double mhz = 0;
+  FILE *cpuinfo;
+
+  if ((cpuinfo = fopen ("/proc/cpuinfo", "r")) == NULL)
+    return 0;
+  while (fgets (line, sizeof (line), cpuinfo) != NULL)
+    if (sscanf (line, "cpu MHz : %lf", &mhz) == 1)
+      break;
+  fclose (cpuinfo);
+
+  return (uint64_t) (mhz * 1e6);
+}
+
+// time stamp counter polled every 100 us, the way meteor used to wait
+// before the timerfd backend; it assumes a constant TSC at the
+// frequency reported by /proc/cpuinfo
+static int
+bench_rdtsc (struct bench_run *run)
+{
+  uint64_t frequency, zero_tsc, zero, next_event, deadline;
+  int i;
+
+  if ((frequency = cpu_frequency ()) == 0)
+    {
+      WARNING ("Cannot read the CPU frequency");
+      return ERROR;
+    }
+
+  // take the two "zero" references as close as possible
+  zero_tsc = rdtsc ();
+  zero = now_ns ();
+
+  for (i = 0; i < run->samples; i++)
+    {
+      deadline = (uint64_t) ((i + 1) * run->period * 1e9);
+      next_event = zero_tsc + (uint64_t) (frequency * (deadline / 1e9));
+      while (rdtsc () <= next_event)
+	usleep (100);
+      run->lateness[i] = now_ns () - (zero + deadline);
+    }
+
+  return SUCCESS;
+}
+#endif
+
+// CPU load: spin on every CPU
+static void *
+load_cpu (void *arg)
+{
+  volatile uint64_t counter = 0;
+
+  while (!load_stop)
+    counter++;
+
+  return NULL;
+}
+
+// netlink load: dump the link table of the kernel continuously, which
+// is what the wireconf programs compete with when updating tc rules
+static void *
+load_netlink (void *arg)
+{
+  struct
+  {
+    struct nlmsghdr header;
+    struct rtgenmsg message;
+  } request;
+  char buffer[16384];
+  struct nlmsghdr *reply;
+  int sock, length, done;
+
+  if ((sock = socket (AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0)
+    {
+      WARNING ("Cannot open netlink socket: %s", strerror (errno));
+      return NULL;
+    }
+
+  memset (&request, 0, sizeof (request));
+  request.header.nlmsg_len = sizeof (request);
+  request.header.nlmsg_type = RTM_GETLINK;
+  request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  request.message.rtgen_family = AF_UNSPEC;
+
+  while (!load_stop)
+    {
+      request.header.nlmsg_seq++;
+      if (send (sock, &request, sizeof (request), 0) < 0)
+	break;
+      for (done = FALSE; !done && !load_stop;)
+	{
+	  if ((length = recv (sock, buffer, sizeof (buffer), 0)) <= 0)
+	    break;
+	  for (reply = (struct nlmsghdr *) buffer; NLMSG_OK (reply, length);
+	       reply = NLMSG_NEXT (reply, length))
+	    if (reply->nlmsg_type == NLMSG_DONE
+		|| reply->nlmsg_type == NLMSG_ERROR)
+	      done = TRUE;
+	}
+    }
+
+  close (sock);
+
+  return NULL;
+}
+
+static struct bench_backend bench_backends[] = {
+  {"nanosleep", bench_nanosleep},
+  {"timerfd", bench_timerfd},
+  {"spin", bench_spin},
+  {"wheel", bench_wheel},
+#if defined(__x86_64__) || defined(__i386__)
+  {"rdtsc", bench_rdtsc},
+#endif
+  {NULL, NULL}
+};
+
+static struct bench_load bench_loads[] = {
+  {"none", NULL},
+  {"cpu", load_cpu},
+  {"netlink", load_netlink},
+  {NULL, NULL}
+};
+
+// return TRUE if 'name' is in the comma-separated 'list', or if
+// 'list' is NULL
+static int
+in_list (const char *list, const char *name)
+{
+  size_t length = strlen (name);
+  const char *position;
+
+  if (list == NULL)
+    return TRUE;
+  for (position = list; (position = strstr (position, name)) != NULL;
+       position += length)
+    if ((position == list || position[-1] == ',')
+	&& (position[length] == ',' || position[length] == '\0'))
+      return TRUE;
+
+  return FALSE;
+}
+
+static int
+compare_int64 (const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+// return the 'fraction' quantile of the sorted samples, in us
+static double
+quantile_us (int64_t *sorted, int count, double fraction)
+{
+  int index = (int) ceil (fraction * count) - 1;
+
+  if (index < 0)
+    index = 0;
+  return sorted[index] / 1e3;
+}
+
+// run all selected backends at all periods under one load, and print
+// one CSV line per run; return SUCCESS or ERROR
+static int
+bench_load_run (FILE *output, struct bench_load *load, const char *backends,
+		double *periods, int period_count, struct bench_run *run)
+{
+  pthread_t threads[256];
+  int thread_count = 0, thread_i, period_i, i, early;
+  struct bench_backend *backend;
+  int ret = SUCCESS;
+
+  // start one CPU load thread per CPU, one netlink load thread
+  load_stop = FALSE;
+  if (load->thread != NULL)
+    {
+      int count = (load->thread == load_cpu) ?
+	sysconf (_SC_NPROCESSORS_ONLN) : 1;
+      for (; thread_count < count && thread_count < 256; thread_count++)
+	if (pthread_create (&threads[thread_count], NULL, load->thread,
+			    NULL) != 0)
+	  break;
+    }
+
+  for (backend = bench_backends; backend->name != NULL; backend++)
+    {
+      if (!in_list (backends, backend->name))
+	continue;
+      for (period_i = 0; period_i < period_count; period_i++)
+	{
+	  run->period = periods[period_i];
+	  timer_reset (&run->timer, 0.0);
+	  if (backend->run (run) == ERROR)
+	    {
+	      WARNING ("Backend %s failed", backend->name);
+	      ret = ERROR;
+	      continue;
+	    }
+
+	  for (i = 0, early = 0; i < run->samples; i++)
+	    if (run->lateness[i] < 0)
+	      early++;
+	  qsort (run->lateness, run->samples, sizeof (int64_t),
+		 compare_int64);
+	  fprintf (output, "%s,%.0f,%s,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+		   backend->name, run->period * 1e6, load->name,
+		   run->samples, early, run->lateness[0] / 1e3,
+		   quantile_us (run->lateness, run->samples, 0.5),
+		   quantile_us (run->lateness, run->samples, 0.99),
+		   quantile_us (run->lateness, run->samples, 0.999),
+		   run->lateness[run->samples - 1] / 1e3);
+	  fflush (output);
+	}
+    }
+
+  load_stop = TRUE;
+  for (thread_i = 0; thread_i < thread_count; thread_i++)
+    pthread_join (threads[thread_i], NULL);
+
+  return ret;
+}
+
+// print the usage of the program
+static void
+usage (void)
+{
+  struct bench_backend *backend;
+
+  fprintf (stderr, "Usage: test_timer [-b <backend>[,<backend>...]] \
+[-p <period_us>[,<period_us>...]]\n\t[-n <samples>] \
+[-l <load>[,<load>...]] [-s <spin_us>] [-o <csv_file>]\n\n");
+  fprintf (stderr, "Without options, test the accuracy of timer_wait. \
+With options, measure the\nwake-up lateness of each backend and print \
+its distribution as CSV.\n\n");
+  fprintf (stderr, "\t-b, --backend: Backends (default all):");
+  for (backend = bench_backends; backend->name != NULL; backend++)
+    fprintf (stderr, " %s", backend->name);
+  fprintf (stderr, "\n\t-p, --period: Wake-up periods in us \
+(default 100,1000,10000).\n");
+  fprintf (stderr, "\t-n, --samples: Wake-ups per run (default %d).\n",
+	   BENCH_DEF_SAMPLES);
+  fprintf (stderr, "\t-l, --load: Synthetic loads, none, cpu or netlink \
+(default none).\n");
+  fprintf (stderr, "\t-s, --spin: Spin margin of the spin backend in us \
+(default %d).\n", BENCH_DEF_SPIN_US);
+  fprintf (stderr, "\t-o, --output: CSV output file (default stdout).\n");
+}
+
+// main function of the program
+int
+main (int argc, char *argv[])
+{
+  static struct option long_options[] = {
+    {"backend", 1, NULL, 'b'},
+    {"period", 1, NULL, 'p'},
+    {"samples", 1, NULL, 'n'},
+    {"load", 1, NULL, 'l'},
+    {"spin", 1, NULL, 's'},
+    {"output", 1, NULL, 'o'},
+    {"help", 0, NULL, 'h'},
+    {0, 0, 0, 0}
+  };
+  const char *backends = NULL, *loads = "none";
+  char period_list[256] = "100,1000,10000", *token;
+  double periods[BENCH_MAX_PERIODS];
+  int period_count = 0;
+  struct bench_run run;
+  struct bench_load *load;
+  FILE *output = stdout;
+  int c, ret = SUCCESS;
+
+  // the original accuracy test
+  if (argc == 1)
+    return test_duration ();
+
+  memset (&run, 0, sizeof (run));
+  run.samples = BENCH_DEF_SAMPLES;
+  run.spin_ns = BENCH_DEF_SPIN_US * 1000ULL;
+
+  while ((c = getopt_long (argc, argv, "b:p:n:l:s:o:h", long_options,
+			   NULL)) != -1)
+    switch (c)
+      {
+      case 'b':
+	backends = optarg;
+	break;
+      case 'p':
+	strncpy (period_list, optarg, sizeof (period_list) - 1);
+	break;
+      case 'n':
+	run.samples = atoi (optarg);
+	break;
+      case 'l':
+	loads = optarg;
+	break;
+      case 's':
+	run.spin_ns = atoi (optarg) * 1000ULL;
+	break;
+      case 'o':
+	if ((output = fopen (optarg, "w")) == NULL)
+	  {
+	    WARNING ("Cannot open output file '%s'", optarg);
+	    return ERROR;
+	  }
+	break;
+      default:
+	usage ();
+	return ERROR;
+      }
+
+  for (token = strtok (period_list, ","); token != NULL
+       && period_count < BENCH_MAX_PERIODS; token = strtok (NULL, ","))
+    if ((periods[period_count] = atof (token) / 1e6) > 0)
+      period_count++;
+  if (period_count == 0 || run.samples <= 0)
+    {
+      usage ();
+      return ERROR;
+    }
+
+  run.lateness = (int64_t *) malloc (run.samples * sizeof (int64_t));
+  if (run.lateness == NULL)
+    {
+      WARNING ("Cannot allocate memory for %d samples", run.samples);
+      return ERROR;
+    }
+
+  fprintf (output, "backend,period_us,load,samples,early,min_us,p50_us,\
+p99_us,p999_us,max_us\n");
+  for (load = bench_loads; load->name != NULL; load++)
+    if (in_list (loads, load->name)
+	&& bench_load_run (output, load, backends, periods, period_count,
+			   &run) == ERROR)
+      ret = ERROR;
+
+  free (run.lateness);
+  if (output != stdout)
+    fclose (output);
+
+  return ret;
+}
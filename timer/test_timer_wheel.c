@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2006-2013 The StarBED Project  All rights reserved.
+ *
+ * See the file 'LICENSE' for licensing information.
+ *
+ */
+
+/************************************************************************
+ *
+ * QOMET Emulator Implementation
+ *
+ * File name: test_timer_wheel.c
+ * Function: Test program for the timing wheel of the timer library
+ *
+ ***********************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "timer_global.h"
+#include "timer_message.h"
+#include "timer.h"
+#include "timer_wheel.h"
+
+// number of events of the simulated-time test
+#define SIM_EVENT_COUNT         1000000
+
+// range of their expiration times in ns
+#define SIM_RANGE_NS            10000000000ULL
+
+// number of events and range of the clock thread test
+#define CLOCK_EVENT_COUNT       10000
+#define CLOCK_RANGE_NS          1000000000ULL
+
+// event of the tests
+struct test_event
+{
+  struct timer_wheel_event event;
+  uint64_t expires_ns;
+  uint64_t fired_ns;
+  int fired;
+  int cancelled;
+};
+
+// time passed to the current and to the previous call of
+// timer_wheel_advance in the simulated-time test
+static uint64_t sim_now_ns;
+static uint64_t sim_prev_ns;
+
+// number of errors found by the callbacks
+static int error_count;
+
+// callback of the simulated-time test
+static void
+sim_callback (struct timer_wheel_event *event, void *arg)
+{
+  struct test_event *test = (struct test_event *) arg;
+
+  if (test->fired || test->cancelled)
+    error_count++;
+  // the event must not fire before its time, nor miss the call of
+  // timer_wheel_advance that first passes it by more than a tick
+  if (sim_now_ns < test->expires_ns)
+    error_count++;
+  if (sim_prev_ns >= test->expires_ns + TIMER_WHEEL_DEF_TICK_NS)
+    error_count++;
+  test->fired = TRUE;
+}
+
+// callback of the clock thread test
+static void
+clock_callback (struct timer_wheel_event *event, void *arg)
+{
+  struct test_event *test = (struct test_event *) arg;
+
+  test->fired_ns = timer_wheel_time_ns ();
+  __atomic_store_n (&test->fired, TRUE, __ATOMIC_RELEASE);
+}
+
+// test the wheel driven by timer_wheel_advance with simulated time;
+// return SUCCESS or ERROR
+static int
+test_simulated (void)
+{
+  struct timer_wheel *wheel;
+  struct test_event *tests;
+  struct timespec start_tp, end_tp;
+  double add_ns, cancel_ns;
+  int i, fired = 0, cancelled = 0;
+
+  wheel = timer_wheel_create (0);
+  tests = (struct test_event *) calloc (SIM_EVENT_COUNT,
+					sizeof (struct test_event));
+  if (wheel == NULL || tests == NULL)
+    {
+      WARNING ("Cannot allocate memory for the test");
+      return ERROR;
+    }
+
+  srandom (1);
+  sim_now_ns = wheel->zero_ns;
+  sim_prev_ns = wheel->zero_ns;
+
+  clock_gettime (TIMER_TYPE, &start_tp);
+  for (i = 0; i < SIM_EVENT_COUNT; i++)
+    {
+      tests[i].expires_ns = wheel->zero_ns
+	+ (((uint64_t) random () << 16) ^ random ()) % SIM_RANGE_NS;
+      timer_wheel_event_init (&tests[i].event, sim_callback, &tests[i]);
+      timer_wheel_add (wheel, &tests[i].event, tests[i].expires_ns);
+    }
+  clock_gettime (TIMER_TYPE, &end_tp);
+  add_ns = ((end_tp.tv_sec - start_tp.tv_sec) * 1e9
+	    + (end_tp.tv_nsec - start_tp.tv_nsec)) / SIM_EVENT_COUNT;
+
+  clock_gettime (TIMER_TYPE, &start_tp);
+  for (i = 0; i < SIM_EVENT_COUNT; i += 3)
+    {
+      timer_wheel_cancel (wheel, &tests[i].event);
+      tests[i].cancelled = TRUE;
+      cancelled++;
+    }
+  clock_gettime (TIMER_TYPE, &end_tp);
+  cancel_ns = ((end_tp.tv_sec - start_tp.tv_sec) * 1e9
+	       + (end_tp.tv_nsec - start_tp.tv_nsec)) / cancelled;
+
+  INFO ("Added %d events (%.1f ns each), cancelled %d (%.1f ns each)",
+	SIM_EVENT_COUNT, add_ns, cancelled, cancel_ns);
+
+  // advance in irregular steps of up to 10 ms
+  while (wheel->pending > 0)
+    {
+      sim_prev_ns = sim_now_ns;
+      sim_now_ns += random () % 10000000;
+      fired += timer_wheel_advance (wheel, sim_now_ns);
+    }
+
+  for (i = 0; i < SIM_EVENT_COUNT; i++)
+    if (!tests[i].fired && !tests[i].cancelled)
+      error_count++;
+
+  INFO ("Fired %d events, %d errors", fired, error_count);
+
+  timer_wheel_destroy (wheel);
+  free (tests);
+
+  return (error_count == 0
+	  && fired == SIM_EVENT_COUNT - cancelled) ? SUCCESS : ERROR;
+}
+
+// test the wheel driven by its clock thread; return SUCCESS or ERROR
+static int
+test_clock (void)
+{
+  struct timer_wheel *wheel;
+  struct test_event *tests;
+  uint64_t start_ns, late_ns, max_late_ns = 0;
+  double total_late_ns = 0;
+  int i;
+
+  wheel = timer_wheel_create (0);
+  tests = (struct test_event *) calloc (CLOCK_EVENT_COUNT,
+					sizeof (struct test_event));
+  if (wheel == NULL || tests == NULL)
+    {
+      WARNING ("Cannot allocate memory for the test");
+      return ERROR;
+    }
+
+  if (timer_wheel_start (wheel) == ERROR)
+    return ERROR;
+
+  start_ns = timer_wheel_time_ns ();
+  for (i = 0; i < CLOCK_EVENT_COUNT; i++)
+    {
+      tests[i].expires_ns = start_ns + random () % CLOCK_RANGE_NS;
+      timer_wheel_event_init (&tests[i].event, clock_callback, &tests[i]);
+      timer_wheel_add (wheel, &tests[i].event, tests[i].expires_ns);
+    }
+
+  // wait for the last events, with some margin
+  usleep ((CLOCK_RANGE_NS / 1000) + 100000);
+  timer_wheel_stop (wheel);
+
+  for (i = 0; i < CLOCK_EVENT_COUNT; i++)
+    {
+      if (!__atomic_load_n (&tests[i].fired, __ATOMIC_ACQUIRE)
+	  || tests[i].fired_ns < tests[i].expires_ns)
+	{
+	  error_count++;
+	  continue;
+	}
+      late_ns = tests[i].fired_ns - tests[i].expires_ns;
+      total_late_ns += late_ns;
+      if (late_ns > max_late_ns)
+	max_late_ns = late_ns;
+    }
+
+  INFO ("Clock thread: %d events, lateness avg=%.1f us max=%.1f us, \
+%d errors", CLOCK_EVENT_COUNT, total_late_ns / CLOCK_EVENT_COUNT / 1e3,
+	max_late_ns / 1e3, error_count);
+
+  timer_wheel_destroy (wheel);
+  free (tests);
+
+  return (error_count == 0) ? SUCCESS : ERROR;
+}
+
+// main function of the program
+int
+main ()
+{
+  INFO ("Testing timing wheel with simulated time...");
+  if (test_simulated () == ERROR)
+    {
+      WARNING ("Simulated time test failed");
+      return ERROR;
+    }
+
+  INFO ("Testing timing wheel with its clock thread...");
+  if (test_clock () == ERROR)
+    {
+      WARNING ("Clock thread test failed");
+      return ERROR;
+    }
+
+  return SUCCESS;
+}
@@ -24,6 +24,11 @@
 
 #include <time.h>
 #include <math.h>
+#include <errno.h>
+
+#ifdef __linux
+#include <sys/timerfd.h>
+#endif
 
 #include "timer_global.h"
 #include "timer_message.h"
@@ -148,10 +153,90 @@ double
 timer_elapsed_time (struct timer_handle *handle)
 {
   struct timespec crt_tp;
+  // timespec_diff2sec normalizes its second argument in place, which
+  // would leave a negative tv_nsec in the "zero" of the timer
+  struct timespec zero_tp = handle->zero_tp;
 
   // get current time
   clock_gettime (TIMER_TYPE, &crt_tp);
   DEBUG_print_timespec (&crt_tp);
 
-  return timespec_diff2sec (&crt_tp, &(handle->zero_tp));
+  return timespec_diff2sec (&crt_tp, &zero_tp);
+}
+
+#ifdef __linux
+// open the timerfd of the timer; return its file descriptor, 
+// or -1 on error
+int
+timer_open_fd (struct timer_handle *handle)
+{
+  handle->fd = timerfd_create (TIMER_TYPE, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (handle->fd < 0)
+    {
+      WARNING ("Cannot create timerfd: %s", strerror (errno));
+      return -1;
+    }
+
+  return handle->fd;
+}
+
+// arm the timerfd to expire once at logical time 'time_in_s', an
+// absolute deadline relative to the timer "zero"; a deadline in the
+// past expires immediately; return 0 on success, -1 on error
+int
+timer_arm_fd (struct timer_handle *handle, double time_in_s)
+{
+  struct itimerspec its;
+
+  memset (&its, 0, sizeof (its));
+  its.it_value = compute_next_time (handle, time_in_s);
+  DEBUG_print_timespec (&its.it_value);
+
+  // an all-zero it_value would disarm the timer instead
+  if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+    its.it_value.tv_nsec = 1;
+
+  if (timerfd_settime (handle->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+    {
+      WARNING ("Cannot arm timerfd: %s", strerror (errno));
+      return -1;
+    }
+
+  return 0;
+}
+
+// disarm the timerfd; return 0 on success, -1 on error
+int
+timer_disarm_fd (struct timer_handle *handle)
+{
+  struct itimerspec its;
+
+  memset (&its, 0, sizeof (its));
+
+  return timerfd_settime (handle->fd, 0, &its, NULL);
+}
+
+// acknowledge the expiration of the timerfd; return the number of
+// expirations since the last call, 0 if it has not expired yet,
+// or -1 on error
+int
+timer_read_fd (struct timer_handle *handle)
+{
+  uint64_t expirations;
+
+  if (read (handle->fd, &expirations, sizeof (expirations)) !=
+      sizeof (expirations))
+    return (errno == EAGAIN) ? 0 : -1;
+
+  return (int) expirations;
+}
+
+// close the timerfd, unless 'fd' of the handle is -1
+void
+timer_close_fd (struct timer_handle *handle)
+{
+  if (handle->fd >= 0)
+    close (handle->fd);
+  handle->fd = -1;
 }
+#endif
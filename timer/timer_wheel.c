@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) 2006-2013 The StarBED Project  All rights reserved.
+ *
+ * See the file 'LICENSE' for licensing information.
+ *
+ */
+
+/************************************************************************
+ *
+ * QOMET Emulator Implementation
+ *
+ * File name: timer_wheel.c
+ * Function: Hierarchical timing wheel of the timer library
+ *
+ ***********************************************************************/
+
+
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "timer_global.h"
+#include "timer_message.h"
+#include "timer.h"
+#include "timer_wheel.h"
+
+#define SLOT_MASK               (TIMER_WHEEL_SLOTS - 1)
+
+// number of ticks covered by the wheel
+#define WHEEL_SPAN              (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+
+/////////////////////////////////////////////
+// Internal functions
+/////////////////////////////////////////////
+
+static void
+list_init (struct timer_wheel_event *head)
+{
+  head->next = head;
+  head->prev = head;
+}
+
+static int
+list_empty (struct timer_wheel_event *head)
+{
+  return head->next == head;
+}
+
+static void
+list_add_tail (struct timer_wheel_event *head,
+	       struct timer_wheel_event *event)
+{
+  event->prev = head->prev;
+  event->next = head;
+  head->prev->next = event;
+  head->prev = event;
+}
+
+static void
+list_del (struct timer_wheel_event *event)
+{
+  event->prev->next = event->next;
+  event->next->prev = event->prev;
+  event->next = NULL;
+  event->prev = NULL;
+}
+
+// move all events of list 'from' to the end of list 'to'
+static void
+list_splice_tail (struct timer_wheel_event *from,
+		  struct timer_wheel_event *to)
+{
+  if (list_empty (from))
+    return;
+
+  from->next->prev = to->prev;
+  to->prev->next = from->next;
+  from->prev->next = to;
+  to->prev = from->prev;
+  list_init (from);
+}
+
+// link an event into the slot of its expiration tick; must be
+// called with the lock held
+static void
+wheel_link (struct timer_wheel *wheel, struct timer_wheel_event *event)
+{
+  uint64_t expires = event->expires;
+  uint64_t delta;
+  int level;
+
+  // events in the past go to the current tick; events beyond the
+  // span are parked in the last level and linked again from there
+  if (expires < wheel->now)
+    expires = wheel->now;
+  delta = expires - wheel->now;
+  if (delta >= WHEEL_SPAN)
+    {
+      expires = wheel->now + WHEEL_SPAN - 1;
+      delta = WHEEL_SPAN - 1;
+    }
+
+  for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+    if (delta < (1ULL << (TIMER_WHEEL_BITS * (level + 1))))
+      break;
+
+  list_add_tail (&wheel->slots[level]
+		 [(expires >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK],
+		 event);
+}
+
+// move the events of a slot of an upper level to the levels below;
+// must be called with the lock held
+static void
+wheel_cascade (struct timer_wheel *wheel, int level, int index)
+{
+  struct timer_wheel_event list;
+  struct timer_wheel_event *event;
+
+  list_init (&list);
+  list_splice_tail (&wheel->slots[level][index], &list);
+  while (!list_empty (&list))
+    {
+      event = list.next;
+      list_del (event);
+      wheel_link (wheel, event);
+    }
+}
+
+// return the first tick from the current one that has events in level
+// 0 or needs a cascade, i.e. the next tick worth waking up for; the
+// scan covers at most one revolution of level 0
+static uint64_t
+wheel_next_tick (struct timer_wheel *wheel)
+{
+  uint64_t tick = wheel->now;
+
+  while ((tick & SLOT_MASK) != 0
+	 && list_empty (&wheel->slots[0][tick & SLOT_MASK]))
+    tick++;
+
+  return tick;
+}
+
+// convert a TIMER_TYPE time to a tick, rounding up
+static uint64_t
+wheel_tick (struct timer_wheel *wheel, uint64_t time_ns)
+{
+  if (time_ns <= wheel->zero_ns)
+    return 0;
+  return (time_ns - wheel->zero_ns + wheel->tick_ns - 1) / wheel->tick_ns;
+}
+
+// clock thread
+static void *
+wheel_thread (void *arg)
+{
+  struct timer_wheel *wheel = (struct timer_wheel *) arg;
+  uint64_t due_ns;
+  struct timespec due;
+
+  pthread_mutex_lock (&wheel->lock);
+  while (wheel->running)
+    {
+      if (wheel->pending == 0)
+	{
+	  wheel->wake_tick = UINT64_MAX;
+	  pthread_cond_wait (&wheel->wakeup, &wheel->lock);
+	  continue;
+	}
+
+      // sleep until the next tick with work, or until an earlier
+      // event is added; the clock of 'wakeup' is TIMER_TYPE
+      wheel->wake_tick = wheel_next_tick (wheel);
+      due_ns = wheel->zero_ns + wheel->wake_tick * wheel->tick_ns;
+      if (timer_wheel_time_ns () < due_ns)
+	{
+	  due.tv_sec = due_ns / 1000000000ULL;
+	  due.tv_nsec = due_ns % 1000000000ULL;
+	  pthread_cond_timedwait (&wheel->wakeup, &wheel->lock, &due);
+	  continue;
+	}
+
+      wheel->wake_tick = UINT64_MAX;
+      pthread_mutex_unlock (&wheel->lock);
+      timer_wheel_advance (wheel, timer_wheel_time_ns ());
+      pthread_mutex_lock (&wheel->lock);
+    }
+  pthread_mutex_unlock (&wheel->lock);
+
+  return NULL;
+}
+
+
+/////////////////////////////////////////////
+// Functions implemented by the timing wheel
+/////////////////////////////////////////////
+
+// create a timing wheel with ticks of 'tick_ns' ns, or of
+// TIMER_WHEEL_DEF_TICK_NS if 0, starting at the current time;
+// return NULL on error
+struct timer_wheel *
+timer_wheel_create (uint64_t tick_ns)
+{
+  struct timer_wheel *wheel;
+  pthread_condattr_t attr;
+  int level, index;
+
+  wheel = (struct timer_wheel *) calloc (1, sizeof (struct timer_wheel));
+  if (wheel == NULL)
+    {
+      WARNING ("Cannot allocate memory for timing wheel");
+      return NULL;
+    }
+
+  wheel->tick_ns = (tick_ns != 0) ? tick_ns : TIMER_WHEEL_DEF_TICK_NS;
+  wheel->zero_ns = timer_wheel_time_ns ();
+  wheel->wake_tick = UINT64_MAX;
+  for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    for (index = 0; index < TIMER_WHEEL_SLOTS; index++)
+      list_init (&wheel->slots[level][index]);
+
+  pthread_mutex_init (&wheel->lock, NULL);
+  pthread_condattr_init (&attr);
+  if (pthread_condattr_setclock (&attr, TIMER_TYPE) != 0)
+    {
+      WARNING ("Cannot set the clock of the timing wheel condition");
+      pthread_condattr_destroy (&attr);
+      pthread_mutex_destroy (&wheel->lock);
+      free (wheel);
+      return NULL;
+    }
+  pthread_cond_init (&wheel->wakeup, &attr);
+  pthread_condattr_destroy (&attr);
+
+  return wheel;
+}
+
+// stop the clock thread if running, and free the wheel; pending
+// events are dropped without calling their callbacks
+void
+timer_wheel_destroy (struct timer_wheel *wheel)
+{
+  if (wheel == NULL)
+    return;
+
+  timer_wheel_stop (wheel);
+  pthread_cond_destroy (&wheel->wakeup);
+  pthread_mutex_destroy (&wheel->lock);
+  free (wheel);
+}
+
+// return the current TIMER_TYPE time in ns, the clock of all
+// expiration times given to the wheel
+uint64_t
+timer_wheel_time_ns (void)
+{
+  struct timespec now;
+
+  clock_gettime (TIMER_TYPE, &now);
+  return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// initialize an event before its first use
+void
+timer_wheel_event_init (struct timer_wheel_event *event,
+			timer_wheel_callback callback, void *arg)
+{
+  event->next = NULL;
+  event->prev = NULL;
+  event->expires = 0;
+  event->callback = callback;
+  event->arg = arg;
+}
+
+// return TRUE if the event is pending, FALSE otherwise
+int
+timer_wheel_pending (struct timer_wheel_event *event)
+{
+  return (event->next != NULL) ? TRUE : FALSE;
+}
+
+// add an event expiring at TIMER_TYPE time 'expires_ns', rounded up
+// to the next tick; an event already pending is moved; a time in the
+// past expires at the next tick; return SUCCESS or ERROR
+int
+timer_wheel_add (struct timer_wheel *wheel,
+		 struct timer_wheel_event *event, uint64_t expires_ns)
+{
+  if (event->callback == NULL)
+    {
+      WARNING ("Timing wheel event has no callback");
+      return ERROR;
+    }
+
+  pthread_mutex_lock (&wheel->lock);
+
+  if (event->next != NULL)
+    {
+      list_del (event);
+      wheel->pending--;
+    }
+
+  // an empty wheel may be far behind the clock; since there is
+  // nothing to cascade it can jump straight to the current tick
+  if (wheel->pending == 0)
+    {
+      uint64_t now = wheel_tick (wheel, timer_wheel_time_ns ());
+      if (now > wheel->now)
+	wheel->now = now;
+    }
+
+  event->expires = wheel_tick (wheel, expires_ns);
+  wheel_link (wheel, event);
+  wheel->pending++;
+
+  // wake up the clock thread if it sleeps past the new event
+  if (event->expires < wheel->wake_tick)
+    pthread_cond_signal (&wheel->wakeup);
+
+  pthread_mutex_unlock (&wheel->lock);
+
+  return SUCCESS;
+}
+
+// cancel an event if it is pending; once this returns, its callback
+// will not be called unless it was already running
+void
+timer_wheel_cancel (struct timer_wheel *wheel,
+		    struct timer_wheel_event *event)
+{
+  pthread_mutex_lock (&wheel->lock);
+  if (event->next != NULL)
+    {
+      list_del (event);
+      wheel->pending--;
+    }
+  pthread_mutex_unlock (&wheel->lock);
+}
+
+// return the TIMER_TYPE time in ns at which the next tick with work
+// is due, for callers that drive the wheel from their own poll loop,
+// or UINT64_MAX if no event is pending
+uint64_t
+timer_wheel_next_ns (struct timer_wheel *wheel)
+{
+  uint64_t next_ns = UINT64_MAX;
+
+  pthread_mutex_lock (&wheel->lock);
+  if (wheel->pending > 0)
+    next_ns = wheel->zero_ns + wheel_next_tick (wheel) * wheel->tick_ns;
+  pthread_mutex_unlock (&wheel->lock);
+
+  return next_ns;
+}
+
+// process all ticks up to TIMER_TYPE time 'now_ns' and call the
+// callbacks of the expired events in the calling thread; return the
+// number of callbacks called
+int
+timer_wheel_advance (struct timer_wheel *wheel, uint64_t now_ns)
+{
+  struct timer_wheel_event expired;
+  struct timer_wheel_event *event;
+  uint64_t target;
+  int index, level, count = 0;
+
+  list_init (&expired);
+
+  pthread_mutex_lock (&wheel->lock);
+
+  // the tick containing 'now_ns' is due once 'now_ns' reaches its
+  // end, so process the ticks up to and including the one it is in
+  target = (now_ns - wheel->zero_ns) / wheel->tick_ns;
+  if (now_ns < wheel->zero_ns)
+    target = 0;
+
+  while (wheel->now <= target)
+    {
+      if (wheel->pending == 0)
+	{
+	  wheel->now = target + 1;
+	  break;
+	}
+
+      // skip the ticks without events or cascades in one step
+      index = wheel->now & SLOT_MASK;
+      if (index != 0 && list_empty (&wheel->slots[0][index]))
+	{
+	  uint64_t next = wheel_next_tick (wheel);
+	  wheel->now = (next <= target) ? next : target + 1;
+	  continue;
+	}
+
+      if (index == 0)
+	for (level = 1; level < TIMER_WHEEL_LEVELS; level++)
+	  {
+	    int upper = (wheel->now >> (TIMER_WHEEL_BITS * level))
+	      & SLOT_MASK;
+	    wheel_cascade (wheel, level, upper);
+	    if (upper != 0)
+	      break;
+	  }
+
+      list_splice_tail (&wheel->slots[0][index], &expired);
+      wheel->now++;
+    }
+
+  // call the callbacks with the lock released, so that they can add
+  // and cancel events; an event cancelled meanwhile is just unlinked
+  // from 'expired'
+  while (!list_empty (&expired))
+    {
+      event = expired.next;
+      list_del (event);
+      wheel->pending--;
+
+      pthread_mutex_unlock (&wheel->lock);
+      event->callback (event, event->arg);
+      count++;
+      pthread_mutex_lock (&wheel->lock);
+    }
+
+  pthread_mutex_unlock (&wheel->lock);
+
+  return count;
+}
+
+// start the clock thread, which calls timer_wheel_advance as the ticks
+// with events become due; return SUCCESS or ERROR
+int
+timer_wheel_start (struct timer_wheel *wheel)
+{
+  int ret;
+
+  pthread_mutex_lock (&wheel->lock);
+  if (wheel->running)
+    {
+      pthread_mutex_unlock (&wheel->lock);
+      return SUCCESS;
+    }
+  wheel->running = TRUE;
+  pthread_mutex_unlock (&wheel->lock);
+
+  ret = pthread_create (&wheel->thread, NULL, wheel_thread, wheel);
+  if (ret != 0)
+    {
+      WARNING ("Cannot create timing wheel thread (%s)", strerror (ret));
+      wheel->running = FALSE;
+      return ERROR;
+    }
+
+  return SUCCESS;
+}
+
+// stop the clock thread and wait for it to exit
+void
+timer_wheel_stop (struct timer_wheel *wheel)
+{
+  pthread_mutex_lock (&wheel->lock);
+  if (!wheel->running)
+    {
+      pthread_mutex_unlock (&wheel->lock);
+      return;
+    }
+  wheel->running = FALSE;
+  pthread_cond_signal (&wheel->wakeup);
+  pthread_mutex_unlock (&wheel->lock);
+
+  pthread_join (wheel->thread, NULL);
+}